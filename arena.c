@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+
+void arena_init(Arena *arena, size_t block_size) {
+    arena->head       = NULL;
+    arena->block_size = (block_size ? block_size : ARENA_BLOCK_SIZE);
+}
+
+
+void arena_free(Arena *arena) {
+    if (arena == NULL) { return; }
+
+    ArenaBlock *block = arena->head;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    ArenaBlock *block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        // Oversized allocations get a block of their own
+        size_t block_size = (size > arena->block_size ? size : arena->block_size);
+
+        block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + block_size);
+        if (block == NULL) { return NULL; }
+
+        block->used = 0;
+        block->size = block_size;
+
+        // Keep allocating from the current block if a large request didn't use it up
+        if (arena->head != NULL && size > arena->block_size) {
+            block->next       = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+
+    void *rtn = block->data + block->used;
+    block->used += size;
+    return rtn;
+}
+
+
+char *arena_strndup(Arena *arena, const char *text, size_t length) {
+    char *rtn = (char *)arena_alloc(arena, length + 1);
+    if (rtn == NULL) { return NULL; }
+
+    memcpy(rtn, text, length);
+    rtn[length] = 0;
+    return rtn;
+}
+
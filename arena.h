@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Default size of each block an arena carves allocations out of
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+// Every allocation is rounded up to this alignment
+#define ARENA_ALIGN 16
+
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used, size;
+    char   data[];
+} ArenaBlock;
+
+
+// A bump allocator: allocations are never freed individually, only all at once
+// Not thread safe, give each thread its own arena
+typedef struct Arena {
+    ArenaBlock *head;
+    size_t      block_size;
+} Arena;
+
+
+// Prepares an empty arena, block_size of 0 uses ARENA_BLOCK_SIZE
+void arena_init(Arena *arena, size_t block_size);
+
+// Frees every allocation made from an arena
+void arena_free(Arena *arena);
+
+// Allocates size bytes aligned for any type, returns NULL on failure
+void *arena_alloc(Arena *arena, size_t size);
+
+// Copies length bytes of text and adds a NULL terminator, returns NULL on failure
+char *arena_strndup(Arena *arena, const char *text, size_t length);
+
+#endif /* ARENA_H */
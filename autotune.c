@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "autotune.h"
+
+
+// Batch sizes worth trying, the default is somewhere in the middle
+static const int batch_sizes[] = { 64, 256, 1024, 4096 };
+#define BATCH_SIZE_COUNT (int)(sizeof(batch_sizes) / sizeof(batch_sizes[0]))
+
+
+// What every trial runs with besides the configuration being tried
+typedef struct Trial {
+    Engine       *engine;
+    WordReader   *input;
+
+    // The run's output settings, with everything written to /dev/null
+    OutputConfig  output;
+
+    // Memory for a global candidate set of the trial's own, 0 without one
+    size_t        seen_mb;
+} Trial;
+
+
+// Runs one configuration against the sample with output discarded
+// Returns rule applications per second, or -1 on failure
+static double run_trial(Trial *trial, const EngineConfig *config, double time_limit) {
+    Engine    *engine = trial->engine;
+    WordReader sample;
+    OutputSet  discard;
+    if (input_open_sample(&sample, trial->input) != 0) { return -1; }
+    if (output_open(&discard, &trial->output, config->thread_count) != 0) {
+        input_close(&sample);
+        return -1;
+    }
+
+    // Each trial starts with an empty set, one that had seen the sample before would drop all of it
+    SeenSet seen;
+    bool    dedupe_words = engine->dedupe_words;
+    if (trial->seen_mb) {
+        if (seen_init(&seen, trial->seen_mb) != 0) {
+            output_close(&discard);
+            input_close(&sample);
+            return -1;
+        }
+        engine_set_dedupe(engine, dedupe_words, &seen);
+    }
+
+    EngineStats stats;
+    uint64_t start   = engine_clock();
+    int      rtn     = engine_run(engine, config, &sample, &discard, time_limit, &stats);
+    uint64_t elapsed = engine_clock() - start;
+
+    if (trial->seen_mb) {
+        engine_set_dedupe(engine, dedupe_words, NULL);
+        seen_free(&seen);
+    }
+    output_close(&discard);
+    input_close(&sample);
+    if (rtn != 0) { return -1; }
+
+    #ifdef DEBUG_STATS
+    fprintf(
+        stderr, "Autotune trial: %d threads, batch %d, %s: %lu words in %.3fs\n",
+        config->thread_count, config->batch_size, (config->pin_threads ? "pinned" : "unpinned"),
+        stats.word_count, elapsed / 1e9
+    );
+    #endif
+
+    // Rejected words cost as much as printed ones, so both count
+    return (stats.word_count + stats.reject_count + stats.dupe_count) / (elapsed > 0 ? elapsed / 1e9 : 1e-9);
+}
+
+
+// Runs a trial and keeps its configuration if it beats the best so far
+static int try_config(Trial *trial, const EngineConfig *candidate, double time_limit, EngineConfig *best, double *best_rate) {
+    double rate = run_trial(trial, candidate, time_limit);
+    if (rate < 0) { return -1; }
+
+    if (rate > *best_rate) {
+        *best      = *candidate;
+        *best_rate = rate;
+    }
+    return 0;
+}
+
+
+int autotune(Engine *engine, WordReader *input, const OutputConfig *output, size_t seen_mb, EngineConfig *config) {
+    int sample_count = input_read_ahead(input, AUTOTUNE_SAMPLE_WORDS);
+    if (sample_count < 0) {
+        fprintf(stderr, "ERROR: Failed to read autotune sample\n");
+        return -1;
+    }
+
+    // Nothing to measure, whatever we were going to do is fine
+    if (sample_count == 0 || engine->master.count == 0) { return 0; }
+
+    int cpu_count = (engine->topology.cpu_count > 0 ? engine->topology.cpu_count : 1);
+
+    // Thread counts are powers of two up to the number of CPUs, plus the number of CPUs itself
+    int thread_counts[32];
+    int thread_trials = 0;
+    for (int threads = 1; threads < cpu_count && thread_trials < 31; threads *= 2) {
+        thread_counts[thread_trials++] = threads;
+    }
+    thread_counts[thread_trials++] = cpu_count;
+
+    // Trials pay for the same framing, encoding, compression, partitioning and deduplication as the run
+    // Direct I/O is left out, /dev/null would only warn about it
+    Trial trial = { engine, input, *output, seen_mb };
+    trial.output.discard = true;
+    trial.output.direct  = false;
+
+    // Tune one setting at a time: thread count, then batch size, then pinning
+    double       time_limit = AUTOTUNE_BUDGET / (thread_trials + BATCH_SIZE_COUNT + 1);
+    EngineConfig best       = *config;
+    double       best_rate  = 0;
+
+    EngineConfig candidate = *config;
+    candidate.pin_threads  = true;
+    for (int trial_num = 0; trial_num < thread_trials; trial_num++) {
+        candidate.thread_count = thread_counts[trial_num];
+        if (try_config(&trial, &candidate, time_limit, &best, &best_rate) != 0) { return -1; }
+    }
+
+    candidate = best;
+    for (int size_num = 0; size_num < BATCH_SIZE_COUNT; size_num++) {
+        if (batch_sizes[size_num] == best.batch_size) { continue; }
+
+        candidate.batch_size = batch_sizes[size_num];
+        if (try_config(&trial, &candidate, time_limit, &best, &best_rate) != 0) { return -1; }
+    }
+
+    // Pinning doesn't mean anything for a single worker, so it's turned off rather than saved as if it had been chosen
+    if (best.thread_count > 1) {
+        candidate = best;
+        candidate.pin_threads = false;
+        if (try_config(&trial, &candidate, time_limit, &best, &best_rate) != 0) { return -1; }
+    } else {
+        best.pin_threads = false;
+    }
+
+
+    fprintf(
+        stderr, "Autotune: %d threads, batch size %d, %s (%.0f rules applied per second)\n",
+        best.thread_count, best.batch_size, (best.pin_threads ? "pinned" : "not pinned"), best_rate
+    );
+
+    *config = best;
+    return 0;
+}
+
+
+int config_load(EngineConfig *config, const char *file_name) {
+    FILE *config_file = fopen(file_name, "r");
+    if (config_file == NULL) {
+        fprintf(stderr, "ERROR: Failed to open config file <%s>\n", file_name);
+        return -1;
+    }
+
+    EngineConfig loaded = *config;
+    char line[256];
+    unsigned int line_num = 0;
+    int rtn = 0;
+    while (fgets(line, sizeof(line), config_file) != NULL) {
+        line_num++;
+        if (line[0] == '#' || line[0] == '\n') { continue; }
+
+        char key[64];
+        int  value;
+        if (sscanf(line, " %63[^= ] = %d", key, &value) != 2) {
+            fprintf(stderr, "ERROR: Config file <%s> line <%u> is not a setting\n", file_name, line_num);
+            rtn = -1;
+            break;
+        }
+
+        if (strcmp(key, "threads") == 0 && value >= 1) {
+            loaded.thread_count = value;
+        } else if (strcmp(key, "batch_size") == 0 && value >= 1) {
+            loaded.batch_size = value;
+        } else if (strcmp(key, "pin_threads") == 0) {
+            loaded.pin_threads = (value != 0);
+        } else {
+            fprintf(stderr, "ERROR: Config file <%s> line <%u> has an unknown or invalid setting\n", file_name, line_num);
+            rtn = -1;
+            break;
+        }
+    }
+
+    fclose(config_file);
+    if (rtn == 0) { *config = loaded; }
+    return rtn;
+}
+
+
+int config_save(const EngineConfig *config, const char *file_name) {
+    FILE *config_file = fopen(file_name, "w");
+    if (config_file == NULL) {
+        fprintf(stderr, "ERROR: Failed to open config file <%s>\n", file_name);
+        return -1;
+    }
+
+    fprintf(config_file, "# Written by hcre --autotune, load with --config\n");
+    fprintf(config_file, "threads = %d\n",     config->thread_count);
+    fprintf(config_file, "batch_size = %d\n",  config->batch_size);
+    fprintf(config_file, "pin_threads = %d\n", config->pin_threads ? 1 : 0);
+
+    if (fclose(config_file) != 0) {
+        fprintf(stderr, "ERROR: Failed to write config file <%s>\n", file_name);
+        return -1;
+    }
+    return 0;
+}
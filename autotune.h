@@ -0,0 +1,28 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "engine.h"
+
+// Words read from the start of the input to benchmark with
+// They're still processed normally once tuning is finished
+#define AUTOTUNE_SAMPLE_WORDS 65536
+
+// Seconds the tuner may spend benchmarking, split evenly between trials
+#define AUTOTUNE_BUDGET 1.5
+
+
+// Benchmarks candidate configurations against the loaded rules and a sample of input
+// and replaces config with the fastest one found
+// Trials write output the way output says, only to /dev/null, and with seen_mb set, through a global candidate set that big
+// Returns 0 on success, -1 on failure (config is left unchanged)
+int autotune(Engine *engine, WordReader *input, const OutputConfig *output, size_t seen_mb, EngineConfig *config);
+
+// Reads a configuration written by config_save(), overwriting the settings it contains
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int config_load(EngineConfig *config, const char *file_name);
+
+// Writes a configuration so later runs can skip tuning
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int config_save(const EngineConfig *config, const char *file_name);
+
+#endif /* AUTOTUNE_H */
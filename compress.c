@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <zlib.h>
+#include "compress.h"
+#include "zstdlib.h"
+
+
+int compress_max_level(Compression format) {
+    const ZstdLib *zstd;
+    switch (format) {
+        case COMPRESSION_GZIP: return 9;
+        case COMPRESSION_ZSTD: return ((zstd = zstdlib_load()) ? zstd->max_level() : 0);
+        default:               return 0;
+    }
+}
+
+
+int compressor_init(Compressor *compressor, Compression format, int level) {
+    memset(compressor, 0, sizeof(Compressor));
+    compressor->format = format;
+    compressor->level  = level;
+
+    if (format == COMPRESSION_GZIP) {
+        z_stream *stream = (z_stream *)calloc(1, sizeof(z_stream));
+
+        // 16 on top of the window bits asks for a gzip header and trailer rather than zlib's
+        if (stream == NULL || deflateInit2(stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "ERROR: Failed to initialize output compression\n");
+            free(stream);
+            return -1;
+        }
+        compressor->state = stream;
+        return 0;
+    }
+
+    const ZstdLib *zstd = zstdlib_load();
+    if (zstd == NULL || (compressor->state = zstd->create_cctx()) == NULL) {
+        fprintf(stderr, "ERROR: Failed to initialize output compression\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+size_t compress_bound(Compressor *compressor, size_t length) {
+    if (compressor->format == COMPRESSION_GZIP) { return deflateBound((z_stream *)compressor->state, length); }
+    return zstdlib_load()->compress_bound(length);
+}
+
+
+ssize_t compress_block(Compressor *compressor, const char *data, size_t length, char *output, size_t capacity) {
+    if (compressor->format == COMPRESSION_GZIP) {
+        z_stream *stream = (z_stream *)compressor->state;
+        if (length > UINT_MAX || capacity > UINT_MAX || deflateReset(stream) != Z_OK) {
+            fprintf(stderr, "ERROR: Failed to compress output\n");
+            return -1;
+        }
+
+        stream->next_in   = (Bytef *)data;
+        stream->avail_in  = length;
+        stream->next_out  = (Bytef *)output;
+        stream->avail_out = capacity;
+        if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+            fprintf(stderr, "ERROR: Failed to compress output\n");
+            return -1;
+        }
+        return capacity - stream->avail_out;
+    }
+
+    const ZstdLib *zstd   = zstdlib_load();
+    size_t         result = zstd->compress(compressor->state, output, capacity, data, length, compressor->level);
+    if (zstd->is_error(result)) {
+        fprintf(stderr, "ERROR: Failed to compress output: %s\n", zstd->error_name(result));
+        return -1;
+    }
+    return result;
+}
+
+
+void compressor_free(Compressor *compressor) {
+    if (compressor == NULL || compressor->state == NULL) { return; }
+
+    if (compressor->format == COMPRESSION_GZIP) {
+        deflateEnd((z_stream *)compressor->state);
+        free(compressor->state);
+    } else {
+        zstdlib_load()->free_cctx(compressor->state);
+    }
+    memset(compressor, 0, sizeof(Compressor));
+}
@@ -0,0 +1,41 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "decompress.h"
+
+// Default levels, fast enough to keep up with a worker
+#define COMPRESS_GZIP_LEVEL 1
+#define COMPRESS_ZSTD_LEVEL 3
+
+
+// A worker's state for compressing its output buffers
+// Every buffer becomes a complete gzip member or zstd frame, so a file of them back to back still reads with zcat or zstdcat
+typedef struct Compressor {
+    Compression format;
+    int         level;
+
+    // A z_stream or a ZSTD_CCtx, reset for every buffer
+    void       *state;
+} Compressor;
+
+
+// Returns the highest level format takes, 0 if it isn't available
+int compress_max_level(Compression format);
+
+// Sets up a compressor, call from the worker thread so its state is node-local
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int compressor_init(Compressor *compressor, Compression format, int level);
+
+// Returns the most bytes compressing length bytes can produce
+size_t compress_bound(Compressor *compressor, size_t length);
+
+// Compresses length bytes of data into output, which holds at least compress_bound(length) bytes
+// Returns the compressed length, -1 on failure (an error has already been printed)
+ssize_t compress_block(Compressor *compressor, const char *data, size_t length, char *output, size_t capacity);
+
+// Frees a compressor's state, safe to call on a zeroed one
+void compressor_free(Compressor *compressor);
+
+#endif /* COMPRESS_H */
@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <zlib.h>
+#include "decompress.h"
+#include "zstdlib.h"
+
+
+Compression decompress_detect(const char *data, size_t length) {
+    if (length >= 2 && data[0] == '\x1f' && data[1] == '\x8b') { return COMPRESSION_GZIP; }
+    if (length < 4) { return COMPRESSION_NONE; }
+
+    // A zstd frame, or a skippable frame like the ones pzstd starts every frame with
+    if (memcmp(data, "\x28\xb5\x2f\xfd", 4) == 0) { return COMPRESSION_ZSTD; }
+    if ((data[0] & 0xf0) == 0x50 && memcmp(data + 1, "\x2a\x4d\x18", 3) == 0) { return COMPRESSION_ZSTD; }
+    return COMPRESSION_NONE;
+}
+
+
+static DecompressChunk *chunk_alloc(void) {
+    DecompressChunk *chunk = (DecompressChunk *)malloc(sizeof(DecompressChunk) + DECOMPRESS_CHUNK_SIZE);
+    if (chunk == NULL) { return NULL; }
+
+    chunk->next   = NULL;
+    chunk->length = 0;
+    return chunk;
+}
+
+
+static void chunk_free_list(DecompressChunk *chunk) {
+    while (chunk) {
+        DecompressChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+
+// Queues a chunk decompressed from unit_num for the reader, waiting while its slot is full
+// Empty chunks are just freed
+// Returns 0 on success, -1 if the decompressor is stopping and the rest of the unit isn't wanted
+static int emit_chunk(Decompressor *decompressor, size_t unit_num, DecompressChunk *chunk) {
+    if (chunk->length == 0) {
+        free(chunk);
+        return 0;
+    }
+
+    DecompressSlot *slot = &decompressor->slots[unit_num % decompressor->slot_count];
+
+    pthread_mutex_lock(&decompressor->lock);
+    while (slot->count >= DECOMPRESS_QUEUE_DEPTH && !decompressor->stopping) {
+        pthread_cond_wait(&decompressor->room, &decompressor->lock);
+    }
+
+    bool stopping = decompressor->stopping;
+    if (!stopping) {
+        if (slot->tail) { slot->tail->next = chunk; } else { slot->head = chunk; }
+        slot->tail = chunk;
+        slot->count++;
+        pthread_cond_broadcast(&decompressor->ready);
+    }
+    pthread_mutex_unlock(&decompressor->lock);
+
+    if (stopping) {
+        free(chunk);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Inflates a whole gzip file, including any further members concatenated after the first, as zcat would
+// Returns 0 on success, -1 on failure (an error has already been printed unless the decompressor is stopping)
+static int inflate_unit(Decompressor *decompressor, size_t unit_num) {
+    const DecompressUnit *unit = &decompressor->units[unit_num];
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        fprintf(stderr, "ERROR: Failed to decompress wordlist <%s>\n", decompressor->name);
+        return -1;
+    }
+
+    // zlib counts input in unsigned ints, larger files are fed to it a piece at a time
+    const char      *next  = unit->data;
+    size_t           left  = unit->length;
+    DecompressChunk *chunk = NULL;
+
+    int rtn = 0;
+    while (rtn == 0) {
+        if (stream.avail_in == 0 && left > 0) {
+            size_t length = (left > UINT_MAX ? UINT_MAX : left);
+            stream.next_in  = (Bytef *)next;
+            stream.avail_in = length;
+            next += length;
+            left -= length;
+        }
+
+        if (chunk == NULL && (chunk = chunk_alloc()) == NULL) {
+            fprintf(stderr, "ERROR: Failed to allocate decompression buffers\n");
+            rtn = -1;
+            break;
+        }
+        stream.next_out  = (Bytef *)chunk->data + chunk->length;
+        stream.avail_out = DECOMPRESS_CHUNK_SIZE - chunk->length;
+
+        int status = inflate(&stream, Z_NO_FLUSH);
+        chunk->length = DECOMPRESS_CHUNK_SIZE - stream.avail_out;
+
+        if (status == Z_STREAM_END) {
+            // Another member follows, anything else after the last one (like padding) is ignored
+            // The pieces fed to zlib are contiguous, so whatever it hasn't used runs on into the rest
+            if (decompress_detect((const char *)stream.next_in, stream.avail_in + left) != COMPRESSION_GZIP) { break; }
+            inflateReset(&stream);
+
+        } else if (status == Z_BUF_ERROR && stream.avail_in == 0 && left == 0) {
+            fprintf(stderr, "ERROR: Wordlist <%s> is truncated\n", decompressor->name);
+            rtn = -1;
+
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+            fprintf(stderr, "ERROR: Failed to decompress wordlist <%s>: %s\n", decompressor->name, (stream.msg ? stream.msg : "corrupt data"));
+            rtn = -1;
+        }
+
+        if (rtn == 0 && stream.avail_out == 0) {
+            rtn   = emit_chunk(decompressor, unit_num, chunk);
+            chunk = NULL;
+        }
+    }
+
+    if (rtn == 0 && chunk) {
+        rtn   = emit_chunk(decompressor, unit_num, chunk);
+        chunk = NULL;
+    }
+
+    free(chunk);
+    inflateEnd(&stream);
+    return rtn;
+}
+
+
+// Decompresses the zstd frames of a unit, one after another
+// Returns 0 on success, -1 on failure (an error has already been printed unless the decompressor is stopping)
+static int unzstd_unit(Decompressor *decompressor, size_t unit_num) {
+    const DecompressUnit *unit = &decompressor->units[unit_num];
+    const ZstdLib        *zstd = zstdlib_load();
+
+    void *dctx = zstd->create_dctx();
+    if (dctx == NULL) {
+        fprintf(stderr, "ERROR: Failed to decompress wordlist <%s>\n", decompressor->name);
+        return -1;
+    }
+
+    ZstdInBuffer     input  = { unit->data, unit->length, 0 };
+    ZstdOutBuffer    output = { NULL, 0, 0 };
+    DecompressChunk *chunk  = NULL;
+
+    // Not 0 until a frame has been completely decompressed and flushed
+    size_t status = 1;
+
+    int rtn = 0;
+    while (rtn == 0 && (input.pos < input.size || status != 0)) {
+        if (chunk == NULL) {
+            if ((chunk = chunk_alloc()) == NULL) {
+                fprintf(stderr, "ERROR: Failed to allocate decompression buffers\n");
+                rtn = -1;
+                break;
+            }
+            output.dst  = chunk->data;
+            output.size = DECOMPRESS_CHUNK_SIZE;
+            output.pos  = 0;
+        }
+
+        status = zstd->decompress_stream(dctx, &output, &input);
+        chunk->length = output.pos;
+
+        if (zstd->is_error(status)) {
+            fprintf(stderr, "ERROR: Failed to decompress wordlist <%s>: %s\n", decompressor->name, zstd->error_name(status));
+            rtn = -1;
+
+        } else if (output.pos == output.size) {
+            rtn   = emit_chunk(decompressor, unit_num, chunk);
+            chunk = NULL;
+
+        // There was room left and nothing left to read, but the frame isn't finished
+        } else if (input.pos == input.size && status != 0) {
+            fprintf(stderr, "ERROR: Wordlist <%s> is truncated\n", decompressor->name);
+            rtn = -1;
+        }
+    }
+
+    if (rtn == 0 && chunk) {
+        rtn   = emit_chunk(decompressor, unit_num, chunk);
+        chunk = NULL;
+    }
+
+    free(chunk);
+    zstd->free_dctx(dctx);
+    return rtn;
+}
+
+
+static void *decompress_thread(void *arg) {
+    Decompressor *decompressor = (Decompressor *)arg;
+
+    pthread_mutex_lock(&decompressor->lock);
+    while (true) {
+        // Units are taken in order, so the one being read always has a thread on it
+        while (!decompressor->stopping && decompressor->next_unit < decompressor->unit_count
+           &&  decompressor->next_unit >= decompressor->read_unit + decompressor->slot_count) {
+            pthread_cond_wait(&decompressor->room, &decompressor->lock);
+        }
+        if (decompressor->stopping || decompressor->failed || decompressor->next_unit >= decompressor->unit_count) { break; }
+
+        size_t unit_num = decompressor->next_unit++;
+        pthread_mutex_unlock(&decompressor->lock);
+
+        int rtn = (decompressor->format == COMPRESSION_GZIP ? inflate_unit(decompressor, unit_num) : unzstd_unit(decompressor, unit_num));
+
+        pthread_mutex_lock(&decompressor->lock);
+        if (rtn != 0) { decompressor->failed = true; }
+        decompressor->slots[unit_num % decompressor->slot_count].done = true;
+        pthread_cond_broadcast(&decompressor->ready);
+    }
+    pthread_mutex_unlock(&decompressor->lock);
+    return NULL;
+}
+
+
+// Splits zstd input into units of whole frames
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int split_frames(Decompressor *decompressor, const char *data, size_t length) {
+    const ZstdLib *zstd = zstdlib_load();
+    size_t capacity = 0;
+    size_t position = 0;
+
+    while (position < length) {
+        size_t unit_length = 0;
+        while (position + unit_length < length && unit_length < DECOMPRESS_UNIT_MIN) {
+            size_t frame_length = zstd->frame_size(data + position + unit_length, length - position - unit_length);
+            if (zstd->is_error(frame_length)) {
+                fprintf(stderr, "ERROR: Failed to decompress wordlist <%s>: %s\n", decompressor->name, zstd->error_name(frame_length));
+                return -1;
+            }
+            unit_length += frame_length;
+        }
+
+        if (decompressor->unit_count == capacity) {
+            capacity = (capacity ? capacity * 2 : 64);
+            DecompressUnit *units = (DecompressUnit *)realloc(decompressor->units, capacity * sizeof(DecompressUnit));
+            if (units == NULL) { return -1; }
+            decompressor->units = units;
+        }
+
+        decompressor->units[decompressor->unit_count].data   = data + position;
+        decompressor->units[decompressor->unit_count].length = unit_length;
+        decompressor->unit_count++;
+        position += unit_length;
+    }
+    return 0;
+}
+
+
+int decompress_start(Decompressor *decompressor, Compression format, const char *data, size_t length, int thread_count, const char *name) {
+    memset(decompressor, 0, sizeof(Decompressor));
+    decompressor->format = format;
+    decompressor->name   = name;
+    pthread_mutex_init(&decompressor->lock,  NULL);
+    pthread_cond_init (&decompressor->ready, NULL);
+    pthread_cond_init (&decompressor->room,  NULL);
+
+    if (format == COMPRESSION_ZSTD) {
+        if (zstdlib_load() == NULL) {
+            fprintf(stderr, "ERROR: Wordlist <%s> is zstd compressed, but libzstd couldn't be loaded\n", name);
+            decompress_free(decompressor);
+            return -1;
+        }
+
+        if (split_frames(decompressor, data, length) != 0) {
+            decompress_free(decompressor);
+            return -1;
+        }
+
+    // A gzip stream can only be inflated from the start, it's decompressed by one thread while the workers split what it's done
+    } else {
+        decompressor->units = (DecompressUnit *)malloc(sizeof(DecompressUnit));
+        if (decompressor->units == NULL) {
+            decompress_free(decompressor);
+            return -1;
+        }
+        decompressor->units[0].data   = data;
+        decompressor->units[0].length = length;
+        decompressor->unit_count      = 1;
+    }
+
+    if ((size_t)thread_count > decompressor->unit_count) { thread_count = decompressor->unit_count; }
+    if (thread_count < 1)                                { thread_count = 1; }
+
+    decompressor->slot_count = thread_count;
+    decompressor->slots      = (DecompressSlot *)calloc(thread_count, sizeof(DecompressSlot));
+    decompressor->threads    = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+    if (decompressor->slots == NULL || decompressor->threads == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate decompression buffers\n");
+        decompress_free(decompressor);
+        return -1;
+    }
+
+    for (int thread_num = 0; thread_num < thread_count; thread_num++) {
+        if (pthread_create(&decompressor->threads[thread_num], NULL, decompress_thread, decompressor) != 0) { break; }
+        decompressor->thread_count++;
+    }
+
+    if (decompressor->thread_count == 0) {
+        fprintf(stderr, "ERROR: Failed to start decompressing wordlist <%s>\n", name);
+        decompress_free(decompressor);
+        return -1;
+    }
+    return 0;
+}
+
+
+ssize_t decompress_read(Decompressor *decompressor, char *buffer, size_t size) {
+    if (decompressor->chunk == NULL) {
+        pthread_mutex_lock(&decompressor->lock);
+
+        ssize_t rtn = 0;
+        while (decompressor->chunk == NULL && decompressor->read_unit < decompressor->unit_count) {
+            DecompressSlot *slot = &decompressor->slots[decompressor->read_unit % decompressor->slot_count];
+
+            if (slot->head) {
+                decompressor->chunk     = slot->head;
+                decompressor->chunk_pos = 0;
+                slot->head = slot->head->next;
+                if (slot->head == NULL) { slot->tail = NULL; }
+                slot->count--;
+                pthread_cond_broadcast(&decompressor->room);
+
+            } else if (decompressor->failed) {
+                rtn = -1;
+                break;
+
+            // Everything from this unit has been read, its slot is free for a later one
+            } else if (slot->done) {
+                slot->done = false;
+                decompressor->read_unit++;
+                pthread_cond_broadcast(&decompressor->room);
+
+            } else {
+                pthread_cond_wait(&decompressor->ready, &decompressor->lock);
+            }
+        }
+        pthread_mutex_unlock(&decompressor->lock);
+
+        if (decompressor->chunk == NULL) { return rtn; }
+    }
+
+    DecompressChunk *chunk  = decompressor->chunk;
+    size_t           length = chunk->length - decompressor->chunk_pos;
+    if (length > size) { length = size; }
+
+    memcpy(buffer, chunk->data + decompressor->chunk_pos, length);
+    decompressor->chunk_pos += length;
+
+    if (decompressor->chunk_pos == chunk->length) {
+        free(chunk);
+        decompressor->chunk = NULL;
+    }
+    return length;
+}
+
+
+void decompress_free(Decompressor *decompressor) {
+    if (decompressor == NULL || decompressor->name == NULL) { return; }
+
+    pthread_mutex_lock(&decompressor->lock);
+    decompressor->stopping = true;
+    pthread_cond_broadcast(&decompressor->room);
+    pthread_mutex_unlock(&decompressor->lock);
+
+    for (int thread_num = 0; thread_num < decompressor->thread_count; thread_num++) {
+        pthread_join(decompressor->threads[thread_num], NULL);
+    }
+
+    for (int slot_num = 0; decompressor->slots && slot_num < decompressor->slot_count; slot_num++) {
+        chunk_free_list(decompressor->slots[slot_num].head);
+    }
+    free(decompressor->chunk);
+
+    free(decompressor->units);
+    free(decompressor->slots);
+    free(decompressor->threads);
+    pthread_mutex_destroy(&decompressor->lock);
+    pthread_cond_destroy (&decompressor->ready);
+    pthread_cond_destroy (&decompressor->room);
+    memset(decompressor, 0, sizeof(Decompressor));
+}
@@ -0,0 +1,94 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Compressed input is decompressed into chunks of this size
+#define DECOMPRESS_CHUNK_SIZE (4 * 1024 * 1024)
+
+// Chunks a decompressing thread may have waiting to be read before it stops to wait
+#define DECOMPRESS_QUEUE_DEPTH 4
+
+// zstd frames are grouped into units of at least this many compressed bytes, each decompressed by one thread
+#define DECOMPRESS_UNIT_MIN (1024 * 1024)
+
+
+typedef enum Compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD,
+} Compression;
+
+
+// Decompressed text, handed over from a decompressing thread to the reader
+typedef struct DecompressChunk {
+    struct DecompressChunk *next;
+    size_t                  length;
+    char                    data[];
+} DecompressChunk;
+
+
+// A piece of the input one thread decompresses from start to end: some whole zstd frames, or all of a gzip file
+typedef struct DecompressUnit {
+    const char *data;
+    size_t      length;
+} DecompressUnit;
+
+
+// Chunks decompressed from one unit and not read yet
+typedef struct DecompressSlot {
+    DecompressChunk *head, *tail;
+    int              count;
+    bool             done;
+} DecompressSlot;
+
+
+// Compressed input being decompressed by a few threads, and read back in order
+typedef struct Decompressor {
+    Compression     format;
+    const char     *name;
+
+    DecompressUnit *units;
+    size_t          unit_count;
+
+    // The next unit for a thread to take, and the unit being read
+    // Unit n's chunks go in slot n % slot_count, so threads only run slot_count units ahead of the reader
+    size_t          next_unit;
+    size_t          read_unit;
+    DecompressSlot *slots;
+    int             slot_count;
+
+    // The chunk being read from, and how much of it has been
+    DecompressChunk *chunk;
+    size_t           chunk_pos;
+
+    pthread_t      *threads;
+    int             thread_count;
+    bool            failed, stopping;
+
+    pthread_mutex_t lock;
+
+    // Signalled when a slot gets a chunk or is done, and when the reader takes a chunk or moves to the next unit
+    pthread_cond_t  ready, room;
+} Decompressor;
+
+
+// Returns the format of compressed data starting with these bytes, COMPRESSION_NONE if it isn't any we know
+Compression decompress_detect(const char *data, size_t length);
+
+// Starts up to thread_count threads decompressing length bytes of data in the given format
+// data must stay mapped until decompress_free(), name is only used in errors
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int decompress_start(Decompressor *decompressor, Compression format, const char *data, size_t length, int thread_count, const char *name);
+
+// Copies up to size bytes of decompressed text into buffer, waiting for it if needed
+// Returns the number of bytes copied, 0 at the end, -1 if the input is corrupt (an error has already been printed)
+ssize_t decompress_read(Decompressor *decompressor, char *buffer, size_t size);
+
+// Stops the threads and frees everything, safe to call on a zeroed or already freed decompressor
+void decompress_free(Decompressor *decompressor);
+
+#endif /* DECOMPRESS_H */
@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "dedupe.h"
+
+// Tables are sized so they're at most this full (out of 8)
+#define DEDUPE_MAX_LOAD 5
+
+// Slots keep the high half of the hash, the low half picks the slot
+#define DEDUPE_TAG(hash) ((hash) & 0xFFFFFFFF00000000ull)
+
+
+// 64x64 -> 128 bit multiply, folded back to 64 bits
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+
+uint64_t dedupe_hash(const char *text, size_t length) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ length;
+
+    size_t pos = 0;
+    for (; pos + 8 <= length; pos += 8) {
+        uint64_t word;
+        memcpy(&word, text + pos, 8);
+        hash = mix(hash ^ word, 0xBF58476D1CE4E5B9ull);
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, text + pos, length - pos);
+    hash = mix(hash ^ tail, 0x94D049BB133111EBull);
+    return mix(hash, 0x9E3779B97F4A7C15ull);
+}
+
+
+int dedupe_init(DedupeTable *table, size_t capacity) {
+    memset(table, 0, sizeof(DedupeTable));
+
+    size_t slots = 64;
+    while (slots * DEDUPE_MAX_LOAD / 8 < capacity) { slots *= 2; }
+
+    table->slots    = (uint64_t *)calloc(slots, sizeof(uint64_t));
+    table->mask     = slots - 1;
+    table->capacity = capacity;
+    if (table->slots == NULL) { return -1; }
+
+    return 0;
+}
+
+
+void dedupe_free(DedupeTable *table) {
+    if (table == NULL) { return; }
+    if (table->slots) { free(table->slots); }
+    memset(table, 0, sizeof(DedupeTable));
+}
+
+
+uint32_t dedupe_find(const DedupeTable *table, uint64_t hash, DedupeMatch match, void *context) {
+    uint64_t tag  = DEDUPE_TAG(hash);
+    size_t   slot = hash & table->mask;
+
+    // Ids are stored plus one so an empty slot is always 0
+    while (table->slots[slot] != 0) {
+        if (DEDUPE_TAG(table->slots[slot]) == tag) {
+            uint32_t id = (uint32_t)table->slots[slot] - 1;
+            if (match(context, id)) { return id; }
+        }
+        slot = (slot + 1) & table->mask;
+    }
+
+    return DEDUPE_NONE;
+}
+
+
+int dedupe_add(DedupeTable *table, uint64_t hash, uint32_t id) {
+    if (table->count >= table->capacity) { return -1; }
+
+    size_t slot = hash & table->mask;
+    while (table->slots[slot] != 0) { slot = (slot + 1) & table->mask; }
+
+    table->slots[slot] = DEDUPE_TAG(hash) | ((uint64_t)id + 1);
+    table->count++;
+    return 0;
+}
+
+
+// Hashes in one filter bucket, 64 bytes
+#define FILTER_BUCKET_SLOTS 8
+
+
+int dedupe_filter_init(DedupeFilter *filter, size_t size) {
+    memset(filter, 0, sizeof(DedupeFilter));
+
+    size_t buckets = 1;
+    while (buckets * 2 * FILTER_BUCKET_SLOTS * sizeof(uint64_t) <= size) { buckets *= 2; }
+
+    void *slots = NULL;
+    if (posix_memalign(&slots, FILTER_BUCKET_SLOTS * sizeof(uint64_t), buckets * FILTER_BUCKET_SLOTS * sizeof(uint64_t)) != 0) {
+        return -1;
+    }
+
+    filter->slots       = (uint64_t *)slots;
+    filter->bucket_mask = buckets - 1;
+    memset(filter->slots, 0, buckets * FILTER_BUCKET_SLOTS * sizeof(uint64_t));
+    return 0;
+}
+
+
+void dedupe_filter_free(DedupeFilter *filter) {
+    if (filter == NULL) { return; }
+    if (filter->slots) { free(filter->slots); }
+    memset(filter, 0, sizeof(DedupeFilter));
+}
+
+
+bool dedupe_filter_check(DedupeFilter *filter, uint64_t hash) {
+    // 0 marks an empty slot
+    if (hash == 0) { hash = 1; }
+
+    // The bucket comes from the high bits, which the slots don't otherwise get to use
+    uint64_t *bucket = &filter->slots[((hash >> 32) & filter->bucket_mask) * FILTER_BUCKET_SLOTS];
+    for (int slot = 0; slot < FILTER_BUCKET_SLOTS; slot++) {
+        if (bucket[slot] == hash) { return true; }
+        if (bucket[slot] == 0   ) { bucket[slot] = hash; return false; }
+    }
+
+    // Full, slots are in the order they were filled so the oldest is first
+    memmove(&bucket[0], &bucket[1], (FILTER_BUCKET_SLOTS - 1) * sizeof(uint64_t));
+    bucket[FILTER_BUCKET_SLOTS - 1] = hash;
+    filter->evictions++;
+    return false;
+}
+
+
+int dedupe_word_init(DedupeWordSet *set, size_t capacity) {
+    memset(set, 0, sizeof(DedupeWordSet));
+
+    size_t slots = 64;
+    while (slots * DEDUPE_MAX_LOAD / 8 < capacity) { slots *= 2; }
+
+    // Every slot starts out in epoch 0, which is over before the first word
+    set->slots = (DedupeWordSlot *)calloc(slots, sizeof(DedupeWordSlot));
+    set->mask  = slots - 1;
+    if (set->slots == NULL) { return -1; }
+
+    return 0;
+}
+
+
+void dedupe_word_free(DedupeWordSet *set) {
+    if (set == NULL) { return; }
+    if (set->slots) { free(set->slots); }
+    memset(set, 0, sizeof(DedupeWordSet));
+}
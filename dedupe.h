@@ -0,0 +1,107 @@
+#ifndef DEDUPE_H
+#define DEDUPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Returned by dedupe_find() when nothing matches
+#define DEDUPE_NONE UINT32_MAX
+
+
+// A fixed-size, open-addressing set of ids, used to find duplicate rules while loading
+// Each slot is 8 bytes: the top half of the id's hash and the id itself
+// The table never stores text, callers compare candidates through a DedupeMatch callback
+typedef struct DedupeTable {
+    uint64_t *slots;
+    size_t    mask;
+    size_t    count, capacity;
+} DedupeTable;
+
+
+// A fixed-size set of recently seen rule hashes, for rule streams too big to remember every rule
+// Buckets are one cache line of hashes; when a bucket is full, its oldest hash is forgotten
+// A rule is only reported as seen if its full 64-bit hash was, so unique rules are never dropped
+// Once rules start being forgotten, some duplicates get through instead
+typedef struct DedupeFilter {
+    uint64_t *slots;
+    size_t    bucket_mask;
+
+    // Hashes that pushed an older one out
+    size_t    evictions;
+} DedupeFilter;
+
+
+// The hashes of the candidates one word has produced so far, to drop candidates that different rules make alike
+// Sized so every rule's candidate fits, and emptied between words by moving on to a new epoch instead of clearing it
+// Only the 64-bit hash is compared, so two different candidates of the same word would have to collide for one to be lost
+typedef struct DedupeWordSlot {
+    uint64_t hash;
+    uint64_t epoch;
+} DedupeWordSlot;
+
+typedef struct DedupeWordSet {
+    DedupeWordSlot *slots;
+    size_t          mask;
+    uint64_t        epoch;
+} DedupeWordSet;
+
+
+// Returns true if id refers to the same rule the caller is looking for
+typedef bool (*DedupeMatch)(void *context, uint32_t id);
+
+
+// Hashes parsed rule text
+uint64_t dedupe_hash(const char *text, size_t length);
+
+// Prepares an empty table that can hold up to capacity ids
+// Returns 0 on success, -1 on failure
+int dedupe_init(DedupeTable *table, size_t capacity);
+
+// Frees the members of a table
+void dedupe_free(DedupeTable *table);
+
+// Returns the id of an entry with the same hash that match() accepts, or DEDUPE_NONE
+uint32_t dedupe_find(const DedupeTable *table, uint64_t hash, DedupeMatch match, void *context);
+
+// Adds an id that dedupe_find() didn't find, id must be less than DEDUPE_NONE
+// Returns 0 on success, -1 if the table is full
+int dedupe_add(DedupeTable *table, uint64_t hash, uint32_t id);
+
+// Prepares an empty filter using about size bytes
+// Returns 0 on success, -1 on failure
+int dedupe_filter_init(DedupeFilter *filter, size_t size);
+
+// Frees the members of a filter
+void dedupe_filter_free(DedupeFilter *filter);
+
+// Returns true if hash has been seen recently, otherwise remembers it and returns false
+// Not thread safe
+bool dedupe_filter_check(DedupeFilter *filter, uint64_t hash);
+
+// Prepares an empty word set for up to capacity candidates per word
+// Returns 0 on success, -1 on failure
+int dedupe_word_init(DedupeWordSet *set, size_t capacity);
+
+// Frees the members of a word set
+void dedupe_word_free(DedupeWordSet *set);
+
+// Forgets every hash, call before each word
+static inline void dedupe_word_reset(DedupeWordSet *set) {
+    set->epoch++;
+}
+
+// Returns true if hash has already been seen for this word, otherwise remembers it and returns false
+static inline bool dedupe_word_check(DedupeWordSet *set, uint64_t hash) {
+    size_t slot = hash & set->mask;
+    while (set->slots[slot].epoch == set->epoch) {
+        if (set->slots[slot].hash == hash) { return true; }
+        slot = (slot + 1) & set->mask;
+    }
+
+    set->slots[slot].hash  = hash;
+    set->slots[slot].epoch = set->epoch;
+    return false;
+}
+
+#endif /* DEDUPE_H */
@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "engine.h"
+
+
+typedef struct Worker {
+    Engine   *engine;
+    pthread_t thread;
+
+    // CPU this worker is pinned to (-1 if not pinned) and that CPU's NUMA node
+    int id, cpu, node;
+
+    // Statistics
+    unsigned long int word_count;
+    unsigned long int reject_count;
+    unsigned long int dupe_count;
+
+    int status;
+} Worker;
+
+
+uint64_t engine_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+
+// Writes out the deferred candidates the global set found to be new, and empties the batch
+static int write_accepted(Worker *worker, SeenBatch *accepted, OutputBuffer *output) {
+    size_t position = 0;
+    int    length;
+    char  *word;
+    while ((word = seen_batch_next(accepted, &position, &length)) != NULL) {
+        // In debug mode, the candidate was checked along with its rule, which goes first
+        #ifdef DEBUG_OUTPUT
+        int prefix_length;
+        char *candidate = seen_debug_unpack(word, length, &prefix_length, &length);
+        output_buffer_append(output, word, prefix_length);
+        word = candidate;
+        #endif
+
+        if (output_buffer_record(output, word, length) != 0) { return -1; }
+        worker->word_count++;
+    }
+    accepted->length = 0;
+    return 0;
+}
+
+
+// Copies a rule table into memory owned by table
+// Returns 0 on success, -1 on failure
+static int rule_table_copy(RuleTable *table, const RuleTable *source) {
+    size_t text_size = source->offsets[source->count];
+
+    // Both arrays start on a cache line
+    void *text_mem = NULL, *offsets_mem = NULL;
+    if (posix_memalign(&text_mem,    CACHE_LINE_SIZE, text_size + 1)                          != 0) { text_mem    = NULL; }
+    if (posix_memalign(&offsets_mem, CACHE_LINE_SIZE, (source->count + 1) * sizeof(uint64_t)) != 0) { offsets_mem = NULL; }
+
+    table->text    = (char     *)text_mem;
+    table->offsets = (uint64_t *)offsets_mem;
+    table->count   = source->count;
+    table->owned   = true;
+    if (table->text == NULL || table->offsets == NULL) { return -1; }
+
+    memcpy(table->text,    source->text,    text_size);
+    memcpy(table->offsets, source->offsets, (source->count + 1) * sizeof(uint64_t));
+    return 0;
+}
+
+
+static void rule_table_free(RuleTable *table) {
+    if (table == NULL) { return; }
+    if (table->owned && table->text   ) { free(table->text);    }
+    if (table->owned && table->offsets) { free(table->offsets); }
+    memset(table, 0, sizeof(RuleTable));
+}
+
+
+// Returns the rule table a worker should read from
+// Pinned workers get a copy on their own NUMA node, created by whichever worker gets there first
+// Because the calling thread is already pinned, first-touch allocation places the copy locally
+static const RuleTable *worker_rule_table(Worker *worker) {
+    Engine *engine = worker->engine;
+    if (worker->cpu < 0 || engine->topology.node_count < 2) { return &engine->master; }
+
+    RuleTable *replica = &engine->replicas[worker->node];
+    pthread_mutex_lock(&engine->replica_locks[worker->node]);
+    if (replica->offsets == NULL) {
+        if (rule_table_copy(replica, &engine->master) != 0) {
+            fprintf(stderr, "WARNING: Failed to copy rules to NUMA node %d\n", worker->node);
+            rule_table_free(replica);
+        }
+    }
+    pthread_mutex_unlock(&engine->replica_locks[worker->node]);
+
+    return (replica->offsets != NULL ? replica : &engine->master);
+}
+
+
+// Only set during a timed run, checked between batches and every few thousand rules
+static inline bool deadline_passed(Engine *engine) {
+    return (engine->deadline_ns && engine_clock() >= engine->deadline_ns);
+}
+
+
+static inline bool rule_disabled(Engine *engine, size_t rule_num) {
+    uint64_t bits = __atomic_load_n(&engine->disabled[rule_num / 64], __ATOMIC_RELAXED);
+    return (bits >> (rule_num % 64)) & 1;
+}
+
+
+// Removes a rule for all workers, returns true if this call was the one that removed it
+static bool disable_rule(Engine *engine, size_t rule_num) {
+    uint64_t bit  = (uint64_t)1 << (rule_num % 64);
+    uint64_t prev = __atomic_fetch_or(&engine->disabled[rule_num / 64], bit, __ATOMIC_RELAXED);
+    return !(prev & bit);
+}
+
+
+static void *worker_main(void *arg) {
+    Worker *worker = (Worker *)arg;
+    Engine *engine = worker->engine;
+
+    // Pin before allocating anything so our buffers end up on our NUMA node
+    if (worker->cpu >= 0 && topology_pin_thread(worker->cpu) != 0) {
+        fprintf(stderr, "WARNING: Failed to pin worker %d to CPU %d\n", worker->id, worker->cpu);
+    }
+
+    const RuleTable *table = worker_rule_table(worker);
+
+    WordBatch     batch;
+    OutputBuffer  output;
+    DedupeWordSet word_set;
+    SeenBatch     accepted;
+    memset(&batch,    0, sizeof(WordBatch));
+    memset(&output,   0, sizeof(OutputBuffer));
+    memset(&word_set, 0, sizeof(DedupeWordSet));
+    memset(&accepted, 0, sizeof(SeenBatch));
+    if (input_batch_init(&batch, engine->config->batch_size) != 0
+    ||  output_buffer_init(&output, engine->output->worker_sinks[worker->id]) != 0
+    ||  (engine->dedupe_words && dedupe_word_init(&word_set, table->count) != 0)) {
+        fprintf(stderr, "ERROR: Worker %d failed to allocate buffers\n", worker->id);
+        input_batch_free(&batch);
+        output_buffer_free(&output);
+        dedupe_word_free(&word_set);
+        __atomic_store_n(&engine->failed, 1, __ATOMIC_RELAXED);
+        worker->status = -1;
+        return NULL;
+    }
+
+    // Our mangled text ends up here
+    char rule_output[BLOCK_SIZE];
+
+    while ( !__atomic_load_n(&engine->failed, __ATOMIC_RELAXED) ) {
+        if (deadline_passed(engine)) { break; }
+        if (input_read_batch(engine->input, &batch) == 0) { break; }
+
+        for (int word_num = 0; word_num < batch.count && worker->status == 0; word_num++) {
+            const char *line     = batch.words[word_num];
+            int         line_len = batch.lengths[word_num];
+
+            // A slice of the keyspace may start or end part way through a word's rules
+            size_t first_rule = 0, last_rule = table->count;
+            if (engine->keyspace_start > 0 || engine->keyspace_end < UINT64_MAX) {
+                uint64_t position = (batch.first + word_num) * table->count;
+                if (engine->keyspace_start > position) {
+                    first_rule = (engine->keyspace_start - position < table->count ? engine->keyspace_start - position : table->count);
+                }
+                if (engine->keyspace_end < position + table->count) {
+                    last_rule = (engine->keyspace_end > position ? engine->keyspace_end - position : 0);
+                }
+            }
+            if (engine->dedupe_words) { dedupe_word_reset(&word_set); }
+
+            for (size_t rule_num = first_rule; rule_num < last_rule; rule_num++) {
+                if ((rule_num & 4095) == 4095 && deadline_passed(engine)) { worker->status = 1; break; }
+                if (rule_disabled(engine, rule_num)) { continue; }
+
+                // Rules are packed back to back, the next offset gives the length
+                uint64_t rule_start = table->offsets[rule_num];
+                Rule     cur_rule   = { table->text + rule_start, table->offsets[rule_num + 1] - rule_start - 1 };
+
+                // Apply the rule operations
+                int rule_rtn = apply_rule(&cur_rule, line, line_len, rule_output);
+
+                // Something broke?
+                if (rule_rtn < 0) {
+                    if (rule_rtn == REJECTED) {
+                        // Rejections are expected, they're okay
+                        worker->reject_count++;
+
+                    } else if (disable_rule(engine, rule_num)) {
+                        // We missed something in parsing and now our rule broke
+                        // We can't "fix" the rule, so our only option is to remove it
+                        // If you ever see this message, please contact the developer
+                        RuleSource *source      = &engine->source->sources[rule_num];
+                        char       *source_text = ruleset_source_text(engine->source, rule_num);
+                        fprintf(stderr,
+                            "Input word <%.*s> broke rule <%s> from file <%s>, line <%u> (parsed as <%s>): %s\n",
+                            line_len, line,
+                            (source_text ? source_text : "?"), engine->source->file_names[source->file], source->line,
+                            cur_rule.text, rule_output
+                        );
+                        free(source_text);
+                    }
+
+                    // Regardless if this was a rejection or error, we're not printing this word
+                    continue;
+                }
+
+
+                // Another rule already made this candidate from this word
+                uint64_t hash = (engine->dedupe_words || engine->seen ? dedupe_hash(rule_output, rule_rtn) : 0);
+                if (engine->dedupe_words && dedupe_word_check(&word_set, hash)) {
+                    worker->dupe_count++;
+                    continue;
+                }
+
+                // Or another word did, checking may also turn up earlier candidates that turned out new
+                if (engine->seen) {
+                    #ifdef DEBUG_OUTPUT
+                    char debug_text[cur_rule.length + BLOCK_SIZE + 2];
+                    int  seen_rtn = seen_check(engine->seen, hash, debug_text,
+                                               seen_debug_pack(debug_text, cur_rule.text, cur_rule.length, rule_output, rule_rtn), &accepted);
+                    #else
+                    int seen_rtn = seen_check(engine->seen, hash, rule_output, rule_rtn, &accepted);
+                    #endif
+                    if (seen_rtn < 0 || (accepted.length > 0 && write_accepted(worker, &accepted, &output) != 0)) {
+                        worker->status = -1;
+                        break;
+                    }
+                    if (seen_rtn != SEEN_NEW) { continue; }
+                }
+
+                // In debug mode, include the rule itself with the output
+                #ifdef DEBUG_OUTPUT
+                output_buffer_append(&output, cur_rule.text, cur_rule.length);
+                output_buffer_append(&output, "\t", 1);
+                #endif
+
+                // Output the mangled word, with a newline or whatever else frames it
+                if (output_buffer_record(&output, rule_output, rule_rtn) != 0) {
+                    worker->status = -1;
+                    break;
+                }
+                worker->word_count++;
+            }
+        }
+
+        if (worker->status != 0) { break; }
+    }
+
+    // A positive status only means we ran out of time
+    if (worker->status > 0) { worker->status = 0; }
+
+    // Once every other worker is done, nothing can be deferred any more and whatever is left is written out
+    if (engine->seen && __atomic_sub_fetch(&engine->active, 1, __ATOMIC_ACQ_REL) == 0
+    &&  worker->status == 0 && !__atomic_load_n(&engine->failed, __ATOMIC_RELAXED)) {
+        if (seen_finish(engine->seen, &accepted) != 0 || write_accepted(worker, &accepted, &output) != 0) { worker->status = -1; }
+    }
+
+    if (output_buffer_free(&output) != 0) { worker->status = -1; }
+    input_batch_free(&batch);
+    dedupe_word_free(&word_set);
+    seen_batch_free(&accepted);
+
+    if (worker->status != 0) { __atomic_store_n(&engine->failed, 1, __ATOMIC_RELAXED); }
+    return NULL;
+}
+
+
+int engine_init(Engine *engine, RuleSet *rules) {
+    memset(engine, 0, sizeof(Engine));
+    engine->source       = rules;
+    engine->keyspace_end = UINT64_MAX;
+
+    if (topology_detect(&engine->topology) != 0) {
+        fprintf(stderr, "WARNING: Failed to detect CPU topology, workers will not be pinned\n");
+    }
+    if (engine->topology.node_count < 1) { engine->topology.node_count = 1; }
+
+
+    // The rule set is already packed, so the master table just points at it
+    engine->master.text    = rules->text;
+    engine->master.offsets = rules->offsets;
+    engine->master.count   = rules->count;
+    engine->master.owned   = false;
+
+    engine->disabled = (uint64_t *)calloc(rules->count / 64 + 1, sizeof(uint64_t));
+    if (engine->disabled == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate rule table\n");
+        engine_free(engine);
+        return -1;
+    }
+
+
+    engine->replicas      = (RuleTable       *)calloc(engine->topology.node_count, sizeof(RuleTable));
+    engine->replica_locks = (pthread_mutex_t *)calloc(engine->topology.node_count, sizeof(pthread_mutex_t));
+    if (engine->replicas == NULL || engine->replica_locks == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate rule table\n");
+        engine_free(engine);
+        return -1;
+    }
+
+    for (int node = 0; node < engine->topology.node_count; node++) {
+        pthread_mutex_init(&engine->replica_locks[node], NULL);
+    }
+
+    return 0;
+}
+
+
+void engine_free(Engine *engine) {
+    if (engine == NULL) { return; }
+
+    if (engine->replicas && engine->replica_locks) {
+        for (int node = 0; node < engine->topology.node_count; node++) {
+            rule_table_free(&engine->replicas[node]);
+            pthread_mutex_destroy(&engine->replica_locks[node]);
+        }
+    }
+
+    if (engine->replicas     ) { free(engine->replicas);      }
+    if (engine->replica_locks) { free(engine->replica_locks); }
+    if (engine->disabled     ) { free(engine->disabled);      }
+    rule_table_free(&engine->master);
+    topology_free(&engine->topology);
+    memset(engine, 0, sizeof(Engine));
+}
+
+
+void engine_set_keyspace(Engine *engine, uint64_t start, uint64_t end) {
+    engine->keyspace_start = start;
+    engine->keyspace_end   = end;
+}
+
+
+void engine_set_dedupe(Engine *engine, bool per_word, SeenSet *global) {
+    engine->dedupe_words = per_word;
+    engine->seen         = global;
+}
+
+
+int engine_run(Engine *engine, const EngineConfig *config, WordReader *input, OutputSet *output,
+               double time_limit, EngineStats *stats) {
+    engine->config      = config;
+    engine->input       = input;
+    engine->output      = output;
+    engine->deadline_ns = (time_limit > 0 ? engine_clock() + (uint64_t)(time_limit * 1e9) : 0);
+    engine->failed      = 0;
+    engine->active      = config->thread_count;
+
+    Worker *workers = (Worker *)calloc(config->thread_count, sizeof(Worker));
+    if (workers == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate workers\n");
+        return -1;
+    }
+
+    // A single worker is left wherever the scheduler puts it
+    bool pin_threads = config->pin_threads && config->thread_count > 1 && engine->topology.cpu_count > 0;
+
+    int started = 0;
+    for (int worker_num = 0; worker_num < config->thread_count; worker_num++) {
+        Worker *worker = &workers[worker_num];
+        worker->engine = engine;
+        worker->id     = worker_num;
+        worker->cpu    = -1;
+        worker->node   = 0;
+
+        if (pin_threads) {
+            int slot = worker_num % engine->topology.cpu_count;
+            worker->cpu  = engine->topology.cpus [slot];
+            worker->node = engine->topology.nodes[slot];
+        }
+
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "ERROR: Failed to start worker %d\n", worker_num);
+            __atomic_store_n(&engine->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        started++;
+    }
+
+    memset(stats, 0, sizeof(EngineStats));
+    for (int worker_num = 0; worker_num < started; worker_num++) {
+        pthread_join(workers[worker_num].thread, NULL);
+
+        stats->word_count   += workers[worker_num].word_count;
+        stats->reject_count += workers[worker_num].reject_count;
+        stats->dupe_count   += workers[worker_num].dupe_count;
+    }
+
+    // A wordlist that failed part way through only ended the input early, which mustn't pass for a finished run
+    if (input_failed(input)) { __atomic_store_n(&engine->failed, 1, __ATOMIC_RELAXED); }
+
+    free(workers);
+    engine->config = NULL;
+    engine->input  = NULL;
+    engine->output = NULL;
+    return (engine->failed ? -1 : 0);
+}
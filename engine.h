@@ -0,0 +1,110 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "rules.h"
+#include "ruleset.h"
+#include "input.h"
+#include "output.h"
+#include "dedupe.h"
+#include "seen.h"
+#include "topology.h"
+
+
+// Everything about how a run executes that doesn't change its output (other than line order)
+typedef struct EngineConfig {
+    int  thread_count;
+    int  batch_size;
+    bool pin_threads;
+} EngineConfig;
+
+
+// Rule tables are aligned to this many bytes
+#define CACHE_LINE_SIZE 64
+
+
+// The loaded rules in load order, packed the same way as RuleSet
+// Workers on the same NUMA node share one copy allocated on that node
+typedef struct RuleTable {
+    char     *text;
+    uint64_t *offsets;
+    size_t    count;
+
+    // The master table points into the rule set instead of keeping its own copy
+    bool      owned;
+} RuleTable;
+
+
+// Totals from a run
+typedef struct EngineStats {
+    unsigned long int word_count;
+    unsigned long int reject_count;
+
+    // Candidates dropped for repeating one the same word already produced, the global set keeps its own totals
+    unsigned long int dupe_count;
+} EngineStats;
+
+
+// State shared by all workers
+typedef struct Engine {
+    RuleTable  master;
+
+    // Where each table entry came from, for error messages
+    RuleSet   *source;
+
+    // Bitmap of rules that broke while running and have been removed
+    uint64_t  *disabled;
+
+    // One table per NUMA node, built by the first pinned worker on that node and kept between runs
+    RuleTable       *replicas;
+    pthread_mutex_t *replica_locks;
+
+    Topology   topology;
+
+    // The slice of the keyspace to run, counted from the first word handed out, where word w with rule r is w * count + r
+    uint64_t   keyspace_start, keyspace_end;
+
+    // Candidates a word has already produced through another rule are dropped
+    bool       dedupe_words;
+
+    // Candidates any word has already produced are dropped, the last worker to finish writes out the deferred ones
+    SeenSet   *seen;
+    int        active;
+
+    // Only valid during engine_run()
+    const EngineConfig *config;
+    WordReader *input;
+    OutputSet  *output;
+    uint64_t    deadline_ns;
+
+    // Set when a worker fails so the others stop early
+    int        failed;
+} Engine;
+
+
+// Prepares an engine to run the rules in a rule set, which must outlive the engine
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int engine_init(Engine *engine, RuleSet *rules);
+
+// Frees the members of an engine
+void engine_free(Engine *engine);
+
+// Only runs keyspace positions [start, end) of the words handed out from now on, the first word's rules being positions 0 to count - 1
+void engine_set_keyspace(Engine *engine, uint64_t start, uint64_t end);
+
+// Drops candidates that repeat one the same word already produced, when per_word is set,
+// and those any word already produced if global isn't NULL
+void engine_set_dedupe(Engine *engine, bool per_word, SeenSet *global);
+
+// Applies every rule to every word from input until input runs out
+// If time_limit is non-zero, workers also stop after their current batch once it has passed
+// Returns 0 on success, -1 on failure
+int engine_run(Engine *engine, const EngineConfig *config, WordReader *input, OutputSet *output,
+               double time_limit, EngineStats *stats);
+
+// The current time in nanoseconds from a monotonic clock
+uint64_t engine_clock(void);
+
+#endif /* ENGINE_H */
@@ -3,249 +3,782 @@
 #include <stdio.h>
 #include <locale.h>
 #include <string.h>
+#include <getopt.h>
+#include <errno.h>
 #include "rules.h"
+#include "ruleset.h"
+#include "input.h"
+#include "output.h"
+#include "engine.h"
+#include "autotune.h"
+#include "rulecache.h"
+#include "stream.h"
+#include "merge.h"
+#include "wordpack.h"
+#include "wordindex.h"
 
 
-typedef struct RuleHash {
-    // The Rule struct itself
-    Rule *rule;
+// Command line settings
+typedef struct Options {
+    EngineConfig config;
 
-    // Info about where the rule came from
-    // This makes it easier to track down rule errors and dupes
-    char *source_file, *source_text;
-    unsigned int source_line;
+    // -t 0 means one thread per CPU, resolved once the engine knows the CPU topology
+    bool  auto_threads;
 
-    // Used by HASH_* functions
-    UT_hash_handle hh;
-} RuleHash;
+    bool  autotune;
+    char *autotune_file;
 
+    OutputConfig output;
 
-void free_hash(RuleHash *hash) {
-    if (hash == NULL) { return; }
-    if (hash->rule       ) { free_rule(hash->rule);   }
-    if (hash->source_file) { free(hash->source_file); }
-    if (hash->source_text) { free(hash->source_text); }
-    memset(hash, 0, sizeof(RuleHash));
-}
+    char *compile_file;
+    char *cache_file;
+
+    // Wordlist files or directories given with -w
+    char     **wordlists;
+    int        wordlist_count;
+    int        readers;
+    InputOrder word_order;
+
+    bool   stream_rules;
+    size_t filter_mb;
+
+    char  *merge_file;
+    size_t merge_mb;
+
+    char  *pack_file;
+    bool   index_wordlists;
+
+    // A slice of the keyspace, counted in words times rules
+    uint64_t skip;
+    uint64_t limit;
+    bool     limited;
+
+    // Drop candidates a word already produced through another rule, or that were already produced at all
+    bool     dedupe_words;
+    bool     dedupe_global;
+    size_t   dedupe_mb;
+} Options;
 
 
 void usage(char *hcre) {
     printf("\n");
-    printf("USAGE:  %s  rule_file  [rule_file  ...]\n", hcre);
+    printf("USAGE:  %s  [options]  rule_file  [rule_file  ...]\n", hcre);
     printf("\n");
     printf("Input words are read from STDIN, mangled words are written on STDOUT\n");
     printf("All rule files are unioned together and duplicate rules are removed\n");
     printf("For a cross product of rules, pipe this program into another instance of itself\n");
     printf("\n");
     printf("\n");
+    printf("OPTIONS:\n");
+    printf("    -t, --threads N        Number of worker threads (default 1, 0 for one per CPU)\n");
+    printf("    -o, --output FILE      Write to FILE instead of STDOUT\n");
+    printf("                           A \"%%d\" in FILE is replaced by the worker number, giving each worker its own file\n");
+    printf("                           A \"%%l\" in FILE or NAME is replaced by the candidate length, giving each length its own file or ring\n");
+    printf("        --output-fd LIST   Write to a comma separated list of open fds, assigned to workers round-robin\n");
+    printf("        --output-shm NAME  Write to a shared memory ring for hcre-shmcat or another consumer using shmring.h\n");
+    printf("        --shm-size MB      Size of the shared memory ring (default %d)\n", SHMRING_MB);
+    printf("        --direct-io        Write output files that have a worker to themselves with O_DIRECT\n");
+    printf("        --out-format FORMAT\n");
+    printf("                           Frame candidates as \"lines\" (default), \"nul\" terminated, \"length\" prefixed by a length byte,\n");
+    printf("                           or \"slots\" of %d bytes, NUL padded with the length in the last byte\n", BLOCK_SIZE);
+    printf("        --hex-output       Write candidates with a newline, carriage return, ':' or unprintable bytes as $HEX[...]\n");
+    printf("        --out-encoding ENCODING\n");
+    printf("                           Write candidates as \"bytes\" (default) or \"utf16le\", decoding UTF-8 and widening the framing to match\n");
+    printf("        --compress FORMAT  Compress output with \"gzip\" or \"zstd\", each worker compressing its own buffers\n");
+    printf("        --compress-level N Compression level (default %d for gzip, %d for zstd)\n", COMPRESS_GZIP_LEVEL, COMPRESS_ZSTD_LEVEL);
+    printf("        --no-pin           Don't pin workers to CPUs or copy rules to each NUMA node\n");
+    printf("        --autotune[=FILE]  Benchmark the start of the input to pick the thread count, batch size and pinning\n");
+    printf("                           The chosen settings are saved to FILE, if given\n");
+    printf("        --config FILE      Load settings saved by --autotune\n");
+    printf("        --compile-rules FILE\n");
+    printf("                           Compile the rule files into FILE and exit, FILE can then be given in place of them\n");
+    printf("        --rules-cache FILE Use FILE if it was compiled from the same rule files, otherwise load them and rewrite it\n");
+    printf("    -w, --wordlist PATH    Read input words from PATH instead of STDIN, may be given more than once\n");
+    printf("                           A directory includes every file under it, in name order\n");
+    printf("        --readers N        Threads reading wordlists when there are several (default %d)\n", INPUT_READERS);
+    printf("                           or decompressing a single .gz or .zst wordlist\n");
+    printf("        --word-order ORDER Hand out words from several wordlists by \"file\" (default) or \"interleave\"\n");
+    printf("        --pack-wordlist FILE\n");
+    printf("                           Pack the input words into FILE and exit, FILE can then be given with -w or on STDIN\n");
+    printf("        --index-wordlists  Write an index next to each -w wordlist and exit, used by --skip when present\n");
+    printf("    -s, --skip N           Skip the first N words times rules of the keyspace (each word runs through every rule in turn)\n");
+    printf("    -l, --limit N          Stop after N words times rules of the keyspace\n");
+    printf("        --dedupe MODE      Drop repeated candidates, \"word\" drops those a word already produced through another rule\n");
+    printf("                           and \"global\" those any word already produced, remembering them on disk in $TMPDIR\n");
+    printf("        --dedupe-memory MB Memory for --dedupe global (default %d)\n", SEEN_MEMORY_MB);
+    printf("        --stream-rules     Hold the wordlist in memory and read rules one at a time, requires -w\n");
+    printf("                           Rules come from the rule files, or STDIN if none are given\n");
+    printf("        --rule-filter MB   Memory for detecting duplicate streamed rules (default %d)\n", STREAM_FILTER_MB);
+    printf("        --merge-rules FILE Write the unique rules of the rule files to FILE in their original order and exit\n");
+    printf("                           Works on rule files of any size, using temporary files in $TMPDIR\n");
+    printf("        --merge-memory MB  Memory for --merge-rules (default %d)\n", MERGE_MEMORY_MB);
+    printf("    -h, --help             Show this message\n");
+    printf("\n");
+    printf("With more than one worker, the order of output lines is not preserved\n");
+    printf("\n");
+    printf("\n");
     printf("EXAMPLE:\n");
     printf("    %s  best64.rule  <  words.txt\n", hcre);
     printf("    some_process  |  %s  leetspeak.rule  combinator.rule\n", hcre);
+    printf("    %s  -t 8  -o out.%%d  best64.rule  <  words.txt\n", hcre);
+    printf("    %s  --autotune=tuned.conf  best64.rule  <  words.txt\n", hcre);
+    printf("    %s  --compile-rules big.hcrb  big.rule  &&  %s  big.hcrb  <  words.txt\n", hcre, hcre);
+    printf("    %s  -t 0  -w wordlists/  -w extra.txt  best64.rule\n", hcre);
+    printf("    %s  --pack-wordlist words.hcrw  -w words.txt  &&  %s  -w words.hcrw  best64.rule\n", hcre, hcre);
+    printf("    %s  --index-wordlists  -w words.txt  &&  %s  -s 5000000000  -l 1000000000  -w words.txt  best64.rule\n", hcre, hcre);
+    printf("    %s  --output-shm words  -w words.txt  best64.rule  &  hcre-shmcat  words  |  consumer\n", hcre);
+    printf("    rule_generator  |  %s  --stream-rules  -w  words.txt\n", hcre);
+    printf("    %s  --merge-rules all.rule  collection/*.rule\n", hcre);
     printf("\n");
 }
 
 
-int main(int argc, char **argv) {
-    if (argc <= 1) { usage(argv[0]); return 0; }
+// Loads rules from rule files, a compiled rule file, or a cache of the rule files
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int load_rules(RuleSet *rules, const Options *options, char **file_names, int file_count) {
+    // A compiled file on its own is trusted as-is, alongside others it would be read as rule text
+    for (int file_num = 0; file_num < file_count; file_num++) {
+        if (!rulecache_detect(file_names[file_num])) { continue; }
+        if (file_count == 1) { return rulecache_open(rules, file_names[0], NULL); }
 
-    // Allows rule upper/lower/toggle to follow locale
-    setlocale(LC_CTYPE, "");
+        fprintf(stderr, "ERROR: Compiled rules file <%s> can't be combined with other rule files\n", file_names[file_num]);
+        return -1;
+    }
 
+    uint64_t input_hash = 0;
+    if (options->cache_file) {
+        if (rulecache_input_hash(file_names, file_count, &input_hash) != 0) { return -1; }
 
-    // Our hash structure's head node
-    RuleHash *rules = NULL;
+        int rtn = rulecache_open(rules, options->cache_file, &input_hash);
+        if (rtn <= 0) { return rtn; }
+    }
 
-    // For iterating rules hash with HASH_ITER
-    RuleHash *hash_temp = NULL;
+    // Rules are loaded with every CPU we have, regardless of how many workers will run
+    Topology topology;
+    int load_threads = 1;
+    if (topology_detect(&topology) == 0) {
+        load_threads = topology.cpu_count;
+        topology_free(&topology);
+    }
 
-    // Output for prase_rule()
-    Rule *cur_rule = NULL;
+    if (ruleset_load(rules, file_names, file_count, load_threads) != 0) { return -1; }
 
-    // Reading/writing to rules hash
-    RuleHash *cur_hash = NULL;
+    // The cache is only an optimization, failing to write it doesn't stop the run
+    if (options->cache_file && rulecache_write(rules, options->cache_file, input_hash) != 0) {
+        fprintf(stderr, "WARNING: Continuing without updating the rules cache\n");
+    }
+    return 0;
+}
 
-    // getline() will read into this
-    char   *line     = NULL;
-    ssize_t line_len = 0;
-    size_t  line_malloc_size = 0;
 
-    unsigned int error_count = 0;
-    unsigned int dupe_count  = 0;
+// Parses a keyspace position or count
+// Returns 0 on success, -1 if text isn't a plain number
+static int parse_count(const char *text, uint64_t *count) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-') { return -1; }
 
+    *count = value;
+    return 0;
+}
 
-    // Process each file of rules
-    for (int file_num = 1; file_num < argc; file_num++) {
 
-        char *file_name = argv[file_num];
-        FILE *rule_file = fopen(file_name, "rb");
+// Builds an index for every -w wordlist with every CPU, like rule loading
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int index_main(const Options *options) {
+    if (options->wordlist_count == 0) {
+        fprintf(stderr, "ERROR: --index-wordlists needs a wordlist given with -w\n");
+        return -1;
+    }
 
-        // Make sure we successfully opened the rule file
-        if (rule_file == NULL) {
-            fprintf(stderr, "ERROR: Failed to open input file <%s>\n", file_name);
-            return -1;
-        }
+    Topology topology;
+    int index_threads = 1;
+    if (topology_detect(&topology) == 0) {
+        index_threads = topology.cpu_count;
+        topology_free(&topology);
+    }
 
+    for (int wordlist_num = 0; wordlist_num < options->wordlist_count; wordlist_num++) {
+        if (wordindex_build(options->wordlists[wordlist_num], index_threads) != 0) { return -1; }
+    }
+    return 0;
+}
 
-        // Read each rule from the input file
-        unsigned int line_num = 0;
-        while ( !feof(rule_file) ) {
-            line_len = getline(&line, &line_malloc_size, rule_file);
 
-            // Stop processing file on error or end of input (we don't care which)
-            if (line_len <= 0) { break; }
-            line_num++;
+// Opens the -w wordlists, or stdin if there aren't any
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int open_words(WordReader *input, const Options *options) {
+    if (options->wordlist_count > 0) {
+        return input_open_files(input, options->wordlists, options->wordlist_count, options->readers, options->word_order);
+    }
 
-            // Trim trailing newline by overwriting it will a NULL terminator
-            while (line[line_len - 1] == '\n' || line[line_len - 1] == '\r') {
-                line[--line_len] = 0;
-            }
+    if (input_open(input, stdin) != 0) {
+        fprintf(stderr, "ERROR: Failed to initialize input\n");
+        return -1;
+    }
+    return 0;
+}
 
-            // Skip empty lines and commented lines
-            if (line_len ==  0 ) { continue; }
-            if (line[0]  == '#') { continue; }
 
+// Sets up the candidate set for --dedupe global, if it was asked for
+// Returns the set, NULL if it wasn't or on failure (*failed is set and an error has already been printed)
+static SeenSet *open_seen(const Options *options, SeenSet *seen, bool *failed) {
+    *failed = false;
+    if (!options->dedupe_global) { return NULL; }
 
-            #ifdef DEBUG_PARSING
-            fprintf(stderr, "Before Parsing: %s (Length: %d)\n", line, line_len);
-            #endif
+    if (seen_init(seen, options->dedupe_mb) != 0) {
+        *failed = true;
+        return NULL;
+    }
+    return seen;
+}
 
-            // Prase and validate the rule into cur_rule
-            int rule_check = parse_rule(line, line_len, &cur_rule);
-            if (rule_check < 0) {
-                fprintf(
-                    stderr, "File: <%s>; Line: <%u>; Rule: <%s>; Error: %s\n",
-                    file_name, line_num, line, cur_rule->text
-                );
 
-                error_count++;
-                continue;
-            }
+// Frees the candidate set, saying so if its filter was too full to be much use
+static void close_seen(SeenSet *seen) {
+    if (seen == NULL) { return; }
 
-            #ifdef DEBUG_PARSING
-            fprintf(stderr, "After  Parsing: %s (Length: %d)\n", cur_rule->text, cur_rule->length);
-            fprintf(stderr, "\n");
-            #endif
-
-
-            // Check if the cleaned rule is a dupe
-            HASH_FIND(hh, rules, cur_rule->text, cur_rule->length, hash_temp);
-            if (hash_temp != NULL) {
-                #ifdef DEBUG_DUPES
-                fprintf(
-                    stderr, "File: <%s>; Line: <%u>; Rule: <%s>; Duplicate of <%s> from <%s> line <%u>\n",
-                    file_name, line_num, line,
-                    hash_temp->source_text, hash_temp->source_file, hash_temp->source_line
-                );
-                #endif
-
-                dupe_count++;
-                continue;
-            }
+    SeenStats stats;
+    seen_stats(seen, &stats);
+    double false_positives = (stats.unique_count ? (double)stats.false_positive_count / stats.unique_count : 0);
 
+    #ifdef DEBUG_STATS
+    fprintf(
+        stderr, "Deduplicated %lu unique candidates, dropped %lu global duplicates, deferred %lu, filter false positive rate %.4f, %lu runs in %lu bytes\n",
+        (unsigned long)stats.unique_count, (unsigned long)stats.dupe_count, (unsigned long)stats.deferred_count,
+        false_positives, (unsigned long)stats.run_count, (unsigned long)stats.disk_bytes
+    );
+    #endif
+
+    if (false_positives > SEEN_FPR_WARN) {
+        fprintf(stderr, "WARNING: The dedupe filter matched %.1f%% of new candidates, a larger --dedupe-memory would help\n", false_positives * 100);
+    }
+    seen_free(seen);
+}
 
-            // Make a new hash entry from the current rule
-            cur_hash = (RuleHash *)calloc(1, sizeof(RuleHash));
-            cur_hash->rule        = clone_rule(cur_rule);
-            cur_hash->source_file = strdup(file_name);
-            cur_hash->source_line = line_num;
-            cur_hash->source_text = strdup(line);
 
-            // If clone_rule() failed, we have a major problem
-            if (!cur_hash->rule) {
-                fprintf(stderr, "Failed to clone rule, aborting\n");
-                return -1;
-            }
+// Runs --stream-rules: the whole wordlist is loaded, then rules are read and applied as they arrive
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int stream_main(Options *options, char **rule_files, int rule_file_count) {
+    WordReader words;
+    if (open_words(&words, options) != 0) { return -1; }
+
+    int rtn = 0;
+    // Reader threads only report a failure once their wordlist is done with
+    if (input_read_all(&words) < 0 || input_failed(&words)) {
+        fprintf(stderr, "ERROR: Failed to read wordlists\n");
+        rtn = -1;
+    }
 
-            HASH_ADD_KEYPTR(hh, rules, cur_hash->rule->text, cur_hash->rule->length, cur_hash);
+    if (rtn == 0 && options->auto_threads) {
+        Topology topology;
+        options->config.thread_count = 1;
+        if (topology_detect(&topology) == 0) {
+            options->config.thread_count = topology.cpu_count;
+            topology_free(&topology);
         }
+    }
 
+    SeenSet   seen_set;
+    bool      seen_failed = false;
+    SeenSet  *seen        = (rtn == 0 ? open_seen(options, &seen_set, &seen_failed) : NULL);
+    OutputSet output;
+    if (rtn == 0 && (seen_failed || output_open(&output, &options->output, options->config.thread_count) != 0)) {
+        rtn = -1;
+    } else if (rtn == 0) {
+        StreamStats stats;
+        rtn = stream_run(&options->config, &words.pending, rule_files, rule_file_count, options->filter_mb, seen, &output, &stats);
+
+        #ifdef DEBUG_STATS
+        fprintf(
+            stderr, "Streamed %lu rules, skipped %lu broken and %lu duplicate rules, %lu rules forgotten by the filter\n",
+            stats.rule_count, stats.error_count, stats.dupe_count, stats.forgotten_count
+        );
+        fprintf(stderr, "Created %lu words, rejected %lu\n", stats.word_count, stats.reject_count);
+        #endif
+
+        if (output_close(&output) != 0) {
+            fprintf(stderr, "ERROR: Failed to close output\n");
+            rtn = -1;
+        }
+    }
+
+    close_seen(seen);
+    input_close(&words);
+    return rtn;
+}
 
-        fclose(rule_file);
+
+// Runs --merge-rules with every CPU, like rule loading
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int merge_main(const Options *options, char **rule_files, int rule_file_count) {
+    Topology topology;
+    int merge_threads = 1;
+    if (topology_detect(&topology) == 0) {
+        merge_threads = topology.cpu_count;
+        topology_free(&topology);
     }
 
+    MergeStats stats;
+    int rtn = merge_rules(rule_files, rule_file_count, options->merge_file, options->merge_mb, merge_threads, &stats);
+
     #ifdef DEBUG_STATS
     fprintf(
-        stderr, "Loaded %u rules, skipped %u broken and %u duplicate rules\n",
-        HASH_COUNT(rules), error_count, dupe_count
+        stderr, "Merged %lu rule lines into %lu rules, skipped %lu broken and %lu duplicate rules\n",
+        stats.line_count, stats.rule_count, stats.error_count, stats.dupe_count
     );
     #endif
 
+    return rtn;
+}
 
 
-    // Our mangled text ends up here
-    char rule_output[BLOCK_SIZE];
+int main(int argc, char **argv) {
+    if (argc <= 1) { usage(argv[0]); return 0; }
 
-    // Statistics
-    unsigned long int word_count   = 0;
-    unsigned long int reject_count = 0;
+    // Allows rule upper/lower/toggle to follow locale
+    setlocale(LC_CTYPE, "");
 
-    // Increase the output buffering
-    if (setvbuf(stdout, NULL, _IOFBF, 1024 * 1024) != 0) {
-        fprintf(stderr, "Failed to adjust stdout buffer size\n");
-    }
 
-    // Main processing loop, runs for each line of input
-    while ( !feof(stdin) ) {
-        line_len = getline(&line, &line_malloc_size, stdin);
+    Options options = {
+        .config = {
+            .thread_count = 1,
+            .batch_size   = WORD_BATCH_SIZE,
+            .pin_threads  = true,
+        },
+        .auto_threads   = false,
+        .autotune       = false,
+        .autotune_file  = NULL,
+        .output = {
+            .pattern  = NULL,
+            .fd_list  = NULL,
+            .shm_name = NULL,
+            .shm_mb   = SHMRING_MB,
+            .direct   = false,
+            .compress = COMPRESSION_NONE,
+            .compress_level = 0,
+            .format   = FORMAT_LINES,
+            .hex      = false,
+            .encoding = ENCODING_BYTES,
+        },
+        .compile_file   = NULL,
+        .cache_file     = NULL,
+        .wordlists      = NULL,
+        .wordlist_count = 0,
+        .readers        = INPUT_READERS,
+        .word_order     = ORDER_FILES,
+        .stream_rules   = false,
+        .filter_mb      = STREAM_FILTER_MB,
+        .merge_file     = NULL,
+        .merge_mb       = MERGE_MEMORY_MB,
+        .pack_file      = NULL,
+        .index_wordlists = false,
+        .skip           = 0,
+        .limit          = 0,
+        .limited        = false,
+        .dedupe_words   = false,
+        .dedupe_global  = false,
+        .dedupe_mb      = SEEN_MEMORY_MB,
+    };
+
+    enum { OPT_OUTPUT_FD = 256, OPT_NO_PIN, OPT_AUTOTUNE, OPT_CONFIG, OPT_COMPILE_RULES, OPT_RULES_CACHE,
+           OPT_STREAM_RULES, OPT_RULE_FILTER, OPT_MERGE_RULES, OPT_MERGE_MEMORY,
+           OPT_READERS, OPT_WORD_ORDER, OPT_PACK_WORDLIST, OPT_INDEX_WORDLISTS,
+           OPT_DIRECT_IO, OPT_OUTPUT_SHM, OPT_SHM_SIZE, OPT_COMPRESS, OPT_COMPRESS_LEVEL, OPT_OUT_FORMAT, OPT_HEX_OUTPUT,
+           OPT_OUT_ENCODING, OPT_DEDUPE, OPT_DEDUPE_MEMORY };
+    static struct option long_options[] = {
+        { "threads",   required_argument, NULL, 't'           },
+        { "output",    required_argument, NULL, 'o'           },
+        { "output-fd", required_argument, NULL, OPT_OUTPUT_FD },
+        { "no-pin",    no_argument,       NULL, OPT_NO_PIN    },
+        { "direct-io", no_argument,       NULL, OPT_DIRECT_IO },
+        { "output-shm", required_argument, NULL, OPT_OUTPUT_SHM },
+        { "shm-size",  required_argument, NULL, OPT_SHM_SIZE  },
+        { "out-format", required_argument, NULL, OPT_OUT_FORMAT },
+        { "hex-output", no_argument,       NULL, OPT_HEX_OUTPUT },
+        { "out-encoding", required_argument, NULL, OPT_OUT_ENCODING },
+        { "compress",  required_argument, NULL, OPT_COMPRESS  },
+        { "compress-level", required_argument, NULL, OPT_COMPRESS_LEVEL },
+        { "autotune",  optional_argument, NULL, OPT_AUTOTUNE  },
+        { "config",    required_argument, NULL, OPT_CONFIG    },
+        { "compile-rules", required_argument, NULL, OPT_COMPILE_RULES },
+        { "rules-cache",   required_argument, NULL, OPT_RULES_CACHE   },
+        { "wordlist",      required_argument, NULL, 'w'               },
+        { "readers",       required_argument, NULL, OPT_READERS       },
+        { "word-order",    required_argument, NULL, OPT_WORD_ORDER    },
+        { "pack-wordlist", required_argument, NULL, OPT_PACK_WORDLIST },
+        { "index-wordlists", no_argument,     NULL, OPT_INDEX_WORDLISTS },
+        { "skip",          required_argument, NULL, 's'               },
+        { "limit",         required_argument, NULL, 'l'               },
+        { "dedupe",        required_argument, NULL, OPT_DEDUPE        },
+        { "dedupe-memory", required_argument, NULL, OPT_DEDUPE_MEMORY },
+        { "stream-rules",  no_argument,       NULL, OPT_STREAM_RULES  },
+        { "rule-filter",   required_argument, NULL, OPT_RULE_FILTER   },
+        { "merge-rules",   required_argument, NULL, OPT_MERGE_RULES   },
+        { "merge-memory",  required_argument, NULL, OPT_MERGE_MEMORY  },
+        { "help",      no_argument,       NULL, 'h'           },
+        { NULL,        0,                 NULL, 0             }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:o:w:s:l:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                options.config.thread_count = atoi(optarg);
+                if (options.config.thread_count < 0) {
+                    fprintf(stderr, "ERROR: Invalid thread count <%s>\n", optarg);
+                    return -1;
+                }
+                options.auto_threads = (options.config.thread_count == 0);
+                break;
+
+            case 'o':           options.output.pattern     = optarg; break;
+            case OPT_OUTPUT_FD: options.output.fd_list     = optarg; break;
+            case OPT_OUTPUT_SHM: options.output.shm_name   = optarg; break;
+            case OPT_NO_PIN:    options.config.pin_threads = false;  break;
+            case OPT_DIRECT_IO: options.output.direct      = true;   break;
+            case OPT_HEX_OUTPUT: options.output.hex        = true;   break;
+
+            case OPT_SHM_SIZE:
+                if (atoi(optarg) < SHMRING_MIN_MB) {
+                    fprintf(stderr, "ERROR: Invalid shared memory ring size <%s>, the smallest is %d\n", optarg, SHMRING_MIN_MB);
+                    return -1;
+                }
+                options.output.shm_mb = atoi(optarg);
+                break;
+
+            case OPT_OUT_FORMAT:
+                if (strcmp(optarg, "lines") == 0) {
+                    options.output.format = FORMAT_LINES;
+                } else if (strcmp(optarg, "nul") == 0) {
+                    options.output.format = FORMAT_NUL;
+                } else if (strcmp(optarg, "length") == 0) {
+                    options.output.format = FORMAT_LENGTH;
+                } else if (strcmp(optarg, "slots") == 0) {
+                    options.output.format = FORMAT_SLOTS;
+                } else {
+                    fprintf(stderr, "ERROR: Invalid output format <%s>\n", optarg);
+                    return -1;
+                }
 
-        // Error or end of input
-        if (line_len <= 0) { break; }
+                // Both keep the length in a single byte
+                if ((options.output.format == FORMAT_LENGTH || options.output.format == FORMAT_SLOTS) && BLOCK_SIZE > 256) {
+                    fprintf(stderr, "ERROR: Output format <%s> needs a BLOCK_SIZE of 256 or less\n", optarg);
+                    return -1;
+                }
+                break;
 
-        // Trim trailing newline, skip blank lines
-        line[--line_len] = 0;
-        if (line_len == 0) { continue; }
+            case OPT_OUT_ENCODING:
+                if (strcmp(optarg, "bytes") == 0) {
+                    options.output.encoding = ENCODING_BYTES;
+                } else if (strcmp(optarg, "utf16le") == 0) {
+                    options.output.encoding = ENCODING_UTF16LE;
+                } else {
+                    fprintf(stderr, "ERROR: Invalid output encoding <%s>\n", optarg);
+                    return -1;
+                }
+                break;
 
+            case OPT_COMPRESS:
+                if (strcmp(optarg, "gzip") == 0) {
+                    options.output.compress = COMPRESSION_GZIP;
+                } else if (strcmp(optarg, "zstd") == 0) {
+                    options.output.compress = COMPRESSION_ZSTD;
+                } else {
+                    fprintf(stderr, "ERROR: Invalid compression format <%s>\n", optarg);
+                    return -1;
+                }
+                break;
+
+            // Checked against the format once every option has been read
+            case OPT_COMPRESS_LEVEL:
+                options.output.compress_level = atoi(optarg);
+                if (options.output.compress_level < 1) {
+                    fprintf(stderr, "ERROR: Invalid compression level <%s>\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case OPT_COMPILE_RULES: options.compile_file = optarg; break;
+            case OPT_RULES_CACHE:   options.cache_file   = optarg; break;
+
+            // Every -w adds another path
+            case 'w': {
+                char **wordlists = (char **)realloc(options.wordlists, (options.wordlist_count + 1) * sizeof(char *));
+                if (wordlists == NULL) { return -1; }
+                options.wordlists = wordlists;
+                options.wordlists[options.wordlist_count++] = optarg;
+                break;
+            }
 
-        // Safely iterate the rules hash
-        HASH_ITER(hh, rules, cur_hash, hash_temp) {
-            cur_rule = cur_hash->rule;
+            case OPT_READERS:
+                options.readers = atoi(optarg);
+                if (options.readers < 1) {
+                    fprintf(stderr, "ERROR: Invalid reader count <%s>\n", optarg);
+                    return -1;
+                }
+                break;
 
-            // Apply the rule operations
-            int rule_rtn = apply_rule(cur_rule, line, line_len, rule_output);
+            case OPT_WORD_ORDER:
+                if (strcmp(optarg, "file") == 0) {
+                    options.word_order = ORDER_FILES;
+                } else if (strcmp(optarg, "interleave") == 0) {
+                    options.word_order = ORDER_INTERLEAVE;
+                } else {
+                    fprintf(stderr, "ERROR: Invalid word order <%s>\n", optarg);
+                    return -1;
+                }
+                break;
 
-            // Something broke?
-            if (rule_rtn < 0) {
-                if (rule_rtn == REJECTED) {
-                    // Rejections are expected, they're okay
-                    reject_count++;
+            case OPT_STREAM_RULES:  options.stream_rules = true;   break;
+            case OPT_PACK_WORDLIST: options.pack_file    = optarg; break;
+            case OPT_INDEX_WORDLISTS: options.index_wordlists = true; break;
 
+            case 's':
+                if (parse_count(optarg, &options.skip) != 0) {
+                    fprintf(stderr, "ERROR: Invalid skip <%s>\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'l':
+                if (parse_count(optarg, &options.limit) != 0 || options.limit == 0) {
+                    fprintf(stderr, "ERROR: Invalid limit <%s>\n", optarg);
+                    return -1;
+                }
+                options.limited = true;
+                break;
+
+            case OPT_RULE_FILTER:
+                if (atoi(optarg) < 1) {
+                    fprintf(stderr, "ERROR: Invalid rule filter size <%s>\n", optarg);
+                    return -1;
+                }
+                options.filter_mb = atoi(optarg);
+                break;
+
+            // A word's own repeats are cheaper to catch than going through the global set
+            case OPT_DEDUPE:
+                if (strcmp(optarg, "word") == 0) {
+                    options.dedupe_words  = true;
+                } else if (strcmp(optarg, "global") == 0) {
+                    options.dedupe_words  = true;
+                    options.dedupe_global = true;
                 } else {
-                    // We missed something in parsing and now our rule broke
-                    // We can't "fix" the rule, so our only option is to remove it
-                    // If you ever see this message, please contact the developer
-                    fprintf(stderr,
-                        "Input word <%s> broke rule <%s> from file <%s>, line <%u> (parsed as <%s>): %s\n",
-                        line,
-                        cur_hash->source_text, cur_hash->source_file, cur_hash->source_line, cur_rule->text,
-                        rule_output
-                    );
-
-                    HASH_DEL(rules, cur_hash);
-                    free_hash(cur_hash);
+                    fprintf(stderr, "ERROR: Invalid dedupe mode <%s>\n", optarg);
+                    return -1;
                 }
+                break;
 
-                // Regardless if this was a rejection or error, we're not printing this word
-                continue;
-            }
+            case OPT_DEDUPE_MEMORY:
+                if (atoi(optarg) < SEEN_MIN_MB) {
+                    fprintf(stderr, "ERROR: Invalid dedupe memory size <%s>, the smallest is %d\n", optarg, SEEN_MIN_MB);
+                    return -1;
+                }
+                options.dedupe_mb = atoi(optarg);
+                break;
+
+            case OPT_MERGE_RULES: options.merge_file = optarg; break;
+
+            case OPT_MERGE_MEMORY:
+                if (atoi(optarg) < 1) {
+                    fprintf(stderr, "ERROR: Invalid merge memory size <%s>\n", optarg);
+                    return -1;
+                }
+                options.merge_mb = atoi(optarg);
+                break;
+
+            case OPT_AUTOTUNE:
+                options.autotune      = true;
+                options.autotune_file = optarg;
+                break;
+
+            // Settings are applied in order, so options after --config override the file
+            case OPT_CONFIG:
+                if (config_load(&options.config, optarg) != 0) { return -1; }
+                options.auto_threads = false;
+                break;
+
+            case 'h':
+                usage(argv[0]);
+                return 0;
+
+            default:
+                return -1;
+        }
+    }
+
+    if (options.output.compress != COMPRESSION_NONE) {
+        int max_level = compress_max_level(options.output.compress);
+        if (max_level == 0) {
+            fprintf(stderr, "ERROR: zstd output needs libzstd, which couldn't be loaded\n");
+            return -1;
+        }
+
+        if (options.output.compress_level == 0) {
+            options.output.compress_level = (options.output.compress == COMPRESSION_GZIP ? COMPRESS_GZIP_LEVEL : COMPRESS_ZSTD_LEVEL);
+        } else if (options.output.compress_level > max_level) {
+            fprintf(stderr, "ERROR: Invalid compression level <%d>, the highest is %d\n", options.output.compress_level, max_level);
+            return -1;
+        }
+    }
+
+    // Packing only needs words, no rules
+    if (options.pack_file) {
+        WordReader input;
+        if (open_words(&input, &options) != 0) { return -1; }
+
+        int rtn = wordpack_write(&input, options.pack_file);
+        input_close(&input);
+        free(options.wordlists);
+        return rtn;
+    }
+
+    if (options.index_wordlists) {
+        int rtn = index_main(&options);
+        free(options.wordlists);
+        return rtn;
+    }
+
+    // A slice only means something when words come out in the same order every time
+    if (options.skip > 0 || options.limited) {
+        if (options.stream_rules || options.merge_file || options.compile_file) {
+            fprintf(stderr, "ERROR: --skip and --limit can't be combined with --stream-rules, --merge-rules or --compile-rules\n");
+            return -1;
+        }
+        if (options.word_order == ORDER_INTERLEAVE) {
+            fprintf(stderr, "ERROR: --skip and --limit need the \"file\" word order\n");
+            return -1;
+        }
+    }
+
+    // Streamed rules may all come from stdin
+    if (optind >= argc && !options.stream_rules) { usage(argv[0]); return -1; }
+
+    if (options.stream_rules) {
+        if (options.wordlist_count == 0) {
+            fprintf(stderr, "ERROR: --stream-rules needs a wordlist given with -w\n");
+            return -1;
+        }
+        if (options.autotune || options.compile_file || options.cache_file || options.merge_file) {
+            fprintf(stderr, "ERROR: --stream-rules can't be combined with --autotune, --compile-rules, --rules-cache or --merge-rules\n");
+            return -1;
+        }
 
+        // Streamed rules run through every word in turn, a word's candidates are never all in one place
+        if (options.dedupe_words && !options.dedupe_global) {
+            fprintf(stderr, "ERROR: --dedupe word can't be combined with --stream-rules\n");
+            return -1;
+        }
+        int rtn = stream_main(&options, &argv[optind], argc - optind);
+        free(options.wordlists);
+        return rtn;
+    }
 
-            // In debug mode, include the rule itself with the output
-            #ifdef DEBUG_OUTPUT
-            fwrite(cur_rule->text, cur_rule->length, 1, stdout);
-            fputc('\t', stdout);
-            #endif
 
-            // Output the mangled word and a newline
-            rule_output[rule_rtn++] = '\n';
-            fwrite(rule_output, rule_rtn, 1, stdout);
-            word_count++;
+    // Merging only ever reads the rule files and writes another one
+    if (options.merge_file) {
+        if (options.compile_file) {
+            fprintf(stderr, "ERROR: --merge-rules can't be combined with --compile-rules\n");
+            free(options.wordlists);
+            return -1;
         }
+        int rtn = merge_main(&options, &argv[optind], argc - optind);
+        free(options.wordlists);
+        return rtn;
     }
 
+    // Compiling writes the same cache --rules-cache would, then stops before reading any words
+    if (options.compile_file) {
+        options.cache_file = options.compile_file;
+
+        if (rulecache_detect(argv[optind])) {
+            fprintf(stderr, "ERROR: Rule file <%s> is already compiled\n", argv[optind]);
+            return -1;
+        }
+
+        RuleSet rules;
+        if (load_rules(&rules, &options, &argv[optind], argc - optind) != 0) { return -1; }
+        ruleset_free(&rules);
+        return 0;
+    }
+
+    RuleSet rules;
+    if (load_rules(&rules, &options, &argv[optind], argc - optind) != 0) { return -1; }
 
     #ifdef DEBUG_STATS
-    fprintf(stderr, "Created %lu words, rejected %lu\n", word_count, reject_count);
+    fprintf(
+        stderr, "Loaded %zu rules, skipped %u broken and %u duplicate rules\n",
+        rules.count, rules.error_count, rules.dupe_count
+    );
     #endif
 
-    return 0;
-}
\ No newline at end of file
+
+    Engine engine;
+    if (engine_init(&engine, &rules) != 0) { return -1; }
+
+    if (options.auto_threads) {
+        options.config.thread_count = (engine.topology.cpu_count > 0 ? engine.topology.cpu_count : 1);
+    }
+
+    WordReader input;
+    if (open_words(&input, &options) != 0) { return -1; }
+
+    // Words are skipped and limited before autotuning reads ahead, the slice of the first and last word's rules
+    // only applies to the real run
+    uint64_t keyspace_start = 0, keyspace_end = UINT64_MAX;
+    if ((options.skip > 0 || options.limited) && rules.count > 0) {
+        if (input_skip(&input, options.skip / rules.count) < 0) {
+            fprintf(stderr, "ERROR: Failed to skip input words\n");
+            return -1;
+        }
+
+        keyspace_start = options.skip % rules.count;
+        if (options.limited) {
+            keyspace_end = (options.limit < UINT64_MAX - keyspace_start ? keyspace_start + options.limit : UINT64_MAX);
+            input_limit(&input, keyspace_end / rules.count + (keyspace_end % rules.count ? 1 : 0));
+        }
+    }
+
+    // Trials make global sets of their own, the real run's starts empty
+    engine_set_dedupe(&engine, options.dedupe_words, NULL);
+    if (options.autotune) {
+        if (autotune(&engine, &input, &options.output, (options.dedupe_global ? options.dedupe_mb : 0), &options.config) != 0) { return -1; }
+        if (options.autotune_file && config_save(&options.config, options.autotune_file) != 0) { return -1; }
+    }
+    engine_set_keyspace(&engine, keyspace_start, keyspace_end);
+
+    SeenSet  seen_set;
+    bool     seen_failed;
+    SeenSet *seen = open_seen(&options, &seen_set, &seen_failed);
+    if (seen_failed) { return -1; }
+    engine_set_dedupe(&engine, options.dedupe_words, seen);
+
+    OutputSet output;
+    if (output_open(&output, &options.output, options.config.thread_count) != 0) {
+        close_seen(seen);
+        return -1;
+    }
+
+
+    EngineStats stats;
+    int rtn = engine_run(&engine, &options.config, &input, &output, 0, &stats);
+
+    #ifdef DEBUG_STATS
+    fprintf(stderr, "Created %lu words, rejected %lu, dropped %lu per-word duplicates\n", stats.word_count, stats.reject_count, stats.dupe_count);
+    #endif
+
+    if (output_close(&output) != 0) {
+        fprintf(stderr, "ERROR: Failed to close output\n");
+        rtn = -1;
+    }
+
+    close_seen(seen);
+    input_close(&input);
+    engine_free(&engine);
+    ruleset_free(&rules);
+    free(options.wordlists);
+
+    return rtn;
+}
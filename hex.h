@@ -0,0 +1,127 @@
+#ifndef HEX_H
+#define HEX_H
+
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// hashcat's $HEX[...] notation for words that can't be written as plain lines
+// Everything here is inline, it runs once per input word and once per candidate
+
+#define HEX_PREFIX     "$HEX["
+#define HEX_PREFIX_LEN 5
+
+
+static inline int hex_digit_value(unsigned char c) {
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    return -1;
+}
+
+
+// Decodes digit_count hex digits from src into digit_count / 2 bytes at dst, which may be src or before it
+// Nothing is written unless every digit is valid and there's an even number of them
+// Returns the decoded length, -1 if src isn't hex
+static inline int hex_decode(char *dst, const char *src, int digit_count) {
+    if (digit_count % 2 != 0) { return -1; }
+
+    // Check everything before writing anything, dst may overlap src
+    int pos = 0;
+    #ifdef __SSE2__
+    const __m128i nine = _mm_set1_epi8('9' + 1), zero = _mm_set1_epi8('0' - 1);
+    const __m128i f    = _mm_set1_epi8('f' + 1), a    = _mm_set1_epi8('a' - 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    for (; pos + 16 <= digit_count; pos += 16) {
+        // Bytes over 0x7f compare as negative, so they're neither digits nor letters
+        __m128i text  = _mm_loadu_si128((const __m128i *)(src + pos));
+        __m128i lower = _mm_or_si128(text, case_bit);
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(text,  zero), _mm_cmplt_epi8(text,  nine));
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, a),    _mm_cmplt_epi8(lower, f));
+        if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff) { return -1; }
+    }
+    #endif
+    for (; pos < digit_count; pos++) {
+        if (hex_digit_value(src[pos]) < 0) { return -1; }
+    }
+
+    pos = 0;
+    #ifdef __SSE2__
+    const __m128i low_byte = _mm_set1_epi16(0xff);
+    for (; pos + 16 <= digit_count; pos += 16) {
+        // Digits become 0-9, letters a-f become 10-15
+        __m128i text   = _mm_loadu_si128((const __m128i *)(src + pos));
+        __m128i digit  = _mm_cmplt_epi8(text, nine);
+        __m128i value  = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(text, _mm_set1_epi8('0'))),
+                                      _mm_andnot_si128(digit, _mm_sub_epi8(_mm_or_si128(text, case_bit), _mm_set1_epi8('a' - 10))));
+
+        // Each pair is a 16 bit lane with the high nibble in its low byte
+        __m128i high   = _mm_slli_epi16(_mm_and_si128(value, low_byte), 4);
+        __m128i low    = _mm_srli_epi16(value, 8);
+        __m128i packed = _mm_packus_epi16(_mm_or_si128(high, low), _mm_setzero_si128());
+        _mm_storel_epi64((__m128i *)(dst + pos / 2), packed);
+    }
+    #endif
+    for (; pos < digit_count; pos += 2) {
+        dst[pos / 2] = (char)(hex_digit_value(src[pos]) << 4 | hex_digit_value(src[pos + 1]));
+    }
+    return digit_count / 2;
+}
+
+
+// Returns whether a word has to be written as $HEX[...] to survive as a line: a newline, carriage return, ':' or anything unprintable
+// So does a word that already looks like $HEX[...], or it would be decoded when read back
+static inline bool hex_needed(const char *word, int length) {
+    if (length > HEX_PREFIX_LEN && word[length - 1] == ']' && memcmp(word, HEX_PREFIX, HEX_PREFIX_LEN) == 0) { return true; }
+
+    int pos = 0;
+    #ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' '), del = _mm_set1_epi8(0x7f), colon = _mm_set1_epi8(':');
+    for (; pos + 16 <= length; pos += 16) {
+        // Bytes over 0x7f compare as negative, so they're caught along with the control characters
+        __m128i text = _mm_loadu_si128((const __m128i *)(word + pos));
+        __m128i bad  = _mm_or_si128(_mm_cmplt_epi8(text, space), _mm_or_si128(_mm_cmpeq_epi8(text, del), _mm_cmpeq_epi8(text, colon)));
+        if (_mm_movemask_epi8(bad)) { return true; }
+    }
+    #endif
+    for (; pos < length; pos++) {
+        unsigned char c = word[pos];
+        if (c < ' ' || c >= 0x7f || c == ':') { return true; }
+    }
+    return false;
+}
+
+
+// Writes word as $HEX[...] with lowercase digits into dst, which holds at least HEX_PREFIX_LEN + length * 2 + 1 bytes
+// Returns the encoded length
+static inline int hex_encode(char *dst, const char *word, int length) {
+    memcpy(dst, HEX_PREFIX, HEX_PREFIX_LEN);
+    char *digits = dst + HEX_PREFIX_LEN;
+
+    int pos = 0;
+    #ifdef __SSE2__
+    const __m128i nibble = _mm_set1_epi8(0x0f), nine = _mm_set1_epi8(9), letter = _mm_set1_epi8('a' - '0' - 10);
+    for (; pos + 8 <= length; pos += 8) {
+        // Split 8 bytes into 16 nibbles, high nibble first, then map 0-15 to '0'-'9' and 'a'-'f'
+        __m128i bytes  = _mm_loadl_epi64((const __m128i *)(word + pos));
+        __m128i high   = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+        __m128i low    = _mm_and_si128(bytes, nibble);
+        __m128i value  = _mm_unpacklo_epi8(high, low);
+        __m128i adjust = _mm_and_si128(_mm_cmpgt_epi8(value, nine), letter);
+        _mm_storeu_si128((__m128i *)(digits + pos * 2), _mm_add_epi8(_mm_add_epi8(value, _mm_set1_epi8('0')), adjust));
+    }
+    #endif
+    for (; pos < length; pos++) {
+        unsigned char c = word[pos];
+        digits[pos * 2]     = "0123456789abcdef"[c >> 4];
+        digits[pos * 2 + 1] = "0123456789abcdef"[c & 0x0f];
+    }
+
+    digits[length * 2] = ']';
+    return HEX_PREFIX_LEN + length * 2 + 1;
+}
+
+#endif /* HEX_H */
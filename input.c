@@ -0,0 +1,838 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include "input.h"
+#include "wordindex.h"
+#include "hex.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+// Returns the first newline in [text, end), or NULL if there isn't one
+// Most words are short, so 16 bytes are checked at once without a call into libc
+static inline const char *find_newline(const char *text, const char *end) {
+    #ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - text >= 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)text), newline));
+        if (mask) { return text + __builtin_ctz(mask); }
+        text += 16;
+    }
+    #endif
+
+    return (const char *)memchr(text, '\n', end - text);
+}
+
+
+static InputBlock *block_alloc(size_t size) {
+    InputBlock *block = (InputBlock *)calloc(1, sizeof(InputBlock));
+    if (block == NULL) { return NULL; }
+
+    block->data = (char *)malloc(size);
+    if (block->data == NULL) { free(block); return NULL; }
+
+    block->size = size;
+    block->refs = 1;
+    return block;
+}
+
+
+static void block_release(InputBlock *block) {
+    if (block == NULL || __atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) > 0) { return; }
+
+    if (block->mapped) {
+        munmap(block->data, block->size);
+    } else {
+        free(block->data);
+    }
+    free(block);
+}
+
+
+// Makes sure batch holds a reference to block
+static int batch_hold(WordBatch *batch, InputBlock *block) {
+    // Words are added in input order, so a block is only ever the latest one held
+    if (batch->block_count > 0 && batch->blocks[batch->block_count - 1] == block) { return 0; }
+
+    if (batch->block_count == batch->block_capacity) {
+        int capacity = (batch->block_capacity ? batch->block_capacity * 2 : 4);
+        InputBlock **blocks = (InputBlock **)realloc(batch->blocks, capacity * sizeof(InputBlock *));
+        if (blocks == NULL) { return -1; }
+
+        batch->blocks         = blocks;
+        batch->block_capacity = capacity;
+    }
+
+    __atomic_add_fetch(&block->refs, 1, __ATOMIC_RELAXED);
+    batch->blocks[batch->block_count++] = block;
+    return 0;
+}
+
+
+// Drops a batch's words and the blocks they pointed into
+static void batch_release(WordBatch *batch) {
+    for (int block_num = 0; block_num < batch->block_count; block_num++) { block_release(batch->blocks[block_num]); }
+    batch->block_count = 0;
+    batch->count       = 0;
+}
+
+
+// Maps a regular file from its current position to the end as a single block
+// Returns 0 on success, 1 if the stream isn't a regular file, -1 on failure
+static int map_source(WordSource *source) {
+    int fd = fileno(source->stream);
+
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) { return 1; }
+
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    if (position < 0) { return 1; }
+
+    // Nothing left, there's nothing to map either
+    source->eof = true;
+    if (info.st_size <= position) { return 0; }
+
+    // Writable so $HEX[...] words can be decoded in place, only the pages that hold one are copied
+    void *mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) { return -1; }
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+    source->block = (InputBlock *)calloc(1, sizeof(InputBlock));
+    if (source->block == NULL) {
+        munmap(mapping, info.st_size);
+        return -1;
+    }
+
+    source->block->data   = (char *)mapping;
+    source->block->length = info.st_size;
+    source->block->size   = info.st_size;
+    source->block->mapped = true;
+    source->block->refs   = 1;
+    source->scan          = position;
+    return 0;
+}
+
+
+// Opens a source by its path, "-" is stdin
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int open_source(WordSource *source) {
+    if (source->stream == NULL) {
+        source->stream = (strcmp(source->name, "-") == 0 ? stdin : fopen(source->name, "r"));
+        if (source->stream == NULL) {
+            fprintf(stderr, "ERROR: Failed to open wordlist <%s>\n", source->name);
+            return -1;
+        }
+
+        // Pipes and terminals can't take the hint, and that's fine
+        posix_fadvise(fileno(source->stream), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (map_source(source) < 0) {
+        fprintf(stderr, "ERROR: Failed to map wordlist <%s>\n", (source->name ? source->name : "STDIN"));
+        return -1;
+    }
+
+    // A compressed file is read from its decompressor from here on, like a stream
+    InputBlock *block = source->block;
+    const char *name  = (source->name ? source->name : "STDIN");
+    Compression format;
+    if (block != NULL && block->mapped && (format = decompress_detect(block->data + source->scan, block->length - source->scan)) != COMPRESSION_NONE) {
+        source->mapping = block;
+        source->block   = NULL;
+        source->eof     = false;
+
+        if (decompress_start(&source->decompressor, format, block->data + source->scan, block->length - source->scan, source->decompress_threads, name) != 0) { return -1; }
+        source->compressed = true;
+        source->scan       = 0;
+        return 0;
+    }
+
+    // Only a mapped file can be packed, a stream would need reading into a single block first
+    if (block != NULL && block->mapped && wordpack_detect(block->data + source->scan, block->length - source->scan)) {
+        if (wordpack_parse(&source->pack, block->data + source->scan, block->length - source->scan) != 0) { return -1; }
+        source->packed = true;
+    }
+    return 0;
+}
+
+
+// Drops everything a source holds, closing its stream if it was opened from a path
+static void close_source(WordSource *source) {
+    for (int queue_num = 0; queue_num < source->queue_count; queue_num++) {
+        WordBatch *queued = source->queue[(source->queue_head + queue_num) % INPUT_QUEUE_DEPTH];
+        input_batch_free(queued);
+        free(queued);
+    }
+    source->queue_count = 0;
+
+    block_release(source->block);
+    source->block = NULL;
+
+    decompress_free(&source->decompressor);
+    block_release(source->mapping);
+    source->mapping = NULL;
+
+    if (source->name && source->stream && source->stream != stdin) { fclose(source->stream); }
+    source->stream = NULL;
+}
+
+
+// Adds path to the list of paths, or everything under it in name order if it's a directory
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int add_path(char ***paths, int *count, int *capacity, const char *path) {
+    struct stat info;
+    if (strcmp(path, "-") != 0 && stat(path, &info) != 0) {
+        fprintf(stderr, "ERROR: Failed to open wordlist <%s>\n", path);
+        return -1;
+    }
+
+    if (strcmp(path, "-") != 0 && S_ISDIR(info.st_mode)) {
+        struct dirent **entries;
+        int entry_count = scandir(path, &entries, NULL, alphasort);
+        if (entry_count < 0) {
+            fprintf(stderr, "ERROR: Failed to read directory <%s>\n", path);
+            return -1;
+        }
+
+        int rtn = 0;
+        for (int entry_num = 0; entry_num < entry_count; entry_num++) {
+            const char *entry = entries[entry_num]->d_name;
+            bool        dots  = (strcmp(entry, ".") == 0 || strcmp(entry, "..") == 0);
+
+            char *entry_path = NULL;
+            if (rtn == 0 && !dots) {
+                if (asprintf(&entry_path, "%s/%s", path, entry) < 0) {
+                    rtn = -1;
+                } else {
+                    rtn = add_path(paths, count, capacity, entry_path);
+                    free(entry_path);
+                }
+            }
+            free(entries[entry_num]);
+        }
+        free(entries);
+        return rtn;
+    }
+
+    if (*count == *capacity) {
+        int new_capacity = (*capacity ? *capacity * 2 : 16);
+        char **new_paths = (char **)realloc(*paths, new_capacity * sizeof(char *));
+        if (new_paths == NULL) { return -1; }
+
+        *paths    = new_paths;
+        *capacity = new_capacity;
+    }
+
+    if (((*paths)[*count] = strdup(path)) == NULL) { return -1; }
+    (*count)++;
+    return 0;
+}
+
+
+static int reader_init(WordReader *reader, int source_count) {
+    memset(reader, 0, sizeof(WordReader));
+
+    // Samples have no sources of their own
+    if (source_count > 0) {
+        reader->sources = (WordSource *)calloc(source_count, sizeof(WordSource));
+        if (reader->sources == NULL) { return -1; }
+        reader->source_count = source_count;
+    }
+
+    pthread_mutex_init(&reader->lock,  NULL);
+    pthread_cond_init (&reader->ready, NULL);
+    pthread_cond_init (&reader->room,  NULL);
+    return 0;
+}
+
+
+int input_open(WordReader *reader, FILE *stream) {
+    if (reader_init(reader, 1) != 0) { return -1; }
+    reader->sources[0].stream             = stream;
+    reader->sources[0].decompress_threads = INPUT_READERS;
+
+    if (open_source(&reader->sources[0]) != 0) {
+        input_close(reader);
+        return -1;
+    }
+    return 0;
+}
+
+
+int input_open_sample(WordReader *sample, WordReader *source) {
+    if (reader_init(sample, 0) != 0) { return -1; }
+    sample->finished = true;
+    sample->loop     = (source->pending.count > 0);
+
+    // The sample borrows the source's words, input_close() knows not to free them
+    sample->pending = source->pending;
+    return 0;
+}
+
+
+void input_close(WordReader *reader) {
+    if (reader == NULL) { return; }
+
+    // Reader threads may be waiting for room that will never come
+    if (reader->thread_count > 0) {
+        pthread_mutex_lock(&reader->lock);
+        reader->stopping = true;
+        pthread_cond_broadcast(&reader->room);
+        pthread_mutex_unlock(&reader->lock);
+
+        for (int thread_num = 0; thread_num < reader->thread_count; thread_num++) {
+            pthread_join(reader->threads[thread_num], NULL);
+        }
+    }
+
+    for (int source_num = 0; source_num < reader->source_count; source_num++) {
+        close_source(&reader->sources[source_num]);
+        free(reader->sources[source_num].name);
+    }
+
+    // Sample readers don't own their pending words
+    if (reader->sources != NULL) { input_batch_free(&reader->pending); }
+
+    free(reader->sources);
+    free(reader->threads);
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy (&reader->ready);
+    pthread_cond_destroy (&reader->room);
+    memset(reader, 0, sizeof(WordReader));
+}
+
+
+int input_batch_init(WordBatch *batch, int capacity) {
+    if (capacity < 1) { capacity = WORD_BATCH_SIZE; }
+    memset(batch, 0, sizeof(WordBatch));
+
+    batch->words    = (const char **)calloc(capacity, sizeof(*batch->words));
+    batch->lengths  = (int *)calloc(capacity, sizeof(*batch->lengths));
+    batch->capacity = capacity;
+
+    if (batch->words == NULL || batch->lengths == NULL) {
+        input_batch_free(batch);
+        return -1;
+    }
+    return 0;
+}
+
+
+void input_batch_free(WordBatch *batch) {
+    if (batch == NULL) { return; }
+    batch_release(batch);
+    if (batch->words  ) { free(batch->words);   }
+    if (batch->lengths) { free(batch->lengths); }
+    if (batch->blocks ) { free(batch->blocks);  }
+    memset(batch, 0, sizeof(WordBatch));
+}
+
+
+// Reads more of the stream after the current block's unsplit bytes
+// When the block is short on room, they move to a new block and the old one is freed once its words are done with
+// Must be called by whoever owns the source
+// Returns 0 on success, -1 on failure
+static int read_block(WordSource *source) {
+    InputBlock *block = source->block;
+
+    if (block == NULL || block->size - block->length < INPUT_READ_MIN) {
+        size_t tail = (block ? block->length - source->scan : 0);
+        size_t size = INPUT_BLOCK_SIZE;
+        while (size < tail + INPUT_READ_MIN) { size *= 2; }
+
+        InputBlock *next = block_alloc(size);
+        if (next == NULL) { return -1; }
+
+        if (tail) { memcpy(next->data, block->data + source->scan, tail); }
+        next->length = tail;
+
+        block_release(block);
+        source->block = block = next;
+        source->scan  = 0;
+    }
+
+    // One read at a time, so a slow writer doesn't hold up the words it has already sent
+    ssize_t bytes;
+    if (source->compressed) {
+        if ((bytes = decompress_read(&source->decompressor, block->data + block->length, block->size - block->length)) < 0) { return -1; }
+    } else {
+        do {
+            bytes = read(fileno(source->stream), block->data + block->length, block->size - block->length);
+        } while (bytes < 0 && errno == EINTR);
+    }
+
+    // Errors end the input, same as running out
+    if (bytes <= 0) {
+        source->eof = true;
+        return 0;
+    }
+
+    block->length += bytes;
+    return 0;
+}
+
+
+// Hands out words from a packed source until batch holds max_count words
+// Must be called by whoever owns the source
+// Returns 0 on success, -1 on failure
+static int read_packed(WordSource *source, WordBatch *batch, int max_count) {
+    if (source->finished || batch->count >= max_count) { return 0; }
+    if (batch_hold(batch, source->block) != 0) { return -1; }
+
+    while (batch->count < max_count && source->pack_bucket < WORDPACK_BUCKETS) {
+        const WordPackBucket *bucket = &source->pack.buckets[source->pack_bucket];
+        if (source->pack_next >= bucket->count) {
+            source->pack_bucket++;
+            source->pack_next = 0;
+            continue;
+        }
+
+        // Every slot is already trimmed, truncated and non-empty, the clamp only guards against a corrupt file
+        uint64_t word_num = source->pack_next++;
+        int      length   = bucket->lengths[word_num];
+        if (length >= (int)bucket->slot_size) { length = bucket->slot_size - 1; }
+
+        batch->words  [batch->count] = bucket->slots + word_num * bucket->slot_size;
+        batch->lengths[batch->count] = length;
+        batch->count++;
+    }
+
+    if (source->pack_bucket == WORDPACK_BUCKETS) { source->finished = true; }
+    return 0;
+}
+
+
+// Splits words from a source into batch until it holds max_count words
+// Must be called by whoever owns the source
+// Returns 0 on success, -1 on failure
+static int read_source(WordSource *source, WordBatch *batch, int max_count) {
+    if (source->packed) { return read_packed(source, batch, max_count); }
+
+    while (!source->finished && batch->count < max_count) {
+        InputBlock *block = source->block;
+        const char *start = (block ? block->data + source->scan   : NULL);
+        const char *end   = (block ? block->data + block->length  : NULL);
+        const char *next  = (block ? find_newline(start, end)     : NULL);
+
+        // No complete line left, read more or take the unterminated last line
+        if (next == NULL) {
+            if (!source->eof) {
+                if (read_block(source) != 0) { return -1; }
+                continue;
+            }
+
+            source->finished = true;
+            if (start == end) { break; }
+            next = end;
+        }
+
+        int line_len = next - start;
+        source->scan = (next - block->data) + (next < end ? 1 : 0);
+
+        // Trim a trailing carriage return, skip blank lines
+        if (line_len > 0 && start[line_len - 1] == '\r') { line_len--; }
+        if (line_len == 0) { continue; }
+
+        // hashcat's $HEX[...] notation is decoded in place, the word is always shorter than its line
+        // Anything that isn't valid hex inside the brackets is left as a literal word
+        if (line_len > HEX_PREFIX_LEN && start[line_len - 1] == ']' && memcmp(start, HEX_PREFIX, HEX_PREFIX_LEN) == 0) {
+            int decoded = hex_decode((char *)start, start + HEX_PREFIX_LEN, line_len - HEX_PREFIX_LEN - 1);
+            if (decoded == 0) { continue; }
+            if (decoded >  0) { line_len = decoded; }
+        }
+
+        // apply_rule() would truncate the word to this length anyway
+        if (line_len > BLOCK_SIZE - 1) { line_len = BLOCK_SIZE - 1; }
+
+        if (batch_hold(batch, block) != 0) { return -1; }
+        batch->words  [batch->count] = start;
+        batch->lengths[batch->count] = line_len;
+        batch->count++;
+    }
+    return 0;
+}
+
+
+static void *reader_thread(void *arg) {
+    WordReader *reader = (WordReader *)arg;
+
+    while (true) {
+        // Sources are claimed in order, so the first one that hasn't been drained always has a thread on it
+        int source_num = __atomic_fetch_add(&reader->next_source, 1, __ATOMIC_RELAXED);
+        if (source_num >= reader->source_count) { break; }
+
+        WordSource *source = &reader->sources[source_num];
+        bool        failed = (open_source(source) != 0);
+
+        while (!failed) {
+            WordBatch *batch = (WordBatch *)malloc(sizeof(WordBatch));
+            if (batch == NULL || input_batch_init(batch, INPUT_QUEUE_WORDS) != 0) {
+                fprintf(stderr, "ERROR: Failed to allocate input buffers\n");
+                free(batch);
+                failed = true;
+                break;
+            }
+
+            if (read_source(source, batch, INPUT_QUEUE_WORDS) != 0) {
+                fprintf(stderr, "ERROR: Failed to read wordlist <%s>\n", source->name);
+                failed = true;
+            }
+
+            if (batch->count == 0) {
+                input_batch_free(batch);
+                free(batch);
+                break;
+            }
+
+            pthread_mutex_lock(&reader->lock);
+            while (source->queue_count == INPUT_QUEUE_DEPTH && !reader->stopping) {
+                pthread_cond_wait(&reader->room, &reader->lock);
+            }
+
+            bool stopping = reader->stopping;
+            if (!stopping) {
+                source->queue[(source->queue_head + source->queue_count) % INPUT_QUEUE_DEPTH] = batch;
+                source->queue_count++;
+                pthread_cond_broadcast(&reader->ready);
+            }
+            pthread_mutex_unlock(&reader->lock);
+
+            if (stopping) {
+                input_batch_free(batch);
+                free(batch);
+                return NULL;
+            }
+        }
+
+        // The queued batches hold on to whatever they point into, the rest can go now
+        decompress_free(&source->decompressor);
+        block_release(source->mapping);
+        source->mapping = NULL;
+
+        pthread_mutex_lock(&reader->lock);
+        block_release(source->block);
+        source->block = NULL;
+        source->done  = true;
+        if (failed) { reader->failed = true; }
+        pthread_cond_broadcast(&reader->ready);
+        pthread_mutex_unlock(&reader->lock);
+    }
+    return NULL;
+}
+
+
+// Picks the source workers take from next, NULL if there's nothing to take yet
+// Sets reader->finished once every source has been drained
+// Must be called with the reader locked
+static WordSource *next_queued(WordReader *reader) {
+    while (reader->first_source < reader->source_count) {
+        WordSource *source = &reader->sources[reader->first_source];
+        if (!source->done || source->queue_count > 0) { break; }
+        reader->first_source++;
+    }
+
+    if (reader->first_source == reader->source_count) {
+        reader->finished = true;
+        return NULL;
+    }
+
+    if (reader->order == ORDER_FILES) {
+        WordSource *source = &reader->sources[reader->first_source];
+        return (source->queue_count > 0 ? source : NULL);
+    }
+
+    for (int tries = 0; tries < reader->source_count; tries++) {
+        int source_num = reader->turn;
+        reader->turn = (reader->turn + 1) % reader->source_count;
+        if (reader->sources[source_num].queue_count > 0) { return &reader->sources[source_num]; }
+    }
+    return NULL;
+}
+
+
+// Fills batch with up to max_count words from the sources
+// Must be called with the reader locked
+// Returns 0 on success, -1 on failure
+static int fill_batch(WordReader *reader, WordBatch *batch, int max_count) {
+    if (reader->thread_count == 0) {
+        if (reader->finished || reader->source_count == 0) { return 0; }
+
+        int rtn = read_source(&reader->sources[0], batch, max_count);
+        reader->finished = reader->sources[0].finished;
+        return rtn;
+    }
+
+    while (!reader->finished && batch->count < max_count) {
+        WordSource *source = next_queued(reader);
+        if (source == NULL) {
+            if (!reader->finished) { pthread_cond_wait(&reader->ready, &reader->lock); }
+            continue;
+        }
+
+        // Take as much of the oldest queued batch as fits, along with the blocks it points into
+        WordBatch *queued = source->queue[source->queue_head];
+        for (int block_num = 0; block_num < queued->block_count; block_num++) {
+            if (batch_hold(batch, queued->blocks[block_num]) != 0) { return -1; }
+        }
+
+        int count = queued->count - source->queue_next;
+        if (count > max_count - batch->count) { count = max_count - batch->count; }
+
+        memcpy(batch->words   + batch->count, queued->words   + source->queue_next, count * sizeof(*batch->words));
+        memcpy(batch->lengths + batch->count, queued->lengths + source->queue_next, count * sizeof(*batch->lengths));
+        batch->count       += count;
+        source->queue_next += count;
+
+        if (source->queue_next == queued->count) {
+            input_batch_free(queued);
+            free(queued);
+            source->queue_head = (source->queue_head + 1) % INPUT_QUEUE_DEPTH;
+            source->queue_count--;
+            source->queue_next = 0;
+            pthread_cond_broadcast(&reader->room);
+        }
+    }
+    return 0;
+}
+
+
+// Fills batch with up to max_count words from the sources, stopping at the reader's limit
+// Must be called with the reader locked
+// Returns 0 on success, -1 on failure
+static int read_sources(WordReader *reader, WordBatch *batch, int max_count) {
+    if (!reader->limited) { return fill_batch(reader, batch, max_count); }
+
+    int before = batch->count;
+    if (max_count > before && (uint64_t)(max_count - before) > reader->remaining) { max_count = before + reader->remaining; }
+
+    int rtn = fill_batch(reader, batch, max_count);
+    reader->remaining -= batch->count - before;
+    if (reader->remaining == 0) { reader->finished = true; }
+    return rtn;
+}
+
+
+// Moves a packed or indexed source straight to word word_count, setting *skipped to the number of words it moved past
+// Anything else is left where it is for its words to be split and dropped
+// Must be called by whoever owns the source, before anything has been read from it
+static void jump_source(WordSource *source, uint64_t word_count, uint64_t *skipped) {
+    *skipped = 0;
+
+    if (source->packed) {
+        while (*skipped < word_count && source->pack_bucket < WORDPACK_BUCKETS) {
+            const WordPackBucket *bucket = &source->pack.buckets[source->pack_bucket];
+
+            uint64_t count = bucket->count - source->pack_next;
+            if (count > word_count - *skipped) { count = word_count - *skipped; }
+            source->pack_next += count;
+            *skipped          += count;
+
+            if (source->pack_next == bucket->count) {
+                source->pack_bucket++;
+                source->pack_next = 0;
+            }
+        }
+
+        if (source->pack_bucket == WORDPACK_BUCKETS) { source->finished = true; }
+        return;
+    }
+
+    // An index belongs to a path and its offsets count from the start of the file, which a mapped path is split from
+    if (source->name == NULL || strcmp(source->name, "-") == 0 || source->block == NULL || !source->block->mapped) { return; }
+
+    uint64_t offset, index;
+    if (wordindex_lookup(source->name, fileno(source->stream), word_count, &offset, &index) != 0) { return; }
+
+    source->scan = offset;
+    *skipped     = index;
+}
+
+
+int input_open_files(WordReader *reader, char **paths, int path_count, int reader_count, InputOrder order) {
+    char **names      = NULL;
+    int    name_count = 0;
+    int    capacity   = 0;
+
+    int rtn = 0;
+    for (int path_num = 0; path_num < path_count && rtn == 0; path_num++) {
+        rtn = add_path(&names, &name_count, &capacity, paths[path_num]);
+    }
+
+    if (rtn == 0 && name_count == 0) {
+        fprintf(stderr, "ERROR: No wordlists found\n");
+        rtn = -1;
+    }
+
+    if (rtn != 0 || reader_init(reader, name_count) != 0) {
+        for (int name_num = 0; name_num < name_count; name_num++) { free(names[name_num]); }
+        free(names);
+        return -1;
+    }
+
+    // With several files, each reader thread decompresses the one it's on, and the files are what's done in parallel
+    for (int name_num = 0; name_num < name_count; name_num++) {
+        reader->sources[name_num].name               = names[name_num];
+        reader->sources[name_num].decompress_threads = 1;
+    }
+    free(names);
+    reader->order = order;
+
+    // A single file is split by the workers as they need words, same as a stream
+    // If it's compressed, the reader threads decompress it instead
+    if (name_count == 1) {
+        reader->sources[0].decompress_threads = reader_count;
+        if (open_source(&reader->sources[0]) != 0) {
+            input_close(reader);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (reader_count < 1)          { reader_count = 1; }
+    if (reader_count > name_count) { reader_count = name_count; }
+
+    reader->threads = (pthread_t *)calloc(reader_count, sizeof(pthread_t));
+    if (reader->threads == NULL) {
+        input_close(reader);
+        return -1;
+    }
+
+    for (int thread_num = 0; thread_num < reader_count; thread_num++) {
+        if (pthread_create(&reader->threads[thread_num], NULL, reader_thread, reader) != 0) { break; }
+        reader->thread_count++;
+    }
+
+    if (reader->thread_count == 0) {
+        fprintf(stderr, "ERROR: Failed to start wordlist readers\n");
+        input_close(reader);
+        return -1;
+    }
+    return 0;
+}
+
+
+int input_read_ahead(WordReader *reader, int word_count) {
+    pthread_mutex_lock(&reader->lock);
+
+    int rtn = 0;
+    if (reader->pending.capacity < word_count) {
+        // Words are only pointers, so growing keeps whatever was already read ahead in place
+        const char **words   = (const char **)realloc(reader->pending.words, word_count * sizeof(*words));
+        if (words != NULL) { reader->pending.words = words; }
+
+        int         *lengths = (int *)realloc(reader->pending.lengths, word_count * sizeof(*lengths));
+        if (lengths != NULL) { reader->pending.lengths = lengths; }
+
+        if (words == NULL || lengths == NULL) {
+            rtn = -1;
+        } else {
+            reader->pending.capacity = word_count;
+        }
+    }
+
+    if (rtn == 0 && read_sources(reader, &reader->pending, word_count) != 0) {
+        reader->failed = true;
+        rtn = -1;
+    }
+    if (rtn == 0) { rtn = reader->pending.count - reader->pending_next; }
+
+    pthread_mutex_unlock(&reader->lock);
+    return rtn;
+}
+
+
+int input_read_all(WordReader *reader) {
+    int word_count = WORD_BATCH_SIZE;
+    while (true) {
+        int rtn = input_read_ahead(reader, word_count);
+        if (rtn < word_count) { return rtn; }
+
+        if (word_count > INT_MAX / 2) { return -1; }
+        word_count *= 2;
+    }
+}
+
+
+int64_t input_skip(WordReader *reader, uint64_t word_count) {
+    pthread_mutex_lock(&reader->lock);
+
+    // A single source has no reader thread, so it's ours to move
+    uint64_t skipped = 0;
+    if (reader->thread_count == 0 && reader->source_count == 1) { jump_source(&reader->sources[0], word_count, &skipped); }
+
+    // Whatever's left is split as usual and dropped
+    WordBatch scratch;
+    memset(&scratch, 0, sizeof(WordBatch));
+
+    int rtn = 0;
+    if (skipped < word_count && input_batch_init(&scratch, INPUT_QUEUE_WORDS) != 0) { rtn = -1; }
+
+    while (rtn == 0 && skipped < word_count && !reader->finished) {
+        int max_count = INPUT_QUEUE_WORDS;
+        if ((uint64_t)max_count > word_count - skipped) { max_count = word_count - skipped; }
+
+        if (fill_batch(reader, &scratch, max_count) != 0) { rtn = -1; }
+        skipped += scratch.count;
+        batch_release(&scratch);
+    }
+    input_batch_free(&scratch);
+
+    pthread_mutex_unlock(&reader->lock);
+    return (rtn == 0 ? (int64_t)skipped : -1);
+}
+
+
+void input_limit(WordReader *reader, uint64_t word_count) {
+    pthread_mutex_lock(&reader->lock);
+    reader->limited   = true;
+    reader->remaining = word_count;
+    if (word_count == 0) { reader->finished = true; }
+    pthread_mutex_unlock(&reader->lock);
+}
+
+
+int input_read_batch(WordReader *reader, WordBatch *batch) {
+    batch_release(batch);
+
+    pthread_mutex_lock(&reader->lock);
+    batch->first = reader->handed_out;
+
+    // Words that were read ahead go first, pending keeps the blocks they point into until the reader is closed
+    while (batch->count < batch->capacity && reader->pending_next < reader->pending.count) {
+        int word_num = reader->pending_next++;
+        batch->words  [batch->count] = reader->pending.words[word_num];
+        batch->lengths[batch->count] = reader->pending.lengths[word_num];
+        batch->count++;
+
+        if (reader->loop && reader->pending_next == reader->pending.count) { reader->pending_next = 0; }
+    }
+
+    // Stop handing out words, the run is reported as failed once the workers are done with what they have
+    if (read_sources(reader, batch, batch->capacity) != 0) {
+        fprintf(stderr, "ERROR: Failed to read input\n");
+        reader->finished = true;
+        reader->failed   = true;
+    }
+    reader->handed_out += batch->count;
+    pthread_mutex_unlock(&reader->lock);
+
+    return batch->count;
+}
+
+
+bool input_failed(WordReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    bool failed = reader->failed;
+    pthread_mutex_unlock(&reader->lock);
+    return failed;
+}
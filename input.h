@@ -0,0 +1,191 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "rules.h"
+#include "wordpack.h"
+#include "decompress.h"
+
+// Default number of words a worker takes from the input at a time
+#define WORD_BATCH_SIZE 1024
+
+// Piped input is read into blocks of this size, words are split out of them in place
+#define INPUT_BLOCK_SIZE (8 * 1024 * 1024)
+
+// A new block is started once the current one has less room than this left
+#define INPUT_READ_MIN (64 * 1024)
+
+// Default number of reader threads when there are several wordlists
+#define INPUT_READERS 4
+
+// With several wordlists, each reader thread queues up to this many batches of this many words per file
+#define INPUT_QUEUE_DEPTH 4
+#define INPUT_QUEUE_WORDS 4096
+
+
+// Input text that words point into, freed once nothing points into it anymore
+// Regular files are mapped as a single block, anything else is read a block at a time
+typedef struct InputBlock {
+    char  *data;
+    size_t length, size;
+    bool   mapped;
+
+    // The reader holds one reference while it's splitting words from the block, every batch holds one more
+    int    refs;
+} InputBlock;
+
+
+// Some input words, pointing into input blocks rather than holding copies
+// Words are not NULL terminated and are truncated the same way apply_rule() would truncate them
+typedef struct WordBatch {
+    const char **words;
+    int         *lengths;
+    int          count, capacity;
+
+    // How many words the reader had handed out before this batch's first word
+    uint64_t     first;
+
+    // Blocks the words point into, released when the batch is refilled or freed
+    InputBlock **blocks;
+    int          block_count, block_capacity;
+} WordBatch;
+
+
+// The order words from several wordlists are handed out in
+typedef enum InputOrder {
+    // Every word of a file before any word of the next, as if they had been concatenated
+    ORDER_FILES,
+
+    // A batch from each file in turn
+    ORDER_INTERLEAVE,
+} InputOrder;
+
+
+// One stream of newline separated words
+typedef struct WordSource {
+    FILE *stream;
+
+    // Path the stream is opened from, NULL if it was opened for us
+    char *name;
+
+    // The block words are being split from, and the offset of the first byte not yet split
+    InputBlock *block;
+    size_t      scan;
+
+    // Nothing more can be read into blocks, whatever is left in block is the last line
+    bool        eof;
+    bool        finished;
+
+    // A compressed wordlist is decompressed by threads of its own into blocks, the mapped file is held until then
+    bool         compressed;
+    Decompressor decompressor;
+    InputBlock  *mapping;
+    int          decompress_threads;
+
+    // A packed wordlist is handed out slot by slot instead of being split
+    bool        packed;
+    WordPack    pack;
+    int         pack_bucket;
+    uint64_t    pack_next;
+
+    // Batches a reader thread has split and workers haven't finished taking words from yet
+    // Only used with reader threads, protected by the reader's lock
+    WordBatch  *queue[INPUT_QUEUE_DEPTH];
+    int         queue_head, queue_count;
+    int         queue_next;
+
+    // The reader thread is done with this source, anything left is in queue
+    bool        done;
+} WordSource;
+
+
+// Input words shared between all workers
+// A single source is split by the workers themselves, several are split by reader threads
+typedef struct WordReader {
+    WordSource *sources;
+    int         source_count;
+    bool        finished;
+
+    // A wordlist couldn't be opened, read or decompressed, so the words handed out stop short of the input
+    bool        failed;
+
+    pthread_t  *threads;
+    int         thread_count;
+    InputOrder  order;
+
+    // The next source for a reader thread to open, the first one that hasn't been drained,
+    // and the one workers try next when interleaving
+    int         next_source;
+    int         first_source;
+    int         turn;
+
+    // Tells reader threads to give up, set when the reader is closed
+    bool        stopping;
+
+    // Words that were read ahead of time, handed out before anything else from the sources
+    WordBatch pending;
+    int       pending_next;
+
+    // Hand out the pending words over and over instead of moving on to the sources
+    bool      loop;
+
+    // Words handed out so far, and with a limit, how many more may be
+    uint64_t  handed_out;
+    bool      limited;
+    uint64_t  remaining;
+
+    pthread_mutex_t lock;
+
+    // Signalled when a queue gets a batch and when one has room for another
+    pthread_cond_t  ready, room;
+} WordReader;
+
+
+// Prepares a reader for a stream of newline separated words
+// A regular file is mapped from its current position instead of being read
+int input_open(WordReader *reader, FILE *stream);
+
+// Prepares a reader for wordlist files, directories (read recursively in name order) or "-" for stdin
+// Several files are read and split by up to reader_count threads, and handed out in the given order
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int input_open_files(WordReader *reader, char **paths, int path_count, int reader_count, InputOrder order);
+
+// Prepares a reader that endlessly repeats the words source has read ahead
+// source must outlive sample and may not be read from while sample is in use
+int input_open_sample(WordReader *sample, WordReader *source);
+
+// Frees the members of a reader and closes the files it opened, it does not close a stream passed to input_open()
+void input_close(WordReader *reader);
+
+// Reads up to word_count words ahead of time, they're still returned by input_read_batch() later
+// Returns the number of words now waiting to be read, -1 on failure
+int input_read_ahead(WordReader *reader, int word_count);
+
+// Reads everything that's left in the stream ahead of time, into reader->pending
+// Returns the number of words now waiting to be read, -1 on failure
+int input_read_all(WordReader *reader);
+
+// Moves past word_count words without handing them out, call before anything is read
+// A single wordlist jumps straight there when it's packed or has an up to date index, anything else is split and dropped
+// Returns the number of words skipped, less than word_count if the input ran out, -1 on failure
+int64_t input_skip(WordReader *reader, uint64_t word_count);
+
+// Stops handing out words once word_count more have been, call before anything is read
+void input_limit(WordReader *reader, uint64_t word_count);
+
+// Allocates a batch of capacity words, call from the worker thread so the memory is node-local
+int input_batch_init(WordBatch *batch, int capacity);
+
+// Frees the members of a batch
+void input_batch_free(WordBatch *batch);
+
+// Fills batch with the next words from the reader, skipping blank lines
+// Returns the number of words read, 0 at end of input
+int input_read_batch(WordReader *reader, WordBatch *batch);
+
+// Returns true if reading any wordlist failed, only final once the words have all been handed out
+bool input_failed(WordReader *reader);
+
+#endif /* INPUT_H */
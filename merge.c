@@ -0,0 +1,831 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "merge.h"
+#include "arena.h"
+#include "rules.h"
+
+
+// Runs are sorted either by parsed rule, to find duplicates, or by line number, to restore the input order
+typedef enum MergeOrder {
+    ORDER_RULE,
+    ORDER_LINE,
+} MergeOrder;
+
+
+// A record in memory, key is the parsed rule and text is the line it came from
+// seq numbers every rule line of every input file, in the order they were read
+typedef struct SortEntry {
+    const char *key, *text;
+    uint64_t    seq;
+    uint32_t    key_length, text_length;
+} SortEntry;
+
+
+// A record in a temporary file, followed by key_length bytes of key and text_length bytes of text
+typedef struct RecordHeader {
+    uint64_t seq;
+    uint32_t key_length, text_length;
+} RecordHeader;
+
+
+// A sorted run of records somewhere in a spill file
+typedef struct Run {
+    uint64_t offset, length;
+} Run;
+
+
+// A temporary file holding any number of runs, back to back
+typedef struct SpillFile {
+    FILE    *file;
+    uint64_t size;
+
+    Run     *runs;
+    size_t   run_count, run_capacity;
+} SpillFile;
+
+
+// Reads one run of a spill file a record at a time
+typedef struct RunReader {
+    int      fd;
+    uint64_t position, end;
+
+    // Unread bytes are buffer[next, length)
+    char    *buffer;
+    size_t   size, length, next;
+
+    // The current record, key and text point into buffer until the next read
+    RecordHeader header;
+    const char  *key, *text;
+} RunReader;
+
+
+// A rule line waiting to be parsed, its text is at offset in the input block
+typedef struct MergeLine {
+    size_t       offset;
+    uint32_t     length;
+    uint32_t     line_num;
+    int          file;
+} MergeLine;
+
+
+// Settings and totals shared by every phase
+typedef struct Merger {
+    char       **file_names;
+    int          thread_count;
+    size_t       memory;
+    size_t       fan_in;
+
+    // Rule lines read so far, the seq of the next one
+    uint64_t     seq;
+
+    // The current block of input, NULL terminated lines back to back
+    char        *text;
+    size_t       text_size, text_capacity;
+    MergeLine   *lines;
+    size_t       line_count, line_capacity;
+
+    // Runs sorted by rule, then the unique rules in runs sorted by line
+    SpillFile    rule_runs;
+    SpillFile    line_runs;
+
+    MergeStats  *stats;
+} Merger;
+
+
+// One thread's share of a block of input lines
+typedef struct ParseJob {
+    Merger      *merger;
+    pthread_t    thread;
+    size_t       first, count;
+
+    SortEntry   *entries;
+    size_t       entry_count;
+    Arena        keys;
+
+    // Broken rule messages, printed in order once every job is finished
+    char        *errors;
+    size_t       errors_size;
+    unsigned long error_count;
+
+    int          status;
+} ParseJob;
+
+
+// One thread's share of a block of entries being sorted
+typedef struct SortJob {
+    pthread_t    thread;
+    SortEntry   *entries;
+    size_t       count;
+    MergeOrder   order;
+} SortJob;
+
+
+// Unique rules collected from the rule runs, spilled as line runs whenever memory runs out
+typedef struct Collector {
+    Merger      *merger;
+    Arena        text;
+    size_t       text_size;
+    SortEntry   *entries;
+    size_t       count, capacity;
+} Collector;
+
+
+// Called with every record a merge produces, in order
+// Returns 0 on success, -1 on failure
+typedef int (*MergeEmit)(void *context, const RecordHeader *header, const char *key, const char *text);
+
+
+static int grow_array(void **array, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) { return 0; }
+
+    size_t new_capacity = (*capacity ? *capacity : 1024);
+    while (new_capacity < needed) { new_capacity *= 2; }
+
+    void *new_array = realloc(*array, new_capacity * item_size);
+    if (new_array == NULL) { return -1; }
+
+    *array    = new_array;
+    *capacity = new_capacity;
+    return 0;
+}
+
+
+static int compare_keys(const char *a, uint32_t a_length, const char *b, uint32_t b_length) {
+    int rtn = memcmp(a, b, (a_length < b_length ? a_length : b_length));
+    if (rtn != 0) { return rtn; }
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+
+// Identical rules are ordered by seq, so the first one of a group is the one to keep
+static int compare_by_rule(const void *a, const void *b) {
+    const SortEntry *entry_a = (const SortEntry *)a;
+    const SortEntry *entry_b = (const SortEntry *)b;
+
+    int rtn = compare_keys(entry_a->key, entry_a->key_length, entry_b->key, entry_b->key_length);
+    if (rtn != 0) { return rtn; }
+    return (entry_a->seq > entry_b->seq) - (entry_a->seq < entry_b->seq);
+}
+
+
+static int compare_by_line(const void *a, const void *b) {
+    const SortEntry *entry_a = (const SortEntry *)a;
+    const SortEntry *entry_b = (const SortEntry *)b;
+    return (entry_a->seq > entry_b->seq) - (entry_a->seq < entry_b->seq);
+}
+
+
+static int compare_readers(const RunReader *a, const RunReader *b, MergeOrder order) {
+    if (order == ORDER_RULE) {
+        int rtn = compare_keys(a->key, a->header.key_length, b->key, b->header.key_length);
+        if (rtn != 0) { return rtn; }
+    }
+    return (a->header.seq > b->header.seq) - (a->header.seq < b->header.seq);
+}
+
+
+// Spill files
+
+// Creates an anonymous temporary file in $TMPDIR, or /tmp
+static int spill_open(SpillFile *spill) {
+    memset(spill, 0, sizeof(SpillFile));
+
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || dir[0] == 0) { dir = "/tmp"; }
+
+    char *name = NULL;
+    if (asprintf(&name, "%s/hcre-merge-XXXXXX", dir) < 0) { return -1; }
+
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create a temporary file in <%s>\n", dir);
+        free(name);
+        return -1;
+    }
+
+    // Nobody else needs to find it, and it's cleaned up however we exit
+    unlink(name);
+    free(name);
+
+    spill->file = fdopen(fd, "w+");
+    if (spill->file == NULL) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void spill_close(SpillFile *spill) {
+    if (spill->file) { fclose(spill->file); }
+    free(spill->runs);
+    memset(spill, 0, sizeof(SpillFile));
+}
+
+
+static int spill_begin_run(SpillFile *spill) {
+    if (grow_array((void **)&spill->runs, &spill->run_capacity, spill->run_count + 1, sizeof(Run)) != 0) { return -1; }
+
+    spill->runs[spill->run_count].offset = spill->size;
+    spill->runs[spill->run_count].length = 0;
+    spill->run_count++;
+    return 0;
+}
+
+
+static void spill_end_run(SpillFile *spill) {
+    Run *run = &spill->runs[spill->run_count - 1];
+    run->length = spill->size - run->offset;
+}
+
+
+static int spill_record(SpillFile *spill, uint64_t seq, const char *key, uint32_t key_length,
+                        const char *text, uint32_t text_length) {
+    RecordHeader header = { .seq = seq, .key_length = key_length, .text_length = text_length };
+
+    if (fwrite(&header, sizeof(RecordHeader), 1, spill->file) != 1
+    ||  (key_length  && fwrite(key,  key_length,  1, spill->file) != 1)
+    ||  (text_length && fwrite(text, text_length, 1, spill->file) != 1)) {
+        fprintf(stderr, "ERROR: Failed to write a temporary file: %s\n", strerror(errno));
+        return -1;
+    }
+
+    spill->size += sizeof(RecordHeader) + key_length + text_length;
+    return 0;
+}
+
+
+// Writes sorted entries as a new run, dropping all but the first of each rule when sorted by rule
+static int spill_entries(SpillFile *spill, const SortEntry *entries, size_t count, MergeOrder order,
+                         unsigned long int *dupe_count) {
+    if (count == 0) { return 0; }
+    if (spill_begin_run(spill) != 0) { return -1; }
+
+    for (size_t entry_num = 0; entry_num < count; entry_num++) {
+        const SortEntry *entry = &entries[entry_num];
+
+        if (order == ORDER_RULE && entry_num > 0
+        &&  compare_keys(entry->key, entry->key_length, entries[entry_num - 1].key, entries[entry_num - 1].key_length) == 0) {
+            (*dupe_count)++;
+            continue;
+        }
+
+        if (spill_record(spill, entry->seq, entry->key, entry->key_length, entry->text, entry->text_length) != 0) {
+            return -1;
+        }
+    }
+
+    spill_end_run(spill);
+    return 0;
+}
+
+
+// Makes everything written so far visible to readers
+static int spill_flush(SpillFile *spill) {
+    if (fflush(spill->file) != 0) {
+        fprintf(stderr, "ERROR: Failed to write a temporary file: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+// Run readers
+
+// Makes sure at least needed unread bytes are in the buffer
+// Returns 0 on success, 1 if the run ends first, -1 on failure
+static int reader_fill(RunReader *reader, size_t needed) {
+    if (reader->length - reader->next >= needed) { return 0; }
+
+    // Move what's left to the front, and make room for records bigger than the buffer
+    memmove(reader->buffer, reader->buffer + reader->next, reader->length - reader->next);
+    reader->length -= reader->next;
+    reader->next    = 0;
+
+    if (needed > reader->size) {
+        char *buffer = (char *)realloc(reader->buffer, needed);
+        if (buffer == NULL) { return -1; }
+        reader->buffer = buffer;
+        reader->size   = needed;
+    }
+
+    while (reader->length < needed) {
+        size_t wanted = reader->size - reader->length;
+        if (wanted > reader->end - reader->position) { wanted = reader->end - reader->position; }
+        if (wanted == 0) { return 1; }
+
+        ssize_t bytes = pread(reader->fd, reader->buffer + reader->length, wanted, reader->position);
+        if (bytes < 0 && errno == EINTR) { continue; }
+        if (bytes <= 0) {
+            fprintf(stderr, "ERROR: Failed to read a temporary file: %s\n", (bytes < 0 ? strerror(errno) : "truncated"));
+            return -1;
+        }
+
+        reader->length   += bytes;
+        reader->position += bytes;
+    }
+    return 0;
+}
+
+
+// Moves on to the next record of the run
+// Returns 1 if there is one, 0 at the end of the run, -1 on failure
+static int reader_next(RunReader *reader) {
+    int rtn = reader_fill(reader, sizeof(RecordHeader));
+    if (rtn != 0) { return (rtn > 0 && reader->length == reader->next ? 0 : -1); }
+
+    memcpy(&reader->header, reader->buffer + reader->next, sizeof(RecordHeader));
+    reader->next += sizeof(RecordHeader);
+
+    size_t record_size = (size_t)reader->header.key_length + reader->header.text_length;
+    if (reader_fill(reader, record_size) != 0) {
+        fprintf(stderr, "ERROR: Temporary file is corrupt\n");
+        return -1;
+    }
+
+    reader->key   = reader->buffer + reader->next;
+    reader->text  = reader->key + reader->header.key_length;
+    reader->next += record_size;
+    return 1;
+}
+
+
+static void heap_sift_down(RunReader **heap, size_t count, size_t pos, MergeOrder order) {
+    while (true) {
+        size_t smallest = pos;
+        size_t left     = pos * 2 + 1;
+        size_t right    = left + 1;
+
+        if (left  < count && compare_readers(heap[left],  heap[smallest], order) < 0) { smallest = left;  }
+        if (right < count && compare_readers(heap[right], heap[smallest], order) < 0) { smallest = right; }
+        if (smallest == pos) { return; }
+
+        RunReader *swap = heap[pos];
+        heap[pos]       = heap[smallest];
+        heap[smallest]  = swap;
+        pos = smallest;
+    }
+}
+
+
+// Merges count runs of source starting at run first, passing every record to emit in order
+// When merging by rule, only the first record of each rule is emitted
+static int merge_runs(const Merger *merger, SpillFile *source, size_t first, size_t count, MergeOrder order,
+                      MergeEmit emit, void *context) {
+    if (count == 0) { return 0; }
+
+    RunReader  *readers = (RunReader *)calloc(count, sizeof(RunReader));
+    RunReader **heap    = (RunReader **)calloc(count, sizeof(RunReader *));
+    if (readers == NULL || heap == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate merge buffers\n");
+        free(readers);
+        free(heap);
+        return -1;
+    }
+
+    int    rtn        = 0;
+    size_t heap_count = 0;
+    for (size_t run_num = 0; run_num < count && rtn == 0; run_num++) {
+        RunReader *reader = &readers[run_num];
+        Run       *run    = &source->runs[first + run_num];
+        reader->fd        = fileno(source->file);
+        reader->position  = run->offset;
+        reader->end       = run->offset + run->length;
+        reader->size      = MERGE_READ_SIZE;
+        reader->buffer    = (char *)malloc(reader->size);
+        if (reader->buffer == NULL) {
+            fprintf(stderr, "ERROR: Failed to allocate merge buffers\n");
+            rtn = -1;
+            break;
+        }
+
+        int next = reader_next(reader);
+        if (next < 0) { rtn = -1; }
+        if (next > 0) { heap[heap_count++] = reader; }
+    }
+
+    for (size_t pos = heap_count / 2; pos-- > 0; ) { heap_sift_down(heap, heap_count, pos, order); }
+
+    // The last rule emitted, copied out since the reader's buffer moves on
+    char  *last_key      = NULL;
+    size_t last_capacity = 0;
+    size_t last_length   = 0;
+    bool   have_last     = false;
+
+    while (rtn == 0 && heap_count > 0) {
+        RunReader *reader = heap[0];
+
+        if (order == ORDER_RULE && have_last
+        &&  compare_keys(reader->key, reader->header.key_length, last_key, last_length) == 0) {
+            merger->stats->dupe_count++;
+        } else {
+            if (order == ORDER_RULE) {
+                if (grow_array((void **)&last_key, &last_capacity, reader->header.key_length + 1, 1) != 0) { rtn = -1; break; }
+                memcpy(last_key, reader->key, reader->header.key_length);
+                last_length = reader->header.key_length;
+                have_last   = true;
+            }
+
+            if (emit(context, &reader->header, reader->key, reader->text) != 0) { rtn = -1; break; }
+        }
+
+        int next = reader_next(reader);
+        if (next < 0) { rtn = -1; break; }
+        if (next == 0) { heap[0] = heap[--heap_count]; }
+        heap_sift_down(heap, heap_count, 0, order);
+    }
+
+    for (size_t run_num = 0; run_num < count; run_num++) { free(readers[run_num].buffer); }
+    free(readers);
+    free(heap);
+    free(last_key);
+    return rtn;
+}
+
+
+static int emit_to_spill(void *context, const RecordHeader *header, const char *key, const char *text) {
+    return spill_record((SpillFile *)context, header->seq, key, header->key_length, text, header->text_length);
+}
+
+
+// Merges groups of runs into longer runs until they can all be merged at once
+static int reduce_runs(Merger *merger, SpillFile *spill, MergeOrder order) {
+    if (spill_flush(spill) != 0) { return -1; }
+
+    while (spill->run_count > merger->fan_in) {
+        SpillFile merged;
+        if (spill_open(&merged) != 0) { return -1; }
+
+        for (size_t first = 0; first < spill->run_count; first += merger->fan_in) {
+            size_t count = spill->run_count - first;
+            if (count > merger->fan_in) { count = merger->fan_in; }
+
+            if (spill_begin_run(&merged) != 0
+            ||  merge_runs(merger, spill, first, count, order, emit_to_spill, &merged) != 0) {
+                spill_close(&merged);
+                return -1;
+            }
+            spill_end_run(&merged);
+        }
+
+        if (spill_flush(&merged) != 0) {
+            spill_close(&merged);
+            return -1;
+        }
+
+        spill_close(spill);
+        *spill = merged;
+    }
+    return 0;
+}
+
+
+// Sorting
+
+static void *sort_thread(void *arg) {
+    SortJob *job = (SortJob *)arg;
+    qsort(job->entries, job->count, sizeof(SortEntry), (job->order == ORDER_RULE ? compare_by_rule : compare_by_line));
+    return NULL;
+}
+
+
+// Sorts entries in one slice per thread and writes each slice as its own run
+static int sort_and_spill(Merger *merger, SortEntry *entries, size_t count, MergeOrder order, SpillFile *spill) {
+    int      thread_count = merger->thread_count;
+    SortJob *jobs         = (SortJob *)calloc(thread_count, sizeof(SortJob));
+    if (jobs == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate sort jobs\n");
+        return -1;
+    }
+
+    for (int job_num = 0; job_num < thread_count; job_num++) {
+        size_t first = count *  job_num      / thread_count;
+        size_t last  = count * (job_num + 1) / thread_count;
+        jobs[job_num].entries = entries + first;
+        jobs[job_num].count   = last - first;
+        jobs[job_num].order   = order;
+    }
+
+    // The last slice is sorted here, and so is any slice whose thread doesn't start
+    int started = 0;
+    for (int job_num = 0; job_num < thread_count - 1; job_num++) {
+        if (pthread_create(&jobs[job_num].thread, NULL, sort_thread, &jobs[job_num]) != 0) { break; }
+        started++;
+    }
+    for (int job_num = started; job_num < thread_count; job_num++) { sort_thread(&jobs[job_num]); }
+    for (int job_num = 0; job_num < started; job_num++) { pthread_join(jobs[job_num].thread, NULL); }
+
+    int rtn = 0;
+    for (int job_num = 0; job_num < thread_count && rtn == 0; job_num++) {
+        rtn = spill_entries(spill, jobs[job_num].entries, jobs[job_num].count, order, &merger->stats->dupe_count);
+    }
+
+    free(jobs);
+    return rtn;
+}
+
+
+// Phase 1: parse blocks of input into runs sorted by rule
+
+static void *parse_thread(void *arg) {
+    ParseJob *job    = (ParseJob *)arg;
+    Merger   *merger = job->merger;
+
+    FILE *errors = open_memstream(&job->errors, &job->errors_size);
+    if (errors == NULL) {
+        job->status = -1;
+        return NULL;
+    }
+
+    job->entries = (SortEntry *)malloc((job->count ? job->count : 1) * sizeof(SortEntry));
+    if (job->entries == NULL) { job->status = -1; }
+
+    // Output for parse_rule()
+    Rule *cur_rule = NULL;
+
+    for (size_t line_num = job->first; line_num < job->first + job->count && job->status == 0; line_num++) {
+        MergeLine *line = &merger->lines[line_num];
+        char      *text = merger->text + line->offset;
+
+        if (parse_rule(text, line->length, &cur_rule) < 0) {
+            fprintf(
+                errors, "File: <%s>; Line: <%u>; Rule: <%s>; Error: %s\n",
+                merger->file_names[line->file], line->line_num, text, cur_rule->text
+            );
+            job->error_count++;
+            continue;
+        }
+
+        char *key = arena_strndup(&job->keys, cur_rule->text, cur_rule->length);
+        if (key == NULL) {
+            job->status = -1;
+            break;
+        }
+
+        SortEntry *entry   = &job->entries[job->entry_count++];
+        entry->key         = key;
+        entry->key_length  = cur_rule->length;
+        entry->text        = text;
+        entry->text_length = line->length;
+        entry->seq         = merger->seq + line_num;
+    }
+
+    if (cur_rule) { free_rule(cur_rule); free(cur_rule); }
+
+    if (job->status == 0) { qsort(job->entries, job->entry_count, sizeof(SortEntry), compare_by_rule); }
+
+    fclose(errors);
+    return NULL;
+}
+
+
+// Parses and sorts the current block of input lines, one slice per thread, and spills each slice as a run
+static int spill_block(Merger *merger) {
+    int       thread_count = merger->thread_count;
+    ParseJob *jobs         = (ParseJob *)calloc(thread_count, sizeof(ParseJob));
+    if (jobs == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate parse jobs\n");
+        return -1;
+    }
+
+    for (int job_num = 0; job_num < thread_count; job_num++) {
+        ParseJob *job = &jobs[job_num];
+        job->merger   = merger;
+        job->first    = merger->line_count *  job_num      / thread_count;
+        job->count    = merger->line_count * (job_num + 1) / thread_count - job->first;
+        arena_init(&job->keys, 0);
+    }
+
+    // The last slice is parsed here, and so is any slice whose thread doesn't start
+    int started = 0;
+    for (int job_num = 0; job_num < thread_count - 1; job_num++) {
+        if (pthread_create(&jobs[job_num].thread, NULL, parse_thread, &jobs[job_num]) != 0) { break; }
+        started++;
+    }
+    for (int job_num = started; job_num < thread_count; job_num++) { parse_thread(&jobs[job_num]); }
+    for (int job_num = 0; job_num < started; job_num++) { pthread_join(jobs[job_num].thread, NULL); }
+
+    // Slices are in file order, so errors come out in file and line order
+    int rtn = 0;
+    for (int job_num = 0; job_num < thread_count; job_num++) {
+        ParseJob *job = &jobs[job_num];
+        if (job->status != 0) {
+            fprintf(stderr, "ERROR: Failed to parse rules\n");
+            rtn = -1;
+        }
+
+        if (rtn == 0) {
+            if (job->errors_size) { fwrite(job->errors, 1, job->errors_size, stderr); }
+            merger->stats->error_count += job->error_count;
+            rtn = spill_entries(&merger->rule_runs, job->entries, job->entry_count, ORDER_RULE, &merger->stats->dupe_count);
+        }
+
+        free(job->entries);
+        free(job->errors);
+        arena_free(&job->keys);
+    }
+    free(jobs);
+
+    merger->seq       += merger->line_count;
+    merger->text_size  = 0;
+    merger->line_count = 0;
+    return rtn;
+}
+
+
+// Reads every input file a block at a time, spilling each block as sorted runs
+static int read_inputs(Merger *merger, int file_count) {
+    char   *line      = NULL;
+    size_t  line_size = 0;
+    int     rtn       = 0;
+
+    // Parsed keys and sort entries take about as much memory again as the lines themselves
+    size_t block_limit = merger->memory / 3;
+
+    for (int file_num = 0; file_num < file_count && rtn == 0; file_num++) {
+        const char *file_name = merger->file_names[file_num];
+        FILE *rule_file = (strcmp(file_name, "-") == 0 ? stdin : fopen(file_name, "r"));
+        if (rule_file == NULL) {
+            fprintf(stderr, "ERROR: Failed to open input file <%s>\n", file_name);
+            rtn = -1;
+            break;
+        }
+
+        unsigned int line_num = 0;
+        ssize_t      line_len;
+        while ((line_len = getline(&line, &line_size, rule_file)) >= 0) {
+            line_num++;
+
+            // Trimmed and skipped exactly as ruleset_load() does
+            while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) { line[--line_len] = 0; }
+            if (line_len == 0 || line[0] == '#') { continue; }
+
+            if (merger->text_size + line_len + 1 + (merger->line_count + 1) * sizeof(MergeLine) > block_limit
+            &&  merger->line_count > 0 && spill_block(merger) != 0) {
+                rtn = -1;
+                break;
+            }
+
+            if (grow_array((void **)&merger->text,  &merger->text_capacity, merger->text_size  + line_len + 1, 1) != 0
+            ||  grow_array((void **)&merger->lines, &merger->line_capacity, merger->line_count + 1, sizeof(MergeLine)) != 0) {
+                fprintf(stderr, "ERROR: Failed to allocate input buffer\n");
+                rtn = -1;
+                break;
+            }
+
+            MergeLine *merge_line = &merger->lines[merger->line_count++];
+            merge_line->offset    = merger->text_size;
+            merge_line->length    = line_len;
+            merge_line->line_num  = line_num;
+            merge_line->file      = file_num;
+
+            memcpy(merger->text + merger->text_size, line, line_len + 1);
+            merger->text_size += line_len + 1;
+            merger->stats->line_count++;
+        }
+
+        if (rtn == 0 && ferror(rule_file)) {
+            fprintf(stderr, "ERROR: Failed to read input file <%s>\n", file_name);
+            rtn = -1;
+        }
+        if (rule_file != stdin) { fclose(rule_file); }
+    }
+
+    if (rtn == 0 && merger->line_count > 0) { rtn = spill_block(merger); }
+
+    free(line);
+    free(merger->text);
+    free(merger->lines);
+    merger->text  = NULL;
+    merger->lines = NULL;
+    return rtn;
+}
+
+
+// Phase 2: merge by rule, collecting the first line of each into runs sorted by line
+
+static int collector_spill(Collector *collector) {
+    Merger *merger = collector->merger;
+    int rtn = sort_and_spill(merger, collector->entries, collector->count, ORDER_LINE, &merger->line_runs);
+
+    arena_free(&collector->text);
+    arena_init(&collector->text, 0);
+    collector->text_size = 0;
+    collector->count     = 0;
+    return rtn;
+}
+
+
+static int emit_to_collector(void *context, const RecordHeader *header, const char *key, const char *text) {
+    (void)key;
+    Collector *collector = (Collector *)context;
+
+    // Merge readers hold the rest of the memory budget
+    if (collector->text_size + collector->count * sizeof(SortEntry) > collector->merger->memory / 2
+    &&  collector_spill(collector) != 0) {
+        return -1;
+    }
+
+    if (grow_array((void **)&collector->entries, &collector->capacity, collector->count + 1, sizeof(SortEntry)) != 0) {
+        fprintf(stderr, "ERROR: Failed to allocate merge buffers\n");
+        return -1;
+    }
+
+    char *text_copy = arena_strndup(&collector->text, text, header->text_length);
+    if (text_copy == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate merge buffers\n");
+        return -1;
+    }
+
+    SortEntry *entry   = &collector->entries[collector->count++];
+    entry->key         = NULL;
+    entry->key_length  = 0;
+    entry->text        = text_copy;
+    entry->text_length = header->text_length;
+    entry->seq         = header->seq;
+
+    collector->text_size += header->text_length + 1;
+    collector->merger->stats->rule_count++;
+    return 0;
+}
+
+
+// Phase 3: merge by line into the output file
+
+static int emit_to_output(void *context, const RecordHeader *header, const char *key, const char *text) {
+    (void)key;
+    FILE *output = (FILE *)context;
+
+    if (fwrite(text, 1, header->text_length, output) != header->text_length || fputc('\n', output) == EOF) {
+        fprintf(stderr, "ERROR: Failed to write merged rules: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+int merge_rules(char **file_names, int file_count, const char *output_name, size_t memory_mb, int thread_count,
+                MergeStats *stats) {
+    Merger merger;
+    memset(&merger, 0, sizeof(Merger));
+    memset(stats,   0, sizeof(MergeStats));
+    merger.file_names   = file_names;
+    merger.thread_count = (thread_count > 0 ? thread_count : 1);
+    merger.memory       = memory_mb * 1024 * 1024;
+    merger.stats        = stats;
+
+    // Half the budget goes to merge read buffers
+    merger.fan_in = merger.memory / 2 / MERGE_READ_SIZE;
+    if (merger.fan_in < 2)                { merger.fan_in = 2; }
+    if (merger.fan_in > MERGE_MAX_FAN_IN) { merger.fan_in = MERGE_MAX_FAN_IN; }
+
+    if (spill_open(&merger.rule_runs) != 0) { return -1; }
+    if (spill_open(&merger.line_runs) != 0) {
+        spill_close(&merger.rule_runs);
+        return -1;
+    }
+
+    Collector collector;
+    memset(&collector, 0, sizeof(Collector));
+    collector.merger = &merger;
+    arena_init(&collector.text, 0);
+
+    int rtn = read_inputs(&merger, file_count);
+    if (rtn == 0) { rtn = reduce_runs(&merger, &merger.rule_runs, ORDER_RULE); }
+    if (rtn == 0) { rtn = merge_runs(&merger, &merger.rule_runs, 0, merger.rule_runs.run_count, ORDER_RULE, emit_to_collector, &collector); }
+    if (rtn == 0) { rtn = collector_spill(&collector); }
+
+    arena_free(&collector.text);
+    free(collector.entries);
+    spill_close(&merger.rule_runs);
+
+    if (rtn == 0) { rtn = reduce_runs(&merger, &merger.line_runs, ORDER_LINE); }
+
+    // Opened last, so an output that's also one of the inputs was read in full before being replaced
+    if (rtn == 0) {
+        FILE *output = (strcmp(output_name, "-") == 0 ? stdout : fopen(output_name, "w"));
+        if (output == NULL) {
+            fprintf(stderr, "ERROR: Failed to open output file <%s>\n", output_name);
+            rtn = -1;
+        } else {
+            rtn = merge_runs(&merger, &merger.line_runs, 0, merger.line_runs.run_count, ORDER_LINE, emit_to_output, output);
+
+            bool written = (fflush(output) == 0);
+            if (output != stdout && fclose(output) != 0) { written = false; }
+            if (!written) {
+                fprintf(stderr, "ERROR: Failed to write output file <%s>\n", output_name);
+                rtn = -1;
+            }
+        }
+    }
+
+    spill_close(&merger.line_runs);
+    return rtn;
+}
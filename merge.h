@@ -0,0 +1,36 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stddef.h>
+
+// Default memory budget for merging, in MB
+#define MERGE_MEMORY_MB 256
+
+// Each run being merged reads its temporary file this much at a time
+#define MERGE_READ_SIZE (256 * 1024)
+
+// Most runs merged at once, more than this are merged in several passes
+#define MERGE_MAX_FAN_IN 256
+
+
+// Totals from a merge
+typedef struct MergeStats {
+    unsigned long int line_count;
+    unsigned long int rule_count;
+    unsigned long int error_count;
+    unsigned long int dupe_count;
+} MergeStats;
+
+
+// Deduplicates rule files that may be far bigger than memory into a single rule file
+// Rules are compared by their parsed form, and the first line of each rule is written in the order
+// the lines were read, so the output is what ruleset_load() would have kept
+// Lines are parsed and sorted into runs in memory_mb sized pieces, the runs are spilled to
+// temporary files in $TMPDIR and merged back together
+//   file_names  - Read in order, "-" is stdin
+//   output_name - Written only once every input has been read, "-" is stdout
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int merge_rules(char **file_names, int file_count, const char *output_name, size_t memory_mb, int thread_count,
+                MergeStats *stats);
+
+#endif /* MERGE_H */
@@ -0,0 +1,764 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "output.h"
+
+
+// Replaces the first marker ("%d" or "%l") in pattern with number
+// Returns a newly allocated string, or NULL on failure
+static char *replace_marker(const char *pattern, const char *marker, int number) {
+    const char *found = strstr(pattern, marker);
+    if (found == NULL) { return strdup(pattern); }
+
+    char *name = NULL;
+    int   rtn  = asprintf(&name, "%.*s%d%s", (int)(found - pattern), pattern, number, found + 2);
+    return (rtn < 0 ? NULL : name);
+}
+
+
+// Replaces the first "%d" in pattern with the sink number and the first "%l" with the candidate length
+// Returns a newly allocated string, or NULL on failure
+static char *expand_pattern(const char *pattern, int number, int length) {
+    char *name = replace_marker(pattern, "%d", number);
+    if (name == NULL) { return NULL; }
+
+    char *expanded = replace_marker(name, "%l", length);
+    free(name);
+    return expanded;
+}
+
+
+// Counts the comma separated entries of a list
+static int count_list(const char *list) {
+    int count = 1;
+    for (const char *pos = list; *pos; pos++) {
+        if (*pos == ',') { count++; }
+    }
+    return count;
+}
+
+
+// Sets up a sink to write to fd, or with fd -1 for a ring
+static void init_sink(OutputSink *sink, int fd, bool owned) {
+    sink->fd     = fd;
+    sink->owned  = owned;
+    sink->shm    = NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) { memset(&info, 0, sizeof(info)); }
+
+    // Shrinking the pipe is what makes splicing safe: a full buffer sent after another one pushes it out of the pipe
+    sink->splice    = false;
+    sink->pipe_size = 0;
+    if (S_ISFIFO(info.st_mode)) {
+        fcntl(fd, F_SETPIPE_SZ, OUTPUT_PIPE_SIZE);
+
+        int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+        if (pipe_size > 0 && pipe_size <= OUTPUT_PIPE_SIZE) {
+            sink->splice    = true;
+            sink->pipe_size = pipe_size;
+        }
+    }
+
+    // Files are written at offsets, which an appending fd would ignore
+    sink->positioned  = false;
+    sink->direct      = false;
+    sink->preallocate = false;
+    sink->allocated   = 0;
+    off_t position   = lseek(fd, 0, SEEK_CUR);
+    if (S_ISREG(info.st_mode) && !(fcntl(fd, F_GETFL) & O_APPEND) && position >= 0) {
+        sink->positioned = true;
+        sink->offset     = position;
+
+        // Only a file we opened (and truncated) is ours to extend and trim
+        sink->preallocate = owned;
+        sink->allocated   = position;
+    }
+}
+
+
+// Opens file_name as the sink's output
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int open_file(OutputSink *sink, const char *file_name) {
+    // Opening a FIFO blocks here until its reader shows up
+    int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Failed to open output file <%s>: %s\n", file_name, strerror(errno));
+        return -1;
+    }
+
+    init_sink(sink, fd, true);
+    return 0;
+}
+
+
+// Creates a shared memory ring of size bytes as the sink's output
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int open_ring(OutputSink *sink, const char *name, size_t size) {
+    init_sink(sink, -1, false);
+
+    sink->shm = (ShmRing *)malloc(sizeof(ShmRing));
+    if (sink->shm == NULL || shmring_create(sink->shm, name, size) != 0) {
+        free(sink->shm);
+        sink->shm = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+// Only a file we opened that no other worker writes to, written from the start of a block, can go direct
+static bool direct_possible(const OutputSink *sink) {
+    return sink->owned && sink->positioned && !sink->shared && sink->offset % OUTPUT_DIRECT_ALIGN == 0;
+}
+
+
+// Switches a sink's file to O_DIRECT, returns false if its filesystem doesn't take it
+static bool set_direct(OutputSink *sink) {
+    if (fcntl(sink->fd, F_SETFL, fcntl(sink->fd, F_GETFL) | O_DIRECT) != 0) { return false; }
+
+    sink->direct = true;
+    return true;
+}
+
+
+// Opens a partition's file or ring once its first candidate turns up, from whichever worker that is
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int open_partition(OutputSink *sink) {
+    if (__atomic_load_n(&sink->opened, __ATOMIC_ACQUIRE)) { return 0; }
+
+    int rtn = 0;
+    pthread_mutex_lock(&sink->lock);
+    if (!sink->opened) {
+        rtn = (sink->shm_size ? open_ring(sink, sink->name, sink->shm_size) : open_file(sink, sink->name));
+
+        // Workers only write through the page cache when the partitions aren't suitable, there's no warning for each of them
+        if (rtn == 0 && sink->open_direct && direct_possible(sink)) { set_direct(sink); }
+        if (rtn == 0) { __atomic_store_n(&sink->opened, true, __ATOMIC_RELEASE); }
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return rtn;
+}
+
+
+// Ends a partition that never got a candidate, so a reader waiting for its FIFO or ring sees the end of output
+// A plain file is never created at all, an empty compressed file wouldn't even be valid
+static void close_unopened(OutputSink *sink) {
+    if (sink->shm_size) {
+        ShmRing ring;
+        if (shmring_create(&ring, sink->name, (size_t)SHMRING_MIN_MB * 1024 * 1024) == 0) { shmring_close(&ring); }
+        return;
+    }
+
+    // Without a reader, opening the FIFO fails and there's nobody to tell
+    struct stat info;
+    if (stat(sink->name, &info) == 0 && S_ISFIFO(info.st_mode)) {
+        int fd = open(sink->name, O_WRONLY | O_NONBLOCK);
+        if (fd >= 0) { close(fd); }
+    }
+}
+
+
+int output_open(OutputSet *set, const OutputConfig *config, int worker_count) {
+    memset(set, 0, sizeof(OutputSet));
+    if (worker_count < 1) { return -1; }
+
+    if ((config->pattern != NULL) + (config->fd_list != NULL) + (config->shm_name != NULL) > 1) {
+        fprintf(stderr, "ERROR: Output file, output fd list and shared memory ring are mutually exclusive\n");
+        return -1;
+    }
+
+    if (config->shm_name != NULL && (config->compress != COMPRESSION_NONE || config->format != FORMAT_LINES)) {
+        fprintf(stderr, "ERROR: Shared memory rings only carry uncompressed, newline separated candidates\n");
+        return -1;
+    }
+
+    // The other formats can already carry any candidate
+    if (config->hex && config->format != FORMAT_LINES && config->format != FORMAT_NUL) {
+        fprintf(stderr, "ERROR: $HEX[] output only applies to line or NUL terminated output\n");
+        return -1;
+    }
+
+    if (config->encoding == ENCODING_UTF16LE && (config->hex || config->shm_name != NULL)) {
+        fprintf(stderr, "ERROR: UTF-16LE output can't be written as $HEX[] or to a shared memory ring\n");
+        return -1;
+    }
+
+    // Length prefixes and slot lengths are a byte each, counting bytes rather than characters
+    if (config->encoding == ENCODING_UTF16LE && (config->format == FORMAT_LENGTH || config->format == FORMAT_SLOTS)
+    &&  (BLOCK_SIZE - 1) * 2 > 255) {
+        fprintf(stderr, "ERROR: UTF-16LE candidates can be longer than a length byte holds\n");
+        return -1;
+    }
+
+    // Workers on the same sink are assigned round-robin, so we need at most one per worker
+    int sink_count = 1;
+    if (config->pattern != NULL && strstr(config->pattern, "%d") != NULL) { sink_count = worker_count; }
+    if (config->fd_list != NULL) { sink_count = count_list(config->fd_list); }
+
+    // Partitioned by length, every sink is repeated for every length a candidate can have
+    int partition_count = 1;
+    if ((config->pattern  != NULL && strstr(config->pattern,  "%l") != NULL)
+    ||  (config->shm_name != NULL && strstr(config->shm_name, "%l") != NULL)) {
+        partition_count = BLOCK_SIZE;
+    }
+
+    #ifdef DEBUG_OUTPUT
+    if (partition_count > 1) {
+        fprintf(stderr, "ERROR: Output partitioned by length can't carry the rules DEBUG_OUTPUT adds\n");
+        return -1;
+    }
+    #endif
+
+    set->sinks        = (OutputSink  *)calloc(sink_count * partition_count, sizeof(OutputSink));
+    set->worker_sinks = (OutputSink **)calloc(worker_count, sizeof(OutputSink *));
+    set->worker_count = worker_count;
+    if (set->sinks == NULL || set->worker_sinks == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate output sinks\n");
+        output_close(set);
+        return -1;
+    }
+
+
+    for (int sink_num = 0; sink_num < sink_count * partition_count; sink_num++) {
+        OutputSink *sink   = &set->sinks[sink_num];
+        int         length = sink_num / sink_count;
+
+        sink->fd = -1;
+        if (pthread_mutex_init(&sink->lock, NULL) != 0) {
+            fprintf(stderr, "ERROR: Failed to initialize output sink\n");
+            output_close(set);
+            return -1;
+        }
+        set->sink_count++;
+        sink->compress         = config->compress;
+        sink->compress_level   = config->compress_level;
+        sink->format           = config->format;
+        sink->hex              = config->hex;
+        sink->encoding         = config->encoding;
+        sink->buffer_size      = (partition_count > 1 ? OUTPUT_PARTITION_BUFFER_SIZE : OUTPUT_BUFFER_SIZE);
+        sink->partition_count  = (partition_count > 1 ? partition_count : 0);
+        sink->partition_stride = sink_count;
+
+        // Partitions are opened once they're needed, most lengths never are
+        if (partition_count > 1) {
+            if (config->discard) {
+                sink->name = strdup("/dev/null");
+            } else {
+                sink->name = (config->pattern != NULL ? expand_pattern(config->pattern, sink_num % sink_count, length)
+                                                      : replace_marker(config->shm_name, "%l", length));
+            }
+            sink->shm_size = (config->shm_name != NULL && !config->discard ? config->shm_mb * 1024 * 1024 : 0);
+            if (sink->name == NULL) {
+                fprintf(stderr, "ERROR: Failed to build output name from <%s>\n", (config->pattern ? config->pattern : config->shm_name));
+                output_close(set);
+                return -1;
+            }
+            continue;
+        }
+
+        if (config->discard) {
+            if (open_file(sink, "/dev/null") != 0) {
+                output_close(set);
+                return -1;
+            }
+
+        } else if (config->pattern != NULL) {
+            char *file_name = expand_pattern(config->pattern, sink_num, 0);
+            if (file_name == NULL) {
+                fprintf(stderr, "ERROR: Failed to build output file name from <%s>\n", config->pattern);
+                output_close(set);
+                return -1;
+            }
+
+            int rtn = open_file(sink, file_name);
+            free(file_name);
+            if (rtn != 0) {
+                output_close(set);
+                return -1;
+            }
+
+        } else if (config->shm_name != NULL) {
+            // The ring is the sink, there's no fd behind it
+            if (open_ring(sink, config->shm_name, config->shm_mb * 1024 * 1024) != 0) {
+                output_close(set);
+                return -1;
+            }
+
+        } else if (config->fd_list != NULL) {
+            // Skip to the sink_num'th entry of the list, the list is never partitioned
+            const char *entry = config->fd_list;
+            for (int skip = 0; skip < sink_num; skip++) { entry = strchr(entry, ',') + 1; }
+
+            char *end = NULL;
+            long  value = strtol(entry, &end, 10);
+            if (end == entry || (*end != ',' && *end != 0) || value < 0 || value > INT_MAX) {
+                fprintf(stderr, "ERROR: Invalid output fd list <%s>\n", config->fd_list);
+                output_close(set);
+                return -1;
+            }
+
+            if (fcntl((int)value, F_GETFL) < 0) {
+                fprintf(stderr, "ERROR: Output fd <%d> is not open\n", (int)value);
+                output_close(set);
+                return -1;
+            }
+            init_sink(sink, (int)value, false);
+
+        } else {
+            init_sink(sink, STDOUT_FILENO, false);
+        }
+        sink->opened = true;
+    }
+
+
+    for (int worker_num = 0; worker_num < worker_count; worker_num++) {
+        OutputSink *sink = &set->sinks[worker_num % sink_count];
+
+        // Any worker past the first lap shares its sink, and the sinks for its other lengths, with an earlier one
+        for (int length = 0; worker_num >= sink_count && length < partition_count; length++) {
+            sink[length * sink_count].shared = true;
+        }
+        set->worker_sinks[worker_num] = sink;
+    }
+
+    // A shared file would need every worker's last partial block written at the end, so only unshared ones go direct
+    // Compressed buffers come out in all sizes, so they can't either
+    if (config->direct && config->compress != COMPRESSION_NONE) {
+        fprintf(stderr, "WARNING: Compressed output is written through the page cache\n");
+    }
+    for (int sink_num = 0; config->direct && config->compress == COMPRESSION_NONE && sink_num < set->sink_count; sink_num++) {
+        OutputSink *sink = &set->sinks[sink_num];
+
+        // Partitions go direct when they're opened, until then only sharing is known, and every length shares alike
+        if (partition_count > 1) {
+            sink->open_direct = !sink->shared;
+            if (sink->shared && sink_num < sink_count) { fprintf(stderr, "WARNING: Output %d is shared, writing it through the page cache\n", sink_num); }
+            continue;
+        }
+
+        if (!direct_possible(sink)) {
+            fprintf(stderr, "WARNING: Output %d is shared or not a file opened by -o, writing it through the page cache\n", sink_num);
+            continue;
+        }
+
+        // Not every filesystem takes O_DIRECT
+        if (!set_direct(sink)) {
+            fprintf(stderr, "WARNING: Output %d doesn't support direct I/O, writing it through the page cache\n", sink_num);
+        }
+    }
+
+    return 0;
+}
+
+
+int output_close(OutputSet *set) {
+    if (set == NULL) { return 0; }
+
+    int rtn = 0;
+    for (int sink_num = 0; sink_num < set->sink_count; sink_num++) {
+        OutputSink *sink = &set->sinks[sink_num];
+
+        // Anything written to the fd after us should land after what we wrote at our offsets
+        if (sink->positioned && !sink->owned) { lseek(sink->fd, sink->offset, SEEK_SET); }
+
+        // Free the blocks preallocated past what was written
+        if (sink->allocated > sink->offset && ftruncate(sink->fd, sink->offset) != 0) { rtn = -1; }
+
+        if (sink->owned && close(sink->fd) != 0) { rtn = -1; }
+        pthread_mutex_destroy(&sink->lock);
+
+        if (sink->shm) {
+            shmring_close(sink->shm);
+            free(sink->shm);
+        }
+
+        if (sink->name) {
+            if (!sink->opened) { close_unopened(sink); }
+            free(sink->name);
+        }
+    }
+
+    if (set->sinks       ) { free(set->sinks);        }
+    if (set->worker_sinks) { free(set->worker_sinks); }
+    memset(set, 0, sizeof(OutputSet));
+    return rtn;
+}
+
+
+// Writes all of data to a sink, retrying short writes, the caller holds the lock if it's needed
+// Spliced pages are only referenced by the pipe, the caller must leave them alone until they've been pushed out of it
+static int write_all(OutputSink *sink, const char *data, size_t length, bool splice) {
+    if (sink->shm) { return shmring_write(sink->shm, data, length); }
+
+    int rtn = 0;
+    while (length > 0) {
+        ssize_t written;
+        if (splice) {
+            struct iovec pages = { (void *)data, length };
+            written = vmsplice(sink->fd, &pages, 1, 0);
+
+            // Whatever the pipe won't take is written instead, and so is everything after it
+            if (written < 0 && errno != EINTR) {
+                sink->splice = splice = false;
+                continue;
+            }
+        } else {
+            written = write(sink->fd, data, length);
+        }
+
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+
+            fprintf(stderr, "ERROR: Failed to write output: %s\n", strerror(errno));
+            rtn = -1;
+            break;
+        }
+
+        data   += written;
+        length -= written;
+    }
+    return rtn;
+}
+
+
+// Writes all of data to a file at offset, retrying short writes
+static int write_at(OutputSink *sink, const char *data, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(sink->fd, data, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+
+            fprintf(stderr, "ERROR: Failed to write output: %s\n", strerror(errno));
+            return -1;
+        }
+
+        data   += written;
+        length -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+
+// Reserves length bytes of a positioned sink for the caller to write at *offset
+// Files we opened have space allocated with fallocate() ahead of the reservations, so the filesystem can lay them out in large extents
+// The file's size is left alone, so a run that's killed leaves only what was written rather than a tail of NULs
+// Returns 0 on success, -1 if the space can't be allocated (an error has already been printed)
+static int reserve_range(OutputSink *sink, size_t length, uint64_t *offset) {
+    *offset = __atomic_fetch_add(&sink->offset, length, __ATOMIC_RELAXED);
+
+    uint64_t end = *offset + length;
+    if (!__atomic_load_n(&sink->preallocate, __ATOMIC_RELAXED) || end <= __atomic_load_n(&sink->allocated, __ATOMIC_ACQUIRE)) { return 0; }
+
+    int rtn = 0;
+    pthread_mutex_lock(&sink->lock);
+    while (sink->preallocate && sink->allocated < end) {
+        if (fallocate(sink->fd, FALLOC_FL_KEEP_SIZE, sink->allocated, OUTPUT_PREALLOCATE) != 0) {
+            // Only running out of space is worth stopping for, anything else just means no preallocation
+            if (errno == ENOSPC) {
+                fprintf(stderr, "ERROR: Failed to write output: %s\n", strerror(errno));
+                rtn = -1;
+            }
+            __atomic_store_n(&sink->preallocate, false, __ATOMIC_RELAXED);
+            break;
+        }
+        __atomic_store_n(&sink->allocated, sink->allocated + OUTPUT_PREALLOCATE, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return rtn;
+}
+
+
+int output_write(OutputSink *sink, const char *data, size_t length) {
+    if (sink->positioned) {
+        uint64_t offset;
+        if (reserve_range(sink, length, &offset) != 0) { return -1; }
+        return write_at(sink, data, length, offset);
+    }
+
+    if (sink->shared) { pthread_mutex_lock(&sink->lock); }
+    int rtn = write_all(sink, data, length, false);
+    if (sink->shared) { pthread_mutex_unlock(&sink->lock); }
+    return rtn;
+}
+
+
+// Waits for one of the buffer's writes to finish, finishing it with pwrite() if it came up short
+// Sets *slot to the slot that's now free
+static int wait_slot(OutputBuffer *buffer, int *slot) {
+    uint64_t id;
+    int      result;
+    if (uring_wait(buffer->ring, &id, &result) != 0 || id >= OUTPUT_RING_DEPTH) {
+        fprintf(stderr, "ERROR: Failed to wait for output to be written\n");
+        return -1;
+    }
+
+    *slot = (int)id;
+    buffer->slot_busy[id] = false;
+    buffer->in_flight--;
+
+    if (result < 0) {
+        fprintf(stderr, "ERROR: Failed to write output: %s\n", strerror(-result));
+        return -1;
+    }
+
+    size_t written = result;
+    if (written < buffer->slot_lengths[id]) {
+        return write_at(buffer->sink, buffer->slots[id] + written, buffer->slot_lengths[id] - written, buffer->slot_offsets[id] + written);
+    }
+    return 0;
+}
+
+
+// Waits for every write the buffer has in flight
+static int drain_slots(OutputBuffer *buffer) {
+    int rtn = 0;
+    while (buffer->in_flight > 0) {
+        int slot;
+        if (wait_slot(buffer, &slot) != 0) { rtn = -1; }
+    }
+    return rtn;
+}
+
+
+// Writes a buffer to a file at a reserved offset, through the ring if there is one so the worker can carry on
+// A direct sink only writes whole blocks, the rest moves to the start of the next buffer
+static int flush_positioned(OutputBuffer *buffer) {
+    OutputSink *sink = buffer->sink;
+
+    size_t length = buffer->length;
+    if (sink->direct) { length &= ~(size_t)(OUTPUT_DIRECT_ALIGN - 1); }
+    if (length == 0) { return 0; }
+
+    size_t   tail = buffer->length - length;
+    uint64_t offset;
+    if (reserve_range(sink, length, &offset) != 0) { return -1; }
+
+    if (buffer->ring == NULL) {
+        int rtn = write_at(sink, buffer->data, length, offset);
+        memmove(buffer->data, buffer->data + length, tail);
+        buffer->length = tail;
+        return rtn;
+    }
+
+    int slot = buffer->slot;
+    buffer->slot_offsets[slot] = offset;
+    buffer->slot_lengths[slot] = length;
+    if (uring_write(buffer->ring, sink->fd, buffer->data, length, offset, slot) != 0) {
+        fprintf(stderr, "ERROR: Failed to queue output: %s\n", strerror(errno));
+        return -1;
+    }
+    buffer->slot_busy[slot] = true;
+    buffer->in_flight++;
+
+    // Carry on with a free slot, or the first one to finish
+    int rtn  = 0;
+    int next = -1;
+    for (int slot_num = 0; slot_num < OUTPUT_RING_DEPTH && next < 0; slot_num++) {
+        if (!buffer->slot_busy[slot_num]) { next = slot_num; }
+    }
+    if (next < 0 && wait_slot(buffer, &next) != 0) { rtn = -1; }
+
+    // The kernel only reads the slot being written, so its tail can be copied out in the meantime
+    memcpy(buffer->slots[next], buffer->data + length, tail);
+    buffer->slot   = next;
+    buffer->data   = buffer->slots[next];
+    buffer->length = tail;
+    return rtn;
+}
+
+
+// Maps a page-aligned buffer, or returns NULL
+static char *map_buffer(size_t size) {
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (mapping == MAP_FAILED ? NULL : (char *)mapping);
+}
+
+
+// Unmaps every slot and the spare, or frees data if nothing was mapped
+static void free_buffers(OutputBuffer *buffer) {
+    if (buffer->spare) {
+        munmap(buffer->data,  buffer->capacity);
+        munmap(buffer->spare, buffer->capacity);
+    } else if (buffer->slots[0]) {
+        for (int slot_num = 0; slot_num < OUTPUT_RING_DEPTH; slot_num++) {
+            if (buffer->slots[slot_num]) { munmap(buffer->slots[slot_num], buffer->capacity); }
+        }
+    } else {
+        free(buffer->data);
+    }
+
+    if (buffer->ring) {
+        uring_free(buffer->ring);
+        free(buffer->ring);
+    }
+
+    free(buffer->packed);
+    compressor_free(&buffer->compressor);
+    memset(buffer, 0, sizeof(OutputBuffer));
+}
+
+
+// Allocates a buffer that fills and writes to a single sink
+static int init_buffer(OutputBuffer *buffer, OutputSink *sink) {
+    memset(buffer, 0, sizeof(OutputBuffer));
+    buffer->sink      = sink;
+    buffer->capacity  = sink->buffer_size;
+    buffer->format    = sink->format;
+    buffer->hex       = sink->hex;
+    buffer->utf16     = (sink->encoding == ENCODING_UTF16LE);
+    buffer->slot_size = (buffer->utf16 ? BLOCK_SIZE * 2 : BLOCK_SIZE);
+
+    // Compressed buffers are written with a plain write or pwrite of their own, compressing is the slow part
+    if (sink->compress != COMPRESSION_NONE) {
+        if (compressor_init(&buffer->compressor, sink->compress, sink->compress_level) != 0) { return -1; }
+
+        buffer->packed_capacity = compress_bound(&buffer->compressor, buffer->capacity);
+        buffer->packed          = (char *)malloc(buffer->packed_capacity);
+        buffer->data            = (char *)malloc(buffer->capacity);
+        if (buffer->packed == NULL || buffer->data == NULL) {
+            free_buffers(buffer);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (sink->positioned) {
+        // Without io_uring, or if we're not allowed it, a single slot is written with pwrite()
+        buffer->ring = (URing *)malloc(sizeof(URing));
+        if (buffer->ring && uring_init(buffer->ring, OUTPUT_RING_DEPTH) != 0) {
+            free(buffer->ring);
+            buffer->ring = NULL;
+        }
+
+        int slot_count = (buffer->ring ? OUTPUT_RING_DEPTH : 1);
+        for (int slot_num = 0; slot_num < slot_count; slot_num++) {
+            if ((buffer->slots[slot_num] = map_buffer(buffer->capacity)) == NULL) {
+                free_buffers(buffer);
+                return -1;
+            }
+        }
+        buffer->data = buffer->slots[0];
+        return 0;
+    }
+
+    if (!sink->splice) {
+        buffer->data = (char *)malloc(buffer->capacity);
+        return (buffer->data == NULL ? -1 : 0);
+    }
+
+    buffer->data  = map_buffer(buffer->capacity);
+    buffer->spare = map_buffer(buffer->capacity);
+    if (buffer->data == NULL || buffer->spare == NULL) {
+        if (buffer->data ) { munmap(buffer->data,  buffer->capacity); }
+        if (buffer->spare) { munmap(buffer->spare, buffer->capacity); }
+        buffer->data = buffer->spare = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+int output_buffer_init(OutputBuffer *buffer, OutputSink *sink) {
+    if (sink->partition_count == 0) { return init_buffer(buffer, sink); }
+
+    // Buffers for each length are only allocated once they're needed, most lengths never are
+    memset(buffer, 0, sizeof(OutputBuffer));
+    buffer->sink       = sink;
+    buffer->partitions = (OutputBuffer *)calloc(sink->partition_count, sizeof(OutputBuffer));
+    return (buffer->partitions == NULL ? -1 : 0);
+}
+
+
+int output_buffer_partition_init(OutputBuffer *buffer, int length) {
+    OutputSink *sink = buffer->sink + (size_t)length * buffer->sink->partition_stride;
+    if (open_partition(sink) != 0) { return -1; }
+
+    if (init_buffer(&buffer->partitions[length], sink) != 0) {
+        fprintf(stderr, "ERROR: Failed to allocate output buffer for length %d\n", length);
+        return -1;
+    }
+    return 0;
+}
+
+
+int output_buffer_flush(OutputBuffer *buffer) {
+    if (buffer->length == 0) { return 0; }
+
+    OutputSink *sink = buffer->sink;
+    if (sink->compress != COMPRESSION_NONE) {
+        ssize_t length = compress_block(&buffer->compressor, buffer->data, buffer->length, buffer->packed, buffer->packed_capacity);
+        buffer->length = 0;
+        return (length < 0 ? -1 : output_write(sink, buffer->packed, length));
+    }
+
+    if (sink->positioned) { return flush_positioned(buffer); }
+
+    if (sink->shared) { pthread_mutex_lock(&sink->lock); }
+
+    // A short buffer wouldn't push the spare out of the pipe, so it's copied and kept
+    bool splice = (buffer->spare && sink->splice && buffer->length >= sink->pipe_size);
+    int  rtn    = write_all(sink, buffer->data, buffer->length, splice);
+
+    if (sink->shared) { pthread_mutex_unlock(&sink->lock); }
+
+    if (splice) {
+        char *spliced = buffer->data;
+        buffer->data  = buffer->spare;
+        buffer->spare = spliced;
+    }
+    buffer->length = 0;
+    return rtn;
+}
+
+
+int output_buffer_free(OutputBuffer *buffer) {
+    if (buffer == NULL) { return 0; }
+
+    if (buffer->partitions) {
+        int rtn = 0;
+        for (int length = 0; length < buffer->sink->partition_count; length++) {
+            if (output_buffer_free(&buffer->partitions[length]) != 0) { rtn = -1; }
+        }
+        free(buffer->partitions);
+        memset(buffer, 0, sizeof(OutputBuffer));
+        return rtn;
+    }
+    if (buffer->data == NULL) { return 0; }
+
+    OutputSink *sink = buffer->sink;
+    int rtn = output_buffer_flush(buffer);
+    if (buffer->ring && drain_slots(buffer) != 0) { rtn = -1; }
+
+    // The last partial block can't be written directly, and nothing else writes to a direct sink
+    if (sink->direct && buffer->length > 0) {
+        uint64_t offset;
+        sink->direct = false;
+        if (fcntl(sink->fd, F_SETFL, fcntl(sink->fd, F_GETFL) & ~O_DIRECT) != 0
+        ||  reserve_range(sink, buffer->length, &offset) != 0
+        ||  write_at(sink, buffer->data, buffer->length, offset) != 0) {
+            rtn = -1;
+        }
+    }
+
+    // The pipe keeps its own reference to spliced pages, unmapping them doesn't pull them out from under it
+    free_buffers(buffer);
+    return rtn;
+}
+
+
+int output_buffer_record_hex(OutputBuffer *buffer, const char *word, int length) {
+    char encoded[HEX_PREFIX_LEN + BLOCK_SIZE * 2 + 2];
+    int  encoded_len = hex_encode(encoded, word, length);
+
+    return output_buffer_frame(buffer, encoded, encoded_len);
+}
@@ -0,0 +1,292 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "uring.h"
+#include "shmring.h"
+#include "compress.h"
+#include "rules.h"
+#include "hex.h"
+#include "utf16.h"
+
+// Each worker buffers this many bytes of output before handing it to its sink
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+// Output partitioned by length has a buffer for every length a worker produces, so they're smaller
+#define OUTPUT_PARTITION_BUFFER_SIZE (256 * 1024)
+
+// Pipes are resized to this, buffers at least this full are spliced into them rather than written
+#define OUTPUT_PIPE_SIZE (OUTPUT_BUFFER_SIZE / 4)
+
+// Writes to a regular file each worker can have in flight through io_uring, each from its own buffer
+#define OUTPUT_RING_DEPTH 4
+
+// Files we open are allocated this much at a time ahead of the writes, and trimmed to what was written at the end
+#define OUTPUT_PREALLOCATE (64 * 1024 * 1024)
+
+// O_DIRECT writes are made in whole blocks of this size, from buffers aligned to it
+#define OUTPUT_DIRECT_ALIGN 4096
+
+
+// How candidates are framed in the output
+typedef enum OutputFormat {
+    // Each candidate followed by a newline
+    FORMAT_LINES,
+
+    // Each candidate followed by a NUL byte
+    FORMAT_NUL,
+
+    // A byte holding the candidate's length, then the candidate
+    FORMAT_LENGTH,
+
+    // Each candidate NUL padded to a BLOCK_SIZE slot, with its length in the slot's last byte
+    FORMAT_SLOTS,
+} OutputFormat;
+
+
+// How candidates are encoded before they're framed
+typedef enum OutputEncoding {
+    // The bytes the rules produced, UTF-8 or whatever the wordlist was in
+    ENCODING_BYTES,
+
+    // UTF-16LE, every character at least two bytes and the framing widened to match
+    ENCODING_UTF16LE,
+} OutputEncoding;
+
+
+// Where a run's output goes, stdout if none of pattern, fd_list or shm_name are given
+typedef struct OutputConfig {
+    // File name, "%d" is replaced by the worker number (one file per worker)
+    // and "%l" by the candidate length (one file per length, every candidate going to the one for its length)
+    const char *pattern;
+
+    // Comma separated list of open fds, workers are assigned round-robin
+    const char *fd_list;
+
+    // Name of a shared memory ring for a consumer on the same host, and its size
+    // As with pattern, "%l" gives every candidate length a ring of its own
+    const char *shm_name;
+    size_t      shm_mb;
+
+    // Files opened from pattern that only one worker writes to bypass the page cache
+    bool        direct;
+
+    // Compress every buffer on its worker before writing it
+    Compression compress;
+    int         compress_level;
+
+    OutputFormat format;
+
+    // Candidates that wouldn't survive as a line are written as $HEX[...], only with lines or NUL terminated output
+    bool         hex;
+
+    OutputEncoding encoding;
+
+    // Every sink writes to /dev/null instead, as many of them as pattern, fd_list or shm_name would give, to benchmark these settings
+    bool           discard;
+} OutputConfig;
+
+
+// A destination for mangled words: stdout, a file, a FIFO, an inherited fd, or a shared memory ring
+typedef struct OutputSink {
+    int  fd;
+
+    // Output goes into this ring instead of fd
+    ShmRing *shm;
+
+    // We opened fd ourselves and should close it when finished
+    bool owned;
+
+    // More than one worker writes here, so whole buffers are written under lock
+    // This keeps lines from different workers from being interleaved
+    bool shared;
+    pthread_mutex_t lock;
+
+    // fd is a pipe holding at most pipe_size bytes, full buffers are handed to it with vmsplice() instead of copied
+    bool   splice;
+    size_t pipe_size;
+
+    // fd is a regular file, every buffer is written at its own offset reserved from offset, so no lock is needed
+    bool     positioned;
+    uint64_t offset;
+
+    // The file has space allocated up to here, extended under lock as reservations pass it
+    bool     preallocate;
+    uint64_t allocated;
+
+    // fd was opened with O_DIRECT, only whole blocks are written until the last buffer
+    bool     direct;
+
+    // Each buffer is written as a gzip member or zstd frame of its own, compressed by the worker that filled it
+    Compression compress;
+    int         compress_level;
+
+    OutputFormat   format;
+    bool           hex;
+    OutputEncoding encoding;
+
+    // Size of each buffer a worker fills for this sink
+    size_t         buffer_size;
+
+    // With output partitioned by length, the sink for length n is partition_stride sinks after the one for length 0
+    int            partition_count;
+    int            partition_stride;
+
+    // A partition's file or ring is only opened once its first candidate turns up, from name and shm_size
+    // Those that never get one are ended at close, a reader waiting on a FIFO or ring still sees the end of output
+    char          *name;
+    size_t         shm_size;
+    bool           open_direct;
+    bool           opened;
+} OutputSink;
+
+
+// All sinks for a run and the sink assigned to each worker
+// With output partitioned by length, worker_sinks hold each worker's sink for length 0
+typedef struct OutputSet {
+    OutputSink  *sinks;
+    int          sink_count;
+
+    OutputSink **worker_sinks;
+    int          worker_count;
+} OutputSet;
+
+
+// A worker's private output buffer
+typedef struct OutputBuffer {
+    OutputSink  *sink;
+    char        *data;
+    size_t       length, capacity;
+    OutputFormat format;
+    bool         hex;
+
+    // With UTF-16LE, newlines and NULs are two bytes and slots are twice the size
+    bool         utf16;
+    size_t       slot_size;
+
+    // With a splice sink, data and spare are page-aligned mappings that are swapped after every splice
+    // The pipe may still be reading spare, but never once a pipe's worth has been sent after it
+    char       *spare;
+
+    // With a positioned sink, data is one of the slots and the rest may be in flight through ring
+    // Without a ring, there's only the first slot and it's written with pwrite()
+    URing      *ring;
+    char       *slots[OUTPUT_RING_DEPTH];
+    uint64_t    slot_offsets[OUTPUT_RING_DEPTH];
+    size_t      slot_lengths[OUTPUT_RING_DEPTH];
+    bool        slot_busy[OUTPUT_RING_DEPTH];
+    int         slot, in_flight;
+
+    // With a compressing sink, data is compressed into packed and that's what gets written
+    Compressor  compressor;
+    char       *packed;
+    size_t      packed_capacity;
+
+    // With output partitioned by length, a buffer for every length, each set up when its first candidate turns up
+    // This buffer holds nothing itself
+    struct OutputBuffer *partitions;
+} OutputBuffer;
+
+
+// Creates the sinks for worker_count workers as config describes
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int output_open(OutputSet *set, const OutputConfig *config, int worker_count);
+
+// Closes any sinks we opened and frees the set
+// Returns 0 on success, -1 if a close failed
+int output_close(OutputSet *set);
+
+// Writes all of data to a sink, retrying short writes
+// Returns 0 on success, -1 on failure
+int output_write(OutputSink *sink, const char *data, size_t length);
+
+// Allocates a worker's output buffer
+// Call from the worker thread so the memory lands on the worker's NUMA node
+int output_buffer_init(OutputBuffer *buffer, OutputSink *sink);
+
+// Allocates a partitioned buffer's buffer for candidates of length
+int output_buffer_partition_init(OutputBuffer *buffer, int length);
+
+// Writes out and empties a buffer, a direct sink keeps whatever doesn't fill a whole block
+// Writes to a file may still be in flight afterwards
+int output_buffer_flush(OutputBuffer *buffer);
+
+// Flushes and frees a buffer, waiting for everything it sent to be written
+int output_buffer_free(OutputBuffer *buffer);
+
+
+// Appends data to an output buffer, flushing it first if required
+static inline int output_buffer_append(OutputBuffer *buffer, const char *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        if (output_buffer_flush(buffer) != 0) { return -1; }
+
+        // Too large to ever be buffered, send it straight through
+        if (buffer->length + length > buffer->capacity) { return output_write(buffer->sink, data, length); }
+    }
+
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+
+// Appends a candidate that needs encoding as $HEX[...], framed the way the sink's format says
+int output_buffer_record_hex(OutputBuffer *buffer, const char *word, int length);
+
+
+// Appends an encoded candidate to an output buffer, framed the way the sink's format says
+// word must have room for the terminator after it, one byte or two with UTF-16LE, so it's copied along with the word
+static inline int output_buffer_frame(OutputBuffer *buffer, char *word, int length) {
+    switch (buffer->format) {
+        case FORMAT_LINES:
+        case FORMAT_NUL:
+            word[length] = (buffer->format == FORMAT_LINES ? '\n' : 0);
+            if (!buffer->utf16) { return output_buffer_append(buffer, word, length + 1); }
+            word[length + 1] = 0;
+            return output_buffer_append(buffer, word, length + 2);
+
+        // Buffers are a whole number of slots, so a record never straddles two of them
+        case FORMAT_LENGTH:
+        case FORMAT_SLOTS: {
+            size_t size = (buffer->format == FORMAT_LENGTH ? (size_t)length + 1 : buffer->slot_size);
+            if (buffer->length + size > buffer->capacity && output_buffer_flush(buffer) != 0) { return -1; }
+
+            char *record = buffer->data + buffer->length;
+            if (buffer->format == FORMAT_LENGTH) {
+                record[0] = (char)length;
+                memcpy(record + 1, word, length);
+            } else {
+                memcpy(record, word, length);
+                memset(record + length, 0, size - 1 - length);
+                record[size - 1] = (char)length;
+            }
+            buffer->length += size;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+// Appends a candidate to an output buffer, or the buffer for its length, encoded and framed the way the sink says
+// word must have room for one more byte after it
+static inline int output_buffer_record(OutputBuffer *buffer, char *word, int length) {
+    if (buffer->partitions) {
+        if (buffer->partitions[length].data == NULL && output_buffer_partition_init(buffer, length) != 0) { return -1; }
+        buffer = &buffer->partitions[length];
+    }
+
+    if (buffer->hex && hex_needed(word, length)) { return output_buffer_record_hex(buffer, word, length); }
+
+    if (buffer->utf16) {
+        char wide[BLOCK_SIZE * 2 + 2];
+        return output_buffer_frame(buffer, wide, utf16_widen(wide, word, length));
+    }
+    return output_buffer_frame(buffer, word, length);
+}
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rulecache.h"
+#include "dedupe.h"
+
+// Sections of the file start on a cache line, like the in-memory tables
+#define RULECACHE_ALIGN 64
+
+// PNG-style, so a compiled file can't be mistaken for text and text can't be mistaken for one
+static const char rulecache_magic[8] = { '\x89', 'H', 'C', 'R', 'B', '\r', '\n', '\x1a' };
+
+// Written as a number, so a file from a machine with the other byte order is rejected
+#define RULECACHE_BYTE_ORDER 0x01020304u
+
+
+// Everything after the header is found through its offsets, so the file can be mapped anywhere
+typedef struct CacheHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t block_size;
+    uint32_t file_count;
+
+    uint64_t input_hash;
+    uint64_t file_size;
+    uint64_t rule_count;
+
+    // Parsed rule text and the count + 1 offsets into it, exactly as in RuleSet
+    uint64_t text_offset, text_size;
+    uint64_t offsets_offset;
+
+    // count RuleSource entries
+    uint64_t sources_offset;
+
+    // file_count NULL terminated file names, back to back
+    uint64_t names_offset, names_size;
+
+    uint32_t error_count;
+    uint32_t dupe_count;
+} CacheHeader;
+
+
+static inline uint64_t align_up(uint64_t value) {
+    return (value + RULECACHE_ALIGN - 1) & ~(uint64_t)(RULECACHE_ALIGN - 1);
+}
+
+
+// Folds another value into a running hash
+static inline uint64_t hash_combine(uint64_t hash, uint64_t value) {
+    uint64_t pair[2] = { hash, value };
+    return dedupe_hash((const char *)pair, sizeof(pair));
+}
+
+
+bool rulecache_detect(const char *file_name) {
+    // Compiled rules are mapped, so only a regular file can be one, and a FIFO mustn't lose what's read from it here
+    struct stat file_stat;
+    if (stat(file_name, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) { return false; }
+
+    FILE *cache_file = fopen(file_name, "rb");
+    if (cache_file == NULL) { return false; }
+
+    char magic[sizeof(rulecache_magic)];
+    bool found = (fread(magic, 1, sizeof(magic), cache_file) == sizeof(magic)
+               && memcmp(magic, rulecache_magic, sizeof(magic)) == 0);
+
+    fclose(cache_file);
+    return found;
+}
+
+
+int rulecache_input_hash(char **file_names, int file_count, uint64_t *hash) {
+    uint64_t total = hash_combine(RULECACHE_VERSION, BLOCK_SIZE);
+
+    for (int file_num = 0; file_num < file_count; file_num++) {
+        int fd = open(file_names[file_num], O_RDONLY);
+        struct stat file_stat;
+        if (fd < 0 || fstat(fd, &file_stat) != 0) {
+            fprintf(stderr, "ERROR: Failed to open input file <%s>\n", file_names[file_num]);
+            if (fd >= 0) { close(fd); }
+            return -1;
+        }
+
+        if (!S_ISREG(file_stat.st_mode)) {
+            fprintf(stderr, "ERROR: Rule file <%s> is not a regular file and can't be cached\n", file_names[file_num]);
+            close(fd);
+            return -1;
+        }
+
+        // The name is part of the hash because it's part of every error message
+        total = hash_combine(total, dedupe_hash(file_names[file_num], strlen(file_names[file_num])));
+        total = hash_combine(total, file_stat.st_size);
+
+        if (file_stat.st_size > 0) {
+            char *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                fprintf(stderr, "ERROR: Failed to read input file <%s>\n", file_names[file_num]);
+                close(fd);
+                return -1;
+            }
+
+            madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+            total = hash_combine(total, dedupe_hash(data, file_stat.st_size));
+            munmap(data, file_stat.st_size);
+        }
+
+        close(fd);
+    }
+
+    *hash = total;
+    return 0;
+}
+
+
+// Pads the file out to the next section boundary after a section of size bytes
+static int write_padding(FILE *cache_file, size_t size) {
+    static const char padding[RULECACHE_ALIGN] = { 0 };
+
+    size_t pad = align_up(size) - size;
+    if (pad > 0 && fwrite(padding, 1, pad, cache_file) != pad) { return -1; }
+    return 0;
+}
+
+
+static int write_section(FILE *cache_file, const void *data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, cache_file) != size) { return -1; }
+    return write_padding(cache_file, size);
+}
+
+
+int rulecache_write(const RuleSet *set, const char *file_name, uint64_t input_hash) {
+    CacheHeader header;
+    memset(&header, 0, sizeof(CacheHeader));
+    memcpy(header.magic, rulecache_magic, sizeof(header.magic));
+    header.version     = RULECACHE_VERSION;
+    header.byte_order  = RULECACHE_BYTE_ORDER;
+    header.block_size  = BLOCK_SIZE;
+    header.file_count  = set->file_count;
+    header.input_hash  = input_hash;
+    header.rule_count  = set->count;
+    header.error_count = set->error_count;
+    header.dupe_count  = set->dupe_count;
+
+    for (int file_num = 0; file_num < set->file_count; file_num++) {
+        header.names_size += strlen(set->file_names[file_num]) + 1;
+    }
+
+    header.text_size      = set->offsets[set->count];
+    header.text_offset    = align_up(sizeof(CacheHeader));
+    header.offsets_offset = header.text_offset    + align_up(header.text_size);
+    header.sources_offset = header.offsets_offset + align_up((set->count + 1) * sizeof(uint64_t));
+    header.names_offset   = header.sources_offset + align_up(set->count * sizeof(RuleSource));
+    header.file_size      = header.names_offset   + align_up(header.names_size);
+
+    // Written under a temporary name so a reader never maps a half-written file
+    char *temp_name = NULL;
+    if (asprintf(&temp_name, "%s.%d.tmp", file_name, (int)getpid()) < 0) {
+        fprintf(stderr, "ERROR: Failed to allocate compiled rules file name\n");
+        return -1;
+    }
+
+    FILE *cache_file = fopen(temp_name, "wb");
+    if (cache_file == NULL) {
+        fprintf(stderr, "ERROR: Failed to open compiled rules file <%s>\n", temp_name);
+        free(temp_name);
+        return -1;
+    }
+
+    int rtn = 0;
+    if (write_section(cache_file, &header,      sizeof(CacheHeader))                       != 0
+    ||  write_section(cache_file, set->text,    header.text_size)                          != 0
+    ||  write_section(cache_file, set->offsets, (set->count + 1) * sizeof(uint64_t))       != 0
+    ||  write_section(cache_file, set->sources, set->count * sizeof(RuleSource))           != 0) {
+        rtn = -1;
+    }
+
+    for (int file_num = 0; rtn == 0 && file_num < set->file_count; file_num++) {
+        const char *name = set->file_names[file_num];
+        if (fwrite(name, 1, strlen(name) + 1, cache_file) != strlen(name) + 1) { rtn = -1; }
+    }
+    if (rtn == 0 && write_padding(cache_file, header.names_size) != 0) { rtn = -1; }
+
+    if (fclose(cache_file) != 0) { rtn = -1; }
+    if (rtn == 0 && rename(temp_name, file_name) != 0) { rtn = -1; }
+
+    if (rtn != 0) {
+        fprintf(stderr, "ERROR: Failed to write compiled rules file <%s>\n", file_name);
+        unlink(temp_name);
+    }
+
+    free(temp_name);
+    return rtn;
+}
+
+
+// Checks that every rule lies within the text and ends in its terminator, and comes from one of the files
+// The engine trusts both, the header checks only make sure the arrays are there to look at
+static bool check_rules(const RuleSet *set, const CacheHeader *header) {
+    if (set->offsets[0] != 0 || set->offsets[set->count] != header->text_size) { return false; }
+
+    // Parsed rules can be longer than BLOCK_SIZE, so there's no tighter bound on a rule's length than the text
+    for (size_t rule_num = 0; rule_num < set->count; rule_num++) {
+        uint64_t start = set->offsets[rule_num], end = set->offsets[rule_num + 1];
+        if (end <= start || end > header->text_size || set->text[end - 1] != 0) { return false; }
+        if (set->sources[rule_num].file >= header->file_count) { return false; }
+    }
+    return true;
+}
+
+
+int rulecache_open(RuleSet *set, const char *file_name, const uint64_t *input_hash) {
+    memset(set, 0, sizeof(RuleSet));
+    arena_init(&set->storage, 0);
+
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        // A missing cache is only an error if we were told to use it
+        if (input_hash != NULL) { return 1; }
+        fprintf(stderr, "ERROR: Failed to open compiled rules file <%s>\n", file_name);
+        return -1;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        if (input_hash != NULL && file_stat.st_size == 0) { return 1; }
+        fprintf(stderr, "ERROR: Compiled rules file <%s> is truncated\n", file_name);
+        return -1;
+    }
+
+    char *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Failed to map compiled rules file <%s>\n", file_name);
+        return -1;
+    }
+
+    set->mapping      = data;
+    set->mapping_size = file_stat.st_size;
+
+
+    // Check everything the header claims before pointing anything at it
+    const CacheHeader *header = (const CacheHeader *)data;
+    const char        *problem = NULL;
+    if (memcmp(header->magic, rulecache_magic, sizeof(header->magic)) != 0) {
+        problem = "is not a compiled rules file";
+    } else if (header->version != RULECACHE_VERSION || header->byte_order != RULECACHE_BYTE_ORDER) {
+        problem = "was written by a different version of hcre";
+    } else if (header->block_size != BLOCK_SIZE) {
+        problem = "was written for a different BLOCK_SIZE";
+    } else if (header->file_size != (uint64_t)file_stat.st_size
+           ||  header->rule_count >= (uint64_t)file_stat.st_size
+           ||  header->text_offset    + header->text_size                              > header->file_size
+           ||  header->offsets_offset + (header->rule_count + 1) * sizeof(uint64_t)   > header->file_size
+           ||  header->sources_offset + header->rule_count * sizeof(RuleSource)       > header->file_size
+           ||  header->names_offset   + header->names_size                            > header->file_size
+           ||  header->text_offset % RULECACHE_ALIGN || header->offsets_offset % RULECACHE_ALIGN
+           ||  header->sources_offset % RULECACHE_ALIGN) {
+        problem = "is corrupt";
+    }
+
+    if (problem == NULL) {
+        set->text    = data + header->text_offset;
+        set->offsets = (uint64_t   *)(data + header->offsets_offset);
+        set->sources = (RuleSource *)(data + header->sources_offset);
+        set->count   = header->rule_count;
+
+        if (!check_rules(set, header)) { problem = "is corrupt"; }
+    }
+
+    // Anything other than a bad magic number is just a cache that needs rebuilding
+    // A file that was never a cache is an error either way, so it doesn't get overwritten
+    bool is_cache = (memcmp(header->magic, rulecache_magic, sizeof(header->magic)) == 0);
+
+    if (problem != NULL) {
+        ruleset_free(set);
+        if (input_hash != NULL && is_cache) { return 1; }
+        fprintf(stderr, "ERROR: Rules file <%s> %s\n", file_name, problem);
+        return -1;
+    }
+
+    if (input_hash != NULL && header->input_hash != *input_hash) {
+        ruleset_free(set);
+        return 1;
+    }
+
+
+    // File names are the only thing that needs unpacking
+    set->file_names  = (const char **)calloc(header->file_count + 1, sizeof(char *));
+    set->file_count  = header->file_count;
+    set->error_count = header->error_count;
+    set->dupe_count  = header->dupe_count;
+    if (set->file_names == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate rule files\n");
+        ruleset_free(set);
+        return -1;
+    }
+
+    const char *name     = data + header->names_offset;
+    const char *name_end = name + header->names_size;
+    for (uint32_t file_num = 0; file_num < header->file_count; file_num++) {
+        const char *terminator = (name < name_end ? memchr(name, 0, name_end - name) : NULL);
+        if (terminator == NULL) {
+            ruleset_free(set);
+            if (input_hash != NULL) { return 1; }
+            fprintf(stderr, "ERROR: Rules file <%s> is corrupt\n", file_name);
+            return -1;
+        }
+
+        set->file_names[file_num] = name;
+        name = terminator + 1;
+    }
+
+    return 0;
+}
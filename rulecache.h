@@ -0,0 +1,29 @@
+#ifndef RULECACHE_H
+#define RULECACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ruleset.h"
+
+// Bumped whenever the layout or the meaning of a parsed rule changes
+#define RULECACHE_VERSION 1
+
+
+// Returns true if file_name is a regular file that starts with a compiled rule set header
+bool rulecache_detect(const char *file_name);
+
+// Hashes the names and contents of a list of rule files, in order
+// Only regular files can be hashed, anything else would be consumed by reading it
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int rulecache_input_hash(char **file_names, int file_count, uint64_t *hash);
+
+// Writes a loaded rule set to file_name, tagged with the hash of the files it came from
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int rulecache_write(const RuleSet *set, const char *file_name, uint64_t input_hash);
+
+// Maps a compiled rule set, pointing set directly into the mapping
+// If input_hash is not NULL, the cache must have been compiled from input files with that hash
+// Returns 0 on success, 1 if the cache is stale or missing, -1 on failure (an error has already been printed)
+int rulecache_open(RuleSet *set, const char *file_name, const uint64_t *input_hash);
+
+#endif /* RULECACHE_H */
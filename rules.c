@@ -4,6 +4,7 @@
 // License: MIT
 // =============================================================================
 
+#include <stdlib.h>
 #include "rules.h"
 
 // Increment rule position, return syntax error on premature end
@@ -782,7 +783,7 @@ int parse_rule(char *rule, int rule_len, Rule **output_rule) {
 
 
 
-int apply_rule(Rule *input_rule, char *input_word, int input_len, char out[BLOCK_SIZE])
+int apply_rule(Rule *input_rule, const char *input_word, int input_len, char out[BLOCK_SIZE])
 {
     if (input_rule       == NULL) { return(INVALID_INPUT); }
     if (input_rule->text == NULL) { return(INVALID_INPUT); }
@@ -16,7 +16,6 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <limits.h>
-#include "uthash.h"
 
 // Input is truncated to BLOCK_SIZE - 1 bytes
 // Rules which push the output over BLOCK_SIZE - 1 are skipped
@@ -44,7 +43,7 @@ int parse_rule(char *rule_text, int rule_text_length, Rule **output_rule);
 // Applies a rule to an input word and saves the output to output_word
 // If a rule operation would cause the length to extend beyond BLOCK_SIZE, the operation is skipped
 // Do not pass a hand-crafted rule struct into this function, run it through parse_rule() first
-int apply_rule(Rule *rule_to_apply, char *input_word, int input_len, char output_word[BLOCK_SIZE]);
+int apply_rule(Rule *rule_to_apply, const char *input_word, int input_len, char output_word[BLOCK_SIZE]);
 
 
 
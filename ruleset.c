@@ -0,0 +1,760 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ruleset.h"
+#include "dedupe.h"
+
+// Rule files are split into chunks of roughly this many bytes, one chunk per parse job
+#define LOAD_CHUNK_SIZE (1024 * 1024)
+
+// ChunkEntry.original for a rule that doesn't appear in any earlier chunk
+#define NO_ORIGINAL DEDUPE_NONE
+
+
+// A rule file's contents, either memory-mapped or read into a buffer
+// Files stay open until loading finishes so source text never has to be copied
+typedef struct RuleFile {
+    char  *name;
+    char  *data;
+    size_t size;
+    bool   mapped;
+} RuleFile;
+
+
+// One non-blank, non-comment line of a rule file
+typedef struct LoadedLine {
+    // Where the line starts, from the start of its chunk
+    uint32_t offset;
+
+    // Line number, counted from the start of the chunk
+    uint32_t line;
+
+    // The chunk entry for this rule's first occurrence in the chunk
+    uint32_t entry;
+} LoadedLine;
+
+
+// The first occurrence of a rule within its chunk
+typedef struct ChunkEntry {
+    // Dedupe hash, the high bits also select the merge partition responsible for this rule
+    uint64_t key;
+
+    // The parsed rule in the chunk's text, or the parse error for a broken rule
+    uint32_t text;
+
+    // The chunk line this entry came from
+    uint32_t line;
+
+    // Set during the merge to the id of the same rule's entry in an earlier chunk
+    uint32_t original;
+
+    // Broken rules are reported but never deduplicated
+    bool     broken;
+} ChunkEntry;
+
+
+// A piece of a rule file that starts and ends on a line boundary
+typedef struct LoadChunk {
+    RuleFile   *file;
+    const char *start, *end;
+
+    // Lines numbers are counted from the start of the chunk until every chunk is parsed
+    // first_line is then the number of lines in the same file before this chunk
+    unsigned int line_count;
+    unsigned int first_line;
+
+    LoadedLine *lines;
+    size_t      count, capacity;
+
+    // Entries are numbered across all chunks, this chunk's start at first_entry
+    ChunkEntry *entries;
+    size_t      entry_count, entry_capacity;
+    uint32_t    first_entry;
+
+    // Every entry's parsed text, back to back and NULL terminated
+    char       *text;
+    size_t      text_size, text_capacity;
+} LoadChunk;
+
+
+typedef struct Loader {
+    LoadChunk *chunks;
+    size_t     chunk_count;
+
+    // Next chunk to be parsed, claimed atomically by the parse threads
+    size_t     next_chunk;
+
+    int        partition_count;
+    int        failed;
+} Loader;
+
+
+typedef struct LoadThread {
+    Loader   *loader;
+    pthread_t thread;
+    int       partition;
+} LoadThread;
+
+
+// What dedupe_find() is looking for and where to find the entries it suggests
+typedef struct EntryMatch {
+    const Loader    *loader;
+    const LoadChunk *chunk;
+    const char      *text;
+    size_t           length;
+} EntryMatch;
+
+
+// Maps a regular file, or reads anything else (pipes, process substitution) into memory
+static int open_rule_file(RuleFile *file, char *file_name) {
+    memset(file, 0, sizeof(RuleFile));
+    file->name = file_name;
+
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) { return -1; }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) { close(fd); return -1; }
+
+    if (S_ISREG(file_stat.st_mode)) {
+        file->size = file_stat.st_size;
+        if (file->size > 0) {
+            file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (file->data == MAP_FAILED) { file->data = NULL; close(fd); return -1; }
+
+            file->mapped = true;
+            madvise(file->data, file->size, MADV_WILLNEED);
+        }
+
+        close(fd);
+        return 0;
+    }
+
+    size_t capacity = 0;
+    while (true) {
+        if (file->size == capacity) {
+            capacity = (capacity ? capacity * 2 : LOAD_CHUNK_SIZE);
+            char *data = (char *)realloc(file->data, capacity);
+            if (data == NULL) { close(fd); return -1; }
+            file->data = data;
+        }
+
+        ssize_t bytes = read(fd, file->data + file->size, capacity - file->size);
+        if (bytes < 0 && errno == EINTR) { continue; }
+        if (bytes < 0) { close(fd); return -1; }
+        if (bytes == 0) { break; }
+        file->size += bytes;
+    }
+
+    close(fd);
+    return 0;
+}
+
+
+static void close_rule_file(RuleFile *file) {
+    if (file->data == NULL) { return; }
+
+    if (file->mapped) {
+        munmap(file->data, file->size);
+    } else {
+        free(file->data);
+    }
+    file->data = NULL;
+}
+
+
+// Grows an array so it can hold at least one more item
+static int grow_array(void **array, size_t *capacity, size_t count, size_t item_size, size_t initial) {
+    if (count < *capacity) { return 0; }
+
+    size_t new_capacity = (*capacity ? *capacity * 2 : initial);
+    void  *grown        = realloc(*array, new_capacity * item_size);
+    if (grown == NULL) { return -1; }
+
+    *array    = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+
+// Length of an entry's parsed text, not counting the NULL terminator
+static inline size_t entry_length(const LoadChunk *chunk, size_t entry_num) {
+    size_t end = (entry_num + 1 < chunk->entry_count ? chunk->entries[entry_num + 1].text : chunk->text_size);
+    return end - chunk->entries[entry_num].text - 1;
+}
+
+
+// Returns a line's text straight from the file, trimmed exactly as parse_chunk() trims it
+static const char *line_text(const LoadChunk *chunk, const LoadedLine *loaded, int *length) {
+    const char *start   = chunk->start + loaded->offset;
+    const char *newline = memchr(start, '\n', chunk->end - start);
+    size_t      len     = (newline ? newline : chunk->end) - start;
+
+    while (len > 0 && (start[len - 1] == '\n' || start[len - 1] == '\r')) { len--; }
+
+    // Text used to be copied with strdup(), so an embedded NULL still ends it
+    *length = (int)strnlen(start, len);
+    return start;
+}
+
+
+// Finds the chunk holding entry id, chunks without entries are never returned
+static const LoadChunk *entry_chunk(const Loader *loader, uint32_t id) {
+    size_t low = 0, high = loader->chunk_count;
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (loader->chunks[mid].first_entry <= id) { low = mid; } else { high = mid; }
+    }
+    return &loader->chunks[low];
+}
+
+
+static bool chunk_match(void *context, uint32_t id) {
+    EntryMatch *match = (EntryMatch *)context;
+    return entry_length(match->chunk, id) == match->length
+        && memcmp(match->chunk->text + match->chunk->entries[id].text, match->text, match->length) == 0;
+}
+
+
+static bool merge_match(void *context, uint32_t id) {
+    EntryMatch      *match = (EntryMatch *)context;
+    const LoadChunk *chunk = entry_chunk(match->loader, id);
+    uint32_t         entry = id - chunk->first_entry;
+
+    return entry_length(chunk, entry) == match->length
+        && memcmp(chunk->text + chunk->entries[entry].text, match->text, match->length) == 0;
+}
+
+
+// Adds an entry for the rule on the chunk's most recent line
+static int add_entry(LoadChunk *chunk, const Rule *rule, uint64_t key, bool broken) {
+    if (grow_array((void **)&chunk->entries, &chunk->entry_capacity, chunk->entry_count, sizeof(ChunkEntry), 1024) != 0) {
+        return -1;
+    }
+
+    while (chunk->text_size + rule->length + 1 > chunk->text_capacity) {
+        size_t capacity = (chunk->text_capacity ? chunk->text_capacity * 2 : 64 * 1024);
+        char  *text     = (char *)realloc(chunk->text, capacity);
+        if (text == NULL) { return -1; }
+
+        chunk->text          = text;
+        chunk->text_capacity = capacity;
+    }
+
+    ChunkEntry *entry = &chunk->entries[chunk->entry_count++];
+    entry->key      = key;
+    entry->text     = chunk->text_size;
+    entry->line     = chunk->count;
+    entry->original = NO_ORIGINAL;
+    entry->broken   = broken;
+
+    memcpy(chunk->text + chunk->text_size, rule->text, rule->length);
+    chunk->text[chunk->text_size + rule->length] = 0;
+    chunk->text_size += rule->length + 1;
+    return 0;
+}
+
+
+static void shrink_chunk(LoadChunk *chunk) {
+    LoadedLine *lines   = (LoadedLine *)realloc(chunk->lines,   (chunk->count       + 1) * sizeof(LoadedLine));
+    ChunkEntry *entries = (ChunkEntry *)realloc(chunk->entries, (chunk->entry_count + 1) * sizeof(ChunkEntry));
+    char       *text    = (char       *)realloc(chunk->text,     chunk->text_size   + 1);
+
+    if (lines  ) { chunk->lines   = lines;   chunk->capacity       = chunk->count       + 1; }
+    if (entries) { chunk->entries = entries; chunk->entry_capacity = chunk->entry_count + 1; }
+    if (text   ) { chunk->text    = text;    chunk->text_capacity  = chunk->text_size   + 1; }
+}
+
+
+// Parses every rule in a chunk, exactly as the serial getline() loop used to
+static int parse_chunk(LoadChunk *chunk) {
+    // Lines are copied here so they can be NULL terminated
+    char  *line      = NULL;
+    size_t line_size = 0;
+
+    // Output for prase_rule()
+    Rule *cur_rule = NULL;
+
+    // First occurrence of each rule in this chunk, sized for every line being a different rule
+    size_t line_limit = 1;
+    for (const char *pos = chunk->start; (pos = memchr(pos, '\n', chunk->end - pos)) != NULL; pos++) { line_limit++; }
+
+    DedupeTable rules;
+    if (dedupe_init(&rules, line_limit) != 0) { return -1; }
+
+    int rtn = 0;
+    const char *pos = chunk->start;
+    while (pos < chunk->end) {
+        const char *newline  = memchr(pos, '\n', chunk->end - pos);
+        const char *line_end = (newline ? newline : chunk->end);
+        size_t      line_len = line_end - pos;
+
+        if (line_len + 1 > line_size) {
+            line_size = line_len + 1;
+            char *grown = (char *)realloc(line, line_size);
+            if (grown == NULL) { rtn = -1; break; }
+            line = grown;
+        }
+        memcpy(line, pos, line_len);
+        line[line_len] = 0;
+
+        LoadedLine loaded;
+        loaded.offset = pos - chunk->start;
+
+        pos = (newline ? newline + 1 : chunk->end);
+        chunk->line_count++;
+
+        // Trim trailing newline by overwriting it will a NULL terminator
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+            line[--line_len] = 0;
+        }
+
+        // Skip empty lines and commented lines
+        if (line_len ==  0 ) { continue; }
+        if (line[0]  == '#') { continue; }
+
+
+        // Prase and validate the rule into cur_rule
+        bool     broken = (parse_rule(line, line_len, &cur_rule) < 0);
+        uint64_t key    = 0;
+        loaded.line  = chunk->line_count;
+        loaded.entry = DEDUPE_NONE;
+
+        // Duplicates within the chunk only cost a line record
+        if (!broken) {
+            key = dedupe_hash(cur_rule->text, cur_rule->length);
+
+            EntryMatch match = { NULL, chunk, cur_rule->text, cur_rule->length };
+            loaded.entry = dedupe_find(&rules, key, chunk_match, &match);
+        }
+
+        if (loaded.entry == DEDUPE_NONE) {
+            loaded.entry = chunk->entry_count;
+            if (add_entry(chunk, cur_rule, key, broken) != 0) { rtn = -1; break; }
+            if (!broken && dedupe_add(&rules, key, loaded.entry) != 0) { rtn = -1; break; }
+        }
+
+        if (grow_array((void **)&chunk->lines, &chunk->capacity, chunk->count, sizeof(LoadedLine), 1024) != 0) {
+            rtn = -1;
+            break;
+        }
+        chunk->lines[chunk->count++] = loaded;
+    }
+
+    // The chunk's table is only needed while parsing, the merge builds its own
+    dedupe_free(&rules);
+
+    // Everything parsed is kept until the whole load finishes, so give back what the arrays over-allocated
+    if (rtn == 0) { shrink_chunk(chunk); }
+
+    if (cur_rule) { free_rule(cur_rule); free(cur_rule); }
+    free(line);
+    return rtn;
+}
+
+
+static void *parse_thread(void *arg) {
+    Loader *loader = ((LoadThread *)arg)->loader;
+
+    while ( !__atomic_load_n(&loader->failed, __ATOMIC_RELAXED) ) {
+        size_t chunk_num = __atomic_fetch_add(&loader->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk_num >= loader->chunk_count) { break; }
+
+        if (parse_chunk(&loader->chunks[chunk_num]) != 0) {
+            __atomic_store_n(&loader->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+
+static inline int entry_partition(const Loader *loader, const ChunkEntry *entry) {
+    return (int)((entry->key >> 32) % (uint64_t)loader->partition_count);
+}
+
+
+// Finds the first occurrence of every rule in one partition of the key space
+// Each partition walks all entries in file order, so "first" means the same thing it does serially
+static void *merge_thread(void *arg) {
+    LoadThread *self   = (LoadThread *)arg;
+    Loader     *loader = self->loader;
+
+    // Size the table for exactly the entries in this partition so it never has to grow
+    size_t capacity = 0;
+    for (size_t chunk_num = 0; chunk_num < loader->chunk_count; chunk_num++) {
+        LoadChunk *chunk = &loader->chunks[chunk_num];
+        for (size_t entry_num = 0; entry_num < chunk->entry_count; entry_num++) {
+            ChunkEntry *entry = &chunk->entries[entry_num];
+            if (!entry->broken && entry_partition(loader, entry) == self->partition) { capacity++; }
+        }
+    }
+
+    DedupeTable rules;
+    if (dedupe_init(&rules, capacity) != 0) {
+        __atomic_store_n(&loader->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    for (size_t chunk_num = 0; chunk_num < loader->chunk_count; chunk_num++) {
+        LoadChunk *chunk = &loader->chunks[chunk_num];
+
+        for (size_t entry_num = 0; entry_num < chunk->entry_count; entry_num++) {
+            ChunkEntry *entry = &chunk->entries[entry_num];
+            if (entry->broken || entry_partition(loader, entry) != self->partition) { continue; }
+
+            EntryMatch match = { loader, NULL, chunk->text + entry->text, entry_length(chunk, entry_num) };
+            entry->original = dedupe_find(&rules, entry->key, merge_match, &match);
+            if (entry->original != NO_ORIGINAL) { continue; }
+
+            // Can't fail, the table was sized for every entry
+            dedupe_add(&rules, entry->key, chunk->first_entry + entry_num);
+        }
+    }
+
+    dedupe_free(&rules);
+    return NULL;
+}
+
+
+// Runs thread_count copies of a loader thread and waits for them
+// Copies that can't get a thread of their own run on the calling thread
+static int run_threads(Loader *loader, int thread_count, void *(*thread_main)(void *)) {
+    LoadThread *threads = (LoadThread *)calloc(thread_count, sizeof(LoadThread));
+    if (threads == NULL) { return -1; }
+
+    for (int thread_num = 0; thread_num < thread_count; thread_num++) {
+        threads[thread_num].loader    = loader;
+        threads[thread_num].partition = thread_num;
+    }
+
+    int started = 0;
+    for (int thread_num = 0; thread_num < thread_count; thread_num++) {
+        if (pthread_create(&threads[thread_num].thread, NULL, thread_main, &threads[thread_num]) != 0) { break; }
+        started++;
+    }
+
+    for (int thread_num = started; thread_num < thread_count; thread_num++) {
+        thread_main(&threads[thread_num]);
+    }
+
+    for (int thread_num = 0; thread_num < started; thread_num++) {
+        pthread_join(threads[thread_num].thread, NULL);
+    }
+
+    free(threads);
+    return 0;
+}
+
+
+// Allocates memory starting on a cache line
+static void *alloc_aligned(size_t size) {
+    void *memory = NULL;
+    if (posix_memalign(&memory, 64, size) != 0) { return NULL; }
+    return memory;
+}
+
+
+int ruleset_load(RuleSet *set, char **file_names, int file_count, int thread_count) {
+    memset(set, 0, sizeof(RuleSet));
+    if (thread_count < 1) { thread_count = 1; }
+
+    // Usually the file names are all the storage holds, so one block just big enough for them will do
+    size_t names_size = 1;
+    for (int file_num = 0; file_num < file_count; file_num++) { names_size += strlen(file_names[file_num]) + ARENA_ALIGN; }
+    arena_init(&set->storage, names_size);
+
+    int rtn = -1;
+    Loader loader;
+    memset(&loader, 0, sizeof(Loader));
+
+    RuleFile *files = (RuleFile *)calloc(file_count + 1, sizeof(RuleFile));
+    set->file_names = (const char **)calloc(file_count + 1, sizeof(char *));
+    set->file_count = file_count;
+    if (files == NULL || set->file_names == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate rule files\n");
+        free(files);
+        ruleset_free(set);
+        return -1;
+    }
+
+
+    // Map every file and split it into chunks on line boundaries
+    size_t chunk_capacity = 0;
+    for (int file_num = 0; file_num < file_count; file_num++) {
+        RuleFile *file = &files[file_num];
+
+        // Make sure we successfully opened the rule file
+        if (open_rule_file(file, file_names[file_num]) != 0) {
+            fprintf(stderr, "ERROR: Failed to open input file <%s>\n", file_names[file_num]);
+            goto cleanup;
+        }
+
+        set->file_names[file_num] = arena_strndup(&set->storage, file->name, strlen(file->name));
+        if (set->file_names[file_num] == NULL) {
+            fprintf(stderr, "ERROR: Failed to allocate rule files\n");
+            goto cleanup;
+        }
+
+        size_t pos = 0;
+        while (pos < file->size) {
+            size_t end = pos + LOAD_CHUNK_SIZE;
+            if (end < file->size) {
+                char *newline = memchr(file->data + end, '\n', file->size - end);
+                end = (newline ? (size_t)(newline - file->data) + 1 : file->size);
+            } else {
+                end = file->size;
+            }
+
+            if (loader.chunk_count == chunk_capacity) {
+                chunk_capacity = (chunk_capacity ? chunk_capacity * 2 : 64);
+                LoadChunk *chunks = (LoadChunk *)realloc(loader.chunks, chunk_capacity * sizeof(LoadChunk));
+                if (chunks == NULL) {
+                    fprintf(stderr, "ERROR: Failed to allocate rule chunks\n");
+                    goto cleanup;
+                }
+                loader.chunks = chunks;
+            }
+
+            LoadChunk *chunk = &loader.chunks[loader.chunk_count++];
+            memset(chunk, 0, sizeof(LoadChunk));
+            chunk->file  = file;
+            chunk->start = file->data + pos;
+            chunk->end   = file->data + end;
+
+            pos = end;
+        }
+    }
+
+
+    // Parse all chunks, then let each partition find its first occurrences
+    int parse_threads = (loader.chunk_count < (size_t)thread_count ? (int)loader.chunk_count : thread_count);
+    if (parse_threads > 0 && run_threads(&loader, parse_threads, parse_thread) != 0) {
+        fprintf(stderr, "ERROR: Failed to allocate rule loading threads\n");
+        goto cleanup;
+    }
+
+    if (loader.failed) {
+        fprintf(stderr, "ERROR: Failed to allocate memory while parsing rules\n");
+        goto cleanup;
+    }
+
+    // Entry ids have to fit in a dedupe table slot
+    size_t entry_total = 0;
+    for (size_t chunk_num = 0; chunk_num < loader.chunk_count; chunk_num++) {
+        loader.chunks[chunk_num].first_entry = entry_total;
+        entry_total += loader.chunks[chunk_num].entry_count;
+
+        if (entry_total >= DEDUPE_NONE) {
+            fprintf(stderr, "ERROR: Too many unique rules\n");
+            goto cleanup;
+        }
+    }
+
+    loader.partition_count = thread_count;
+    if (run_threads(&loader, thread_count, merge_thread) != 0) {
+        fprintf(stderr, "ERROR: Failed to allocate rule loading threads\n");
+        goto cleanup;
+    }
+
+    if (loader.failed) {
+        fprintf(stderr, "ERROR: Failed to allocate memory while deduplicating rules\n");
+        goto cleanup;
+    }
+
+
+    // Everything that survives is known now, so the rule set can be allocated exactly
+    size_t keep_count = 0;
+    size_t keep_text  = 0;
+    for (size_t chunk_num = 0; chunk_num < loader.chunk_count; chunk_num++) {
+        LoadChunk *chunk = &loader.chunks[chunk_num];
+        for (size_t entry_num = 0; entry_num < chunk->entry_count; entry_num++) {
+            ChunkEntry *entry = &chunk->entries[entry_num];
+            if (entry->broken || entry->original != NO_ORIGINAL) { continue; }
+
+            keep_count++;
+            keep_text += entry_length(chunk, entry_num) + 1;
+        }
+    }
+
+    set->text    = (char       *)alloc_aligned(keep_text + 1);
+    set->offsets = (uint64_t   *)alloc_aligned((keep_count + 1) * sizeof(uint64_t));
+    set->sources = (RuleSource *)calloc(keep_count + 1, sizeof(RuleSource));
+    if (set->text == NULL || set->offsets == NULL || set->sources == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate rule set\n");
+        goto cleanup;
+    }
+
+    // Rules from a pipe or stdin keep their source lines, which then take up most of the storage
+    for (int file_num = 0; file_num < file_count; file_num++) {
+        if (files[file_num].mapped || files[file_num].size == 0) { continue; }
+
+        set->storage.block_size = ARENA_BLOCK_SIZE;
+        set->source_lines       = (const char **)calloc(keep_count + 1, sizeof(char *));
+        if (set->source_lines == NULL) {
+            fprintf(stderr, "ERROR: Failed to allocate rule set\n");
+            goto cleanup;
+        }
+        break;
+    }
+
+
+    // Walk every line in order to report errors and dupes and collect the unique rules
+    size_t       text_pos   = 0;
+    unsigned int first_line = 0;
+    for (size_t chunk_num = 0; chunk_num < loader.chunk_count; chunk_num++) {
+        LoadChunk *chunk = &loader.chunks[chunk_num];
+
+        if (chunk_num > 0 && chunk->file != loader.chunks[chunk_num - 1].file) { first_line = 0; }
+        chunk->first_line = first_line;
+        first_line += chunk->line_count;
+
+        for (size_t line_num = 0; line_num < chunk->count; line_num++) {
+            LoadedLine *loaded = &chunk->lines[line_num];
+            ChunkEntry *entry  = &chunk->entries[loaded->entry];
+
+            int          source_len;
+            const char  *source_text = line_text(chunk, loaded, &source_len);
+            unsigned int source_line = loaded->line + chunk->first_line;
+
+            #ifdef DEBUG_PARSING
+            fprintf(stderr, "Before Parsing: %.*s (Length: %d)\n", source_len, source_text, source_len);
+            #endif
+
+            if (entry->broken) {
+                fprintf(
+                    stderr, "File: <%s>; Line: <%u>; Rule: <%.*s>; Error: %s\n",
+                    chunk->file->name, source_line, source_len, source_text, chunk->text + entry->text
+                );
+
+                set->error_count++;
+                continue;
+            }
+
+            #ifdef DEBUG_PARSING
+            fprintf(
+                stderr, "After  Parsing: %s (Length: %d)\n",
+                chunk->text + entry->text, (int)entry_length(chunk, loaded->entry)
+            );
+            fprintf(stderr, "\n");
+            #endif
+
+            // Later lines in the same chunk share their entry with the first occurrence
+            if (entry->line != line_num || entry->original != NO_ORIGINAL) {
+                #ifdef DEBUG_DUPES
+                const LoadChunk  *first_chunk = chunk;
+                const ChunkEntry *first_entry = entry;
+                if (entry->original != NO_ORIGINAL) {
+                    first_chunk = entry_chunk(&loader, entry->original);
+                    first_entry = &first_chunk->entries[entry->original - first_chunk->first_entry];
+                }
+
+                const LoadedLine *first_loaded = &first_chunk->lines[first_entry->line];
+                int         first_len;
+                const char *first_text = line_text(first_chunk, first_loaded, &first_len);
+
+                fprintf(
+                    stderr, "File: <%s>; Line: <%u>; Rule: <%.*s>; Duplicate of <%.*s> from <%s> line <%u>\n",
+                    chunk->file->name, source_line, source_len, source_text,
+                    first_len, first_text, first_chunk->file->name, first_loaded->line + first_chunk->first_line
+                );
+                #endif
+
+                set->dupe_count++;
+                continue;
+            }
+
+            size_t length = entry_length(chunk, loaded->entry);
+            memcpy(set->text + text_pos, chunk->text + entry->text, length + 1);
+
+            if (set->source_lines && !chunk->file->mapped
+            &&  (set->source_lines[set->count] = arena_strndup(&set->storage, source_text, source_len)) == NULL) {
+                fprintf(stderr, "ERROR: Failed to allocate rule set\n");
+                goto cleanup;
+            }
+
+            set->offsets[set->count]      = text_pos;
+            set->sources[set->count].file = chunk->file - files;
+            set->sources[set->count].line = source_line;
+            set->count++;
+            text_pos += length + 1;
+        }
+
+        // Only duplicate reports look back at earlier chunks, otherwise this chunk is finished with
+        #ifndef DEBUG_DUPES
+        free(chunk->lines);   chunk->lines   = NULL;
+        free(chunk->entries); chunk->entries = NULL;
+        free(chunk->text);    chunk->text    = NULL;
+        #endif
+    }
+
+    set->offsets[set->count] = text_pos;
+    rtn = 0;
+
+
+cleanup:
+    for (size_t chunk_num = 0; chunk_num < loader.chunk_count; chunk_num++) {
+        free(loader.chunks[chunk_num].lines);
+        free(loader.chunks[chunk_num].entries);
+        free(loader.chunks[chunk_num].text);
+    }
+    free(loader.chunks);
+
+    for (int file_num = 0; file_num < file_count; file_num++) { close_rule_file(&files[file_num]); }
+    free(files);
+
+    if (rtn != 0) { ruleset_free(set); }
+    return rtn;
+}
+
+
+void ruleset_free(RuleSet *set) {
+    if (set == NULL) { return; }
+
+    if (set->mapping) {
+        munmap(set->mapping, set->mapping_size);
+    } else {
+        if (set->text   ) { free(set->text);    }
+        if (set->offsets) { free(set->offsets); }
+        if (set->sources) { free(set->sources); }
+    }
+
+    if (set->file_names  ) { free(set->file_names);   }
+    if (set->source_lines) { free(set->source_lines); }
+    arena_free(&set->storage);
+    memset(set, 0, sizeof(RuleSet));
+}
+
+
+char *ruleset_source_text(const RuleSet *set, size_t rule_num) {
+    const RuleSource *source = &set->sources[rule_num];
+    if (set->source_lines && set->source_lines[rule_num]) { return strdup(set->source_lines[rule_num]); }
+
+    FILE *rule_file = fopen(set->file_names[source->file], "r");
+    if (rule_file == NULL) { return NULL; }
+
+    char   *line      = NULL;
+    size_t  line_size = 0;
+    ssize_t line_len;
+    unsigned int line_num = 0;
+    while ((line_len = getline(&line, &line_size, rule_file)) >= 0) {
+        if (++line_num < source->line) { continue; }
+
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+            line[--line_len] = 0;
+        }
+        fclose(rule_file);
+        return line;
+    }
+
+    free(line);
+    fclose(rule_file);
+    return NULL;
+}
@@ -0,0 +1,72 @@
+#ifndef RULESET_H
+#define RULESET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "rules.h"
+#include "arena.h"
+
+
+// Where a rule came from, as an index into RuleSet.file_names and a line number
+// This makes it easier to track down rule errors and dupes, but is never touched while applying rules
+typedef struct RuleSource {
+    uint32_t file;
+    uint32_t line;
+} RuleSource;
+
+
+// The unique rules from a set of rule files, in order of first occurrence
+typedef struct RuleSet {
+    // Parsed rules are stored back to back, each NULL terminated
+    // Rule i starts at text + offsets[i] and the next one starts at text + offsets[i + 1]
+    // Both arrays start on a cache line
+    char        *text;
+    uint64_t    *offsets;
+    size_t       count;
+
+    // sources[i] is where rule i came from
+    RuleSource  *sources;
+
+    // Interned, one copy of each file name no matter how many rules came from it
+    const char **file_names;
+    int          file_count;
+
+    // The original lines of rules from files that can't be read again, like pipes and stdin, NULL for the rest
+    // NULL altogether when every file can be
+    const char **source_lines;
+
+    // Holds the interned file names and source lines
+    Arena        storage;
+
+    // Set when everything above points into a compiled rule set mapped by rulecache_open()
+    void        *mapping;
+    size_t       mapping_size;
+
+    unsigned int error_count;
+    unsigned int dupe_count;
+} RuleSet;
+
+
+// Returns rule number rule_num, pointing into the rule set
+static inline Rule ruleset_rule(const RuleSet *set, size_t rule_num) {
+    Rule rule = {
+        .text   = set->text + set->offsets[rule_num],
+        .length = set->offsets[rule_num + 1] - set->offsets[rule_num] - 1,
+    };
+    return rule;
+}
+
+
+// Loads, parses and deduplicates rule files using thread_count threads
+// Errors and duplicates are reported in file and line order, exactly as a serial load would
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int ruleset_load(RuleSet *set, char **file_names, int file_count, int thread_count);
+
+// Frees the members of a rule set
+void ruleset_free(RuleSet *set);
+
+// Returns a rule's original line, re-read from its file unless the file was a pipe and the line was kept
+// Returns the line (the caller must free it), or NULL if the file can't be read again
+char *ruleset_source_text(const RuleSet *set, size_t rule_num);
+
+#endif /* RULESET_H */
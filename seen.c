@@ -0,0 +1,520 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "seen.h"
+#include "rules.h"
+
+// Recent tables are spilled once they're this full (out of 8)
+#define SEEN_MAX_LOAD 5
+
+// Hashes read from each run at a time while merging two of them
+#define SEEN_MERGE_CHUNK 8192
+
+
+static int compare_hashes(const void *a, const void *b) {
+    uint64_t left = *(const uint64_t *)a, right = *(const uint64_t *)b;
+    return (left > right) - (left < right);
+}
+
+
+static int compare_pending(const void *a, const void *b) {
+    const SeenPending *left = (const SeenPending *)a, *right = (const SeenPending *)b;
+    return (left->hash > right->hash) - (left->hash < right->hash);
+}
+
+
+// Rounds down to a power of two, at least 1
+static size_t floor_pow2(size_t value) {
+    size_t result = 1;
+    while (result * 2 <= value) { result *= 2; }
+    return result;
+}
+
+
+// Spill file
+
+// Creates an anonymous temporary file in $TMPDIR, or /tmp
+static int open_spill(SeenSet *set) {
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || dir[0] == 0) { dir = "/tmp"; }
+
+    char *name = NULL;
+    if (asprintf(&name, "%s/hcre-seen-XXXXXX", dir) < 0) { return -1; }
+
+    set->fd = mkstemp(name);
+    if (set->fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create a temporary file in <%s>\n", dir);
+        free(name);
+        return -1;
+    }
+
+    // Nobody else needs to find it, and it's cleaned up however we exit
+    unlink(name);
+    free(name);
+    return 0;
+}
+
+
+static int write_hashes(SeenSet *set, const uint64_t *hashes, size_t count, uint64_t offset) {
+    const char *data   = (const char *)hashes;
+    size_t      length = count * sizeof(uint64_t);
+    while (length > 0) {
+        ssize_t written = pwrite(set->fd, data, length, offset);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written < 0) {
+            fprintf(stderr, "ERROR: Failed to write a temporary file: %s\n", strerror(errno));
+            return -1;
+        }
+
+        data   += written;
+        length -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+
+static int read_hashes(SeenSet *set, uint64_t *hashes, size_t count, uint64_t offset) {
+    char  *data   = (char *)hashes;
+    size_t length = count * sizeof(uint64_t);
+    while (length > 0) {
+        ssize_t bytes = pread(set->fd, data, length, offset);
+        if (bytes < 0 && errno == EINTR) { continue; }
+        if (bytes <= 0) {
+            fprintf(stderr, "ERROR: Failed to read a temporary file: %s\n", (bytes < 0 ? strerror(errno) : "unexpected end of file"));
+            return -1;
+        }
+
+        data   += bytes;
+        length -= bytes;
+        offset += bytes;
+    }
+    return 0;
+}
+
+
+// Runs
+
+// Appends an empty run to a shard, at space reserved for count hashes
+static SeenRun *begin_run(SeenSet *set, SeenShard *shard, uint64_t count) {
+    if (shard->run_count == shard->run_capacity) {
+        size_t   capacity = (shard->run_capacity ? shard->run_capacity * 2 : 16);
+        SeenRun *runs     = (SeenRun *)realloc(shard->runs, capacity * sizeof(SeenRun));
+        if (runs == NULL) { return NULL; }
+        shard->runs         = runs;
+        shard->run_capacity = capacity;
+    }
+
+    SeenRun *run = &shard->runs[shard->run_count];
+    run->offset = __atomic_fetch_add(&set->file_size, count * sizeof(uint64_t), __ATOMIC_RELAXED);
+    run->count  = count;
+    run->fences = (uint64_t *)malloc(((count + SEEN_FENCE_STRIDE - 1) / SEEN_FENCE_STRIDE + 1) * sizeof(uint64_t));
+    if (run->fences == NULL) { return NULL; }
+
+    shard->run_count++;
+    return run;
+}
+
+
+// Gives a run's space back to the filesystem, its offsets are never used again
+static void drop_run(SeenSet *set, SeenRun *run) {
+    if (run->count > 0) {
+        fallocate(set->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, run->offset, run->count * sizeof(uint64_t));
+    }
+    free(run->fences);
+    memset(run, 0, sizeof(SeenRun));
+}
+
+
+// Merges the shard's last two runs into one, they never share a hash
+static int merge_last_runs(SeenSet *set, SeenShard *shard) {
+    SeenRun older = shard->runs[shard->run_count - 2];
+    SeenRun newer = shard->runs[shard->run_count - 1];
+    shard->run_count -= 2;
+
+    SeenRun *merged = begin_run(set, shard, older.count + newer.count);
+    uint64_t *chunks = (uint64_t *)malloc(3 * SEEN_MERGE_CHUNK * sizeof(uint64_t));
+    if (merged == NULL || chunks == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate memory for merging hash runs\n");
+        free(chunks);
+        free(older.fences);
+        free(newer.fences);
+        return -1;
+    }
+
+    uint64_t *left = chunks, *right = chunks + SEEN_MERGE_CHUNK, *out = chunks + 2 * SEEN_MERGE_CHUNK;
+    uint64_t  left_read = 0, right_read = 0, written = 0;
+    size_t    left_pos = 0, left_len = 0, right_pos = 0, right_len = 0, out_len = 0;
+
+    int rtn = 0;
+    while (rtn == 0 && written < merged->count) {
+        // Refill whichever side ran dry
+        if (left_pos == left_len && left_read < older.count) {
+            left_len = (older.count - left_read < SEEN_MERGE_CHUNK ? older.count - left_read : SEEN_MERGE_CHUNK);
+            left_pos = 0;
+            if (read_hashes(set, left, left_len, older.offset + left_read * sizeof(uint64_t)) != 0) { rtn = -1; break; }
+            left_read += left_len;
+        }
+        if (right_pos == right_len && right_read < newer.count) {
+            right_len = (newer.count - right_read < SEEN_MERGE_CHUNK ? newer.count - right_read : SEEN_MERGE_CHUNK);
+            right_pos = 0;
+            if (read_hashes(set, right, right_len, newer.offset + right_read * sizeof(uint64_t)) != 0) { rtn = -1; break; }
+            right_read += right_len;
+        }
+
+        bool take_left = (right_pos == right_len || (left_pos < left_len && left[left_pos] < right[right_pos]));
+        uint64_t hash  = (take_left ? left[left_pos++] : right[right_pos++]);
+
+        uint64_t index = written + out_len;
+        if (index % SEEN_FENCE_STRIDE == 0) { merged->fences[index / SEEN_FENCE_STRIDE] = hash; }
+        out[out_len++] = hash;
+
+        if (out_len == SEEN_MERGE_CHUNK || index + 1 == merged->count) {
+            if (write_hashes(set, out, out_len, merged->offset + written * sizeof(uint64_t)) != 0) { rtn = -1; break; }
+            written += out_len;
+            out_len  = 0;
+        }
+    }
+
+    free(chunks);
+    drop_run(set, &older);
+    drop_run(set, &newer);
+
+    // The cached page may have belonged to either of them
+    shard->page_count = 0;
+    return rtn;
+}
+
+
+// Writes a shard's recent hashes as a new run and empties the table
+// Runs are merged while the one before the newest is no more than twice its size, so a shard has a logarithmic number of them
+static int spill_recent(SeenSet *set, SeenShard *shard) {
+    size_t count = 0;
+    for (size_t slot = 0; slot <= shard->recent_mask; slot++) {
+        if (shard->recent[slot] != 0) { shard->recent[count++] = shard->recent[slot]; }
+    }
+    qsort(shard->recent, count, sizeof(uint64_t), compare_hashes);
+
+    SeenRun *run = begin_run(set, shard, count);
+    if (run == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate memory for a hash run\n");
+        return -1;
+    }
+    for (size_t pos = 0; pos < count; pos += SEEN_FENCE_STRIDE) { run->fences[pos / SEEN_FENCE_STRIDE] = shard->recent[pos]; }
+    if (write_hashes(set, shard->recent, count, run->offset) != 0) { return -1; }
+
+    memset(shard->recent, 0, (shard->recent_mask + 1) * sizeof(uint64_t));
+    shard->recent_count = 0;
+
+    while (shard->run_count >= 2 && shard->runs[shard->run_count - 2].count <= shard->runs[shard->run_count - 1].count * 2) {
+        if (merge_last_runs(set, shard) != 0) { return -1; }
+    }
+    return 0;
+}
+
+
+// Looks for hash in one run, reading the page its fences point at unless it's the one already read
+// Returns 1 if found, 0 if not, -1 on failure
+static int run_contains(SeenSet *set, SeenShard *shard, const SeenRun *run, uint64_t hash) {
+    if (run->count == 0 || hash < run->fences[0]) { return 0; }
+
+    // The last fence at or before hash
+    size_t low = 0, high = (run->count - 1) / SEEN_FENCE_STRIDE;
+    while (low < high) {
+        size_t mid = (low + high + 1) / 2;
+        if (run->fences[mid] <= hash) { low = mid; } else { high = mid - 1; }
+    }
+
+    uint64_t first    = (uint64_t)low * SEEN_FENCE_STRIDE;
+    uint64_t position = run->offset + first * sizeof(uint64_t);
+    size_t   count    = (run->count - first < SEEN_FENCE_STRIDE ? run->count - first : SEEN_FENCE_STRIDE);
+    if (shard->page_count == 0 || shard->page_position != position) {
+        shard->page_count = 0;
+        if (read_hashes(set, shard->page, count, position) != 0) { return -1; }
+        shard->page_position = position;
+        shard->page_count    = count;
+    }
+
+    return (bsearch(&hash, shard->page, count, sizeof(uint64_t), compare_hashes) != NULL);
+}
+
+
+// Shards
+
+// Sets the hash's bits in its filter block
+// Returns true if they were all set already, meaning the hash may have been seen
+static inline bool bloom_add(SeenShard *shard, uint64_t hash) {
+    uint64_t *block = &shard->bloom[hash & shard->bloom_mask];
+
+    // The bit positions come from a remix of the hash, the block index and shard already used its low and high bits
+    uint64_t mixed = hash * 0x9E3779B97F4A7C15ull;
+    uint64_t bits  = 0;
+    for (int bit = 0; bit < SEEN_BLOOM_BITS; bit++) { bits |= 1ull << ((mixed >> (58 - 6 * bit)) & 63); }
+
+    bool maybe = ((*block & bits) == bits);
+    *block |= bits;
+    return maybe;
+}
+
+
+static bool recent_contains(const SeenShard *shard, uint64_t hash) {
+    size_t slot = hash & shard->recent_mask;
+    while (shard->recent[slot] != 0) {
+        if (shard->recent[slot] == hash) { return true; }
+        slot = (slot + 1) & shard->recent_mask;
+    }
+    return false;
+}
+
+
+// Adds a hash that's known to be new, spilling the table first if it's full
+static int recent_add(SeenSet *set, SeenShard *shard, uint64_t hash) {
+    if (shard->recent_count >= shard->recent_capacity && spill_recent(set, shard) != 0) { return -1; }
+
+    size_t slot = hash & shard->recent_mask;
+    while (shard->recent[slot] != 0) { slot = (slot + 1) & shard->recent_mask; }
+    shard->recent[slot] = hash;
+    shard->recent_count++;
+    shard->unique_count++;
+    return 0;
+}
+
+
+static int batch_add(SeenBatch *batch, const char *word, int length) {
+    size_t needed = sizeof(int) + length + 1;
+    if (batch->length + needed > batch->capacity) {
+        size_t capacity = (batch->capacity ? batch->capacity * 2 : 64 * 1024);
+        while (batch->length + needed > capacity) { capacity *= 2; }
+
+        char *text = (char *)realloc(batch->text, capacity);
+        if (text == NULL) {
+            fprintf(stderr, "ERROR: Failed to allocate memory for deduplicated candidates\n");
+            return -1;
+        }
+        batch->text     = text;
+        batch->capacity = capacity;
+    }
+
+    memcpy(batch->text + batch->length, &length, sizeof(int));
+    memcpy(batch->text + batch->length + sizeof(int), word, length);
+    batch->length += needed;
+    return 0;
+}
+
+
+// Looks for every deferred candidate in the runs, in hash order so each run's pages are read front to back
+// New ones are added to the recent table and to accepted, the caller holds the shard's lock
+static int resolve_pending(SeenSet *set, SeenShard *shard, SeenBatch *accepted) {
+    SeenPending *pending = shard->pending;
+    size_t       count   = shard->pending_count;
+    qsort(pending, count, sizeof(SeenPending), compare_pending);
+
+    // A candidate deferred more than once only needs finding once, and any of them may have become recent since
+    // Duplicates are marked by clearing their length's top bit, which no candidate needs
+    const uint32_t dupe = 0x80000000u;
+    for (size_t num = 0; num < count; num++) {
+        if ((num > 0 && pending[num].hash == pending[num - 1].hash) || recent_contains(shard, pending[num].hash)) {
+            pending[num].length |= dupe;
+        }
+    }
+
+    for (size_t run_num = 0; run_num < shard->run_count; run_num++) {
+        for (size_t num = 0; num < count; num++) {
+            if (pending[num].length & dupe) { continue; }
+
+            int found = run_contains(set, shard, &shard->runs[run_num], pending[num].hash);
+            if (found < 0) { return -1; }
+            if (found) { pending[num].length |= dupe; }
+        }
+    }
+
+    int rtn = 0;
+    for (size_t num = 0; num < count && rtn == 0; num++) {
+        if (pending[num].length & dupe) {
+            shard->dupe_count++;
+            continue;
+        }
+
+        // A spill here only adds a run, none of the remaining hashes can be in it
+        shard->false_positive_count++;
+        if (recent_add(set, shard, pending[num].hash) != 0
+        ||  batch_add(accepted, shard->pending_text + pending[num].offset, pending[num].length) != 0) {
+            rtn = -1;
+        }
+    }
+
+    shard->pending_count     = 0;
+    shard->pending_text_size = 0;
+    return rtn;
+}
+
+
+// Set
+
+int seen_init(SeenSet *set, size_t memory_mb) {
+    memset(set, 0, sizeof(SeenSet));
+    set->fd = -1;
+
+    if (memory_mb < SEEN_MIN_MB) { memory_mb = SEEN_MIN_MB; }
+    size_t shard_memory = memory_mb * 1024 * 1024 / SEEN_SHARD_COUNT;
+
+    // Half for the filter, three eighths for recent hashes, the rest for deferred candidates
+    size_t bloom_blocks = floor_pow2(shard_memory / 2 / sizeof(uint64_t));
+    size_t recent_slots = floor_pow2(shard_memory * 3 / 8 / sizeof(uint64_t));
+    size_t pending      = shard_memory / 8 / (sizeof(SeenPending) + BLOCK_SIZE);
+
+    set->shards = (SeenShard *)calloc(SEEN_SHARD_COUNT, sizeof(SeenShard));
+    if (set->shards == NULL || open_spill(set) != 0) {
+        fprintf(stderr, "ERROR: Failed to allocate the candidate set\n");
+        seen_free(set);
+        return -1;
+    }
+
+    for (int shard_num = 0; shard_num < SEEN_SHARD_COUNT; shard_num++) {
+        SeenShard *shard = &set->shards[shard_num];
+        shard->bloom                 = (uint64_t *)calloc(bloom_blocks, sizeof(uint64_t));
+        shard->bloom_mask            = bloom_blocks - 1;
+        shard->recent                = (uint64_t *)calloc(recent_slots, sizeof(uint64_t));
+        shard->recent_mask           = recent_slots - 1;
+        shard->recent_capacity       = recent_slots * SEEN_MAX_LOAD / 8;
+        shard->pending               = (SeenPending *)malloc(pending * sizeof(SeenPending));
+        shard->pending_text          = (char *)malloc(pending * BLOCK_SIZE);
+        shard->pending_capacity      = pending;
+        shard->pending_text_capacity = pending * BLOCK_SIZE;
+        shard->page                  = (uint64_t *)malloc(SEEN_FENCE_STRIDE * sizeof(uint64_t));
+
+        if (shard->bloom == NULL || shard->recent == NULL || shard->pending == NULL || shard->pending_text == NULL || shard->page == NULL
+        ||  pthread_mutex_init(&shard->lock, NULL) != 0) {
+            fprintf(stderr, "ERROR: Failed to allocate the candidate set\n");
+            seen_free(set);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+void seen_free(SeenSet *set) {
+    if (set == NULL) { return; }
+
+    for (int shard_num = 0; set->shards && shard_num < SEEN_SHARD_COUNT; shard_num++) {
+        SeenShard *shard = &set->shards[shard_num];
+        for (size_t run_num = 0; run_num < shard->run_count; run_num++) { free(shard->runs[run_num].fences); }
+
+        // A shard is only half made if its page is missing, and then its lock was never initialized
+        if (shard->page) { pthread_mutex_destroy(&shard->lock); }
+        free(shard->bloom);
+        free(shard->recent);
+        free(shard->runs);
+        free(shard->pending);
+        free(shard->pending_text);
+        free(shard->page);
+    }
+
+    if (set->shards) { free(set->shards); }
+    if (set->fd >= 0) { close(set->fd); }
+    memset(set, 0, sizeof(SeenSet));
+    set->fd = -1;
+}
+
+
+// Makes room for length more bytes of deferred text, only needed for text longer than a candidate
+// Returns 0 on success, -1 on failure (an error has already been printed)
+static int reserve_pending_text(SeenShard *shard, size_t length) {
+    if (shard->pending_text_size + length <= shard->pending_text_capacity) { return 0; }
+
+    size_t capacity = (shard->pending_text_capacity + length) * 2;
+    char  *text     = (char *)realloc(shard->pending_text, capacity);
+    if (text == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate memory for deferred candidates\n");
+        return -1;
+    }
+
+    shard->pending_text          = text;
+    shard->pending_text_capacity = capacity;
+    return 0;
+}
+
+
+int seen_check(SeenSet *set, uint64_t hash, const char *word, int length, SeenBatch *accepted) {
+    // 0 marks an empty slot
+    if (hash == 0) { hash = 1; }
+
+    SeenShard *shard = &set->shards[hash >> (64 - SEEN_SHARD_BITS)];
+    pthread_mutex_lock(&shard->lock);
+
+    int rtn = SEEN_NEW;
+    if (!bloom_add(shard, hash)) {
+        // The filter has never seen it, which it's never wrong about
+        if (recent_add(set, shard, hash) != 0) { rtn = -1; }
+
+    } else if (recent_contains(shard, hash)) {
+        shard->dupe_count++;
+        rtn = SEEN_DUPLICATE;
+
+    } else if (shard->run_count == 0) {
+        // Nothing has been spilled, so the recent table is everything and the filter was wrong
+        shard->false_positive_count++;
+        if (recent_add(set, shard, hash) != 0) { rtn = -1; }
+
+    } else if (reserve_pending_text(shard, length) != 0) {
+        rtn = -1;
+
+    } else {
+        SeenPending *entry = &shard->pending[shard->pending_count++];
+        entry->hash   = hash;
+        entry->offset = shard->pending_text_size;
+        entry->length = length;
+        memcpy(shard->pending_text + shard->pending_text_size, word, length);
+        shard->pending_text_size += length;
+        shard->deferred_count++;
+
+        rtn = SEEN_DEFERRED;
+        if (shard->pending_count == shard->pending_capacity && resolve_pending(set, shard, accepted) != 0) { rtn = -1; }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return rtn;
+}
+
+
+int seen_finish(SeenSet *set, SeenBatch *accepted) {
+    int rtn = 0;
+    for (int shard_num = 0; shard_num < SEEN_SHARD_COUNT && rtn == 0; shard_num++) {
+        SeenShard *shard = &set->shards[shard_num];
+        pthread_mutex_lock(&shard->lock);
+        if (shard->pending_count > 0) { rtn = resolve_pending(set, shard, accepted); }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return rtn;
+}
+
+
+void seen_stats(SeenSet *set, SeenStats *stats) {
+    memset(stats, 0, sizeof(SeenStats));
+    for (int shard_num = 0; shard_num < SEEN_SHARD_COUNT; shard_num++) {
+        SeenShard *shard = &set->shards[shard_num];
+        pthread_mutex_lock(&shard->lock);
+        stats->unique_count         += shard->unique_count;
+        stats->dupe_count           += shard->dupe_count;
+        stats->deferred_count       += shard->deferred_count;
+        stats->false_positive_count += shard->false_positive_count;
+        stats->run_count            += shard->run_count;
+        for (size_t run_num = 0; run_num < shard->run_count; run_num++) {
+            stats->disk_bytes += shard->runs[run_num].count * sizeof(uint64_t);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+
+void seen_batch_free(SeenBatch *batch) {
+    if (batch == NULL) { return; }
+    free(batch->text);
+    memset(batch, 0, sizeof(SeenBatch));
+}
@@ -0,0 +1,167 @@
+#ifndef SEEN_H
+#define SEEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+// Remembers every candidate a run has written, by hash, to drop candidates any earlier word and rule already produced
+// Memory holds a Bloom filter over everything and an exact table of recent hashes, older hashes are spilled to disk
+// as sorted runs and only read back to confirm candidates the filter isn't sure about
+
+// Default and smallest memory for the whole set
+#define SEEN_MEMORY_MB     1024
+#define SEEN_MIN_MB        16
+
+// Candidates are split between this many shards by the top bits of their hash, each with its own lock
+#define SEEN_SHARD_BITS    8
+#define SEEN_SHARD_COUNT   (1 << SEEN_SHARD_BITS)
+
+// Bits set in a filter block for each hash, the block being a single 64-bit word
+#define SEEN_BLOOM_BITS    6
+
+// Hashes between the fence keys kept in memory for each run, so a lookup reads one page of the run
+#define SEEN_FENCE_STRIDE  512
+
+// Above this false positive rate, the filter is too full to be worth much and a warning says so
+#define SEEN_FPR_WARN      0.05
+
+// Returned by seen_check()
+#define SEEN_NEW       0
+#define SEEN_DUPLICATE 1
+#define SEEN_DEFERRED  2
+
+
+// A sorted run of hashes in the spill file, and the first hash of every SEEN_FENCE_STRIDE
+typedef struct SeenRun {
+    uint64_t  offset, count;
+    uint64_t *fences;
+} SeenRun;
+
+
+// A candidate the filter matched that isn't a recent hash, waiting to be looked for in the runs
+typedef struct SeenPending {
+    uint64_t hash;
+    uint32_t offset, length;
+} SeenPending;
+
+
+// The hashes whose top bits pick this shard
+typedef struct SeenShard {
+    pthread_mutex_t lock;
+
+    uint64_t    *bloom;
+    size_t       bloom_mask;
+
+    // Open addressing, 0 marks an empty slot, spilled as a run once count reaches capacity
+    uint64_t    *recent;
+    size_t       recent_mask, recent_count, recent_capacity;
+
+    SeenRun     *runs;
+    size_t       run_count, run_capacity;
+
+    // Deferred candidates and their text, resolved once pending_capacity of them have built up
+    // The text has room for BLOCK_SIZE bytes a candidate, and only grows for text longer than a candidate
+    SeenPending *pending;
+    char        *pending_text;
+    size_t       pending_count, pending_capacity, pending_text_size, pending_text_capacity;
+
+    // The last page of a run that was read, by its position in the spill file
+    uint64_t    *page;
+    uint64_t     page_position;
+    size_t       page_count;
+
+    // Totals, see SeenStats
+    uint64_t     unique_count, dupe_count, deferred_count, false_positive_count;
+} SeenShard;
+
+
+typedef struct SeenSet {
+    SeenShard *shards;
+
+    // Runs of every shard go into one unlinked temporary file, at offsets reserved from file_size
+    int        fd;
+    uint64_t   file_size;
+} SeenSet;
+
+
+// Totals over every shard
+typedef struct SeenStats {
+    uint64_t unique_count;
+    uint64_t dupe_count;
+
+    // Candidates that had to wait for the runs to be checked, and those that turned out new after matching the filter
+    uint64_t deferred_count;
+    uint64_t false_positive_count;
+
+    uint64_t run_count;
+    uint64_t disk_bytes;
+} SeenStats;
+
+
+// Candidates a worker has to write, deferred ones that turned out new, each stored as an int length,
+// the text, and a spare byte for output_buffer_record()
+typedef struct SeenBatch {
+    char  *text;
+    size_t length, capacity;
+} SeenBatch;
+
+
+// Prepares an empty set using about memory_mb of memory, plus the runs' fence keys as they grow
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int seen_init(SeenSet *set, size_t memory_mb);
+
+// Frees the set and its spill file
+void seen_free(SeenSet *set);
+
+// Records a candidate, returning SEEN_NEW if it should be written now, SEEN_DUPLICATE if it was seen before,
+// or SEEN_DEFERRED if that's not known yet; deferred candidates that turn out new are added to accepted
+// Only hash identifies the candidate, word is the text handed back through accepted and may be anything
+// Returns -1 on failure (an error has already been printed)
+int seen_check(SeenSet *set, uint64_t hash, const char *word, int length, SeenBatch *accepted);
+
+// Resolves every deferred candidate, adding the new ones to accepted
+// Only call once nothing else is checking candidates
+int seen_finish(SeenSet *set, SeenBatch *accepted);
+
+// Adds up the totals of every shard
+void seen_stats(SeenSet *set, SeenStats *stats);
+
+// Frees the members of a batch
+void seen_batch_free(SeenBatch *batch);
+
+// Returns the candidate at *position in a batch and moves past it, or NULL at the end of the batch
+static inline char *seen_batch_next(SeenBatch *batch, size_t *position, int *length) {
+    if (*position >= batch->length) { return NULL; }
+
+    char *record = batch->text + *position;
+    memcpy(length, record, sizeof(int));
+    *position += sizeof(int) + *length + 1;
+    return record + sizeof(int);
+}
+
+
+
+#ifdef DEBUG_OUTPUT
+// With DEBUG_OUTPUT, candidates are checked along with the rule that made them, so deferred ones can be written with it
+// The text is the rule, a tab, the candidate, and a byte holding the candidate's length
+// text needs room for rule_length + length + 2 bytes
+static inline int seen_debug_pack(char *text, const char *rule, int rule_length, const char *word, int length) {
+    memcpy(text, rule, rule_length);
+    text[rule_length] = '\t';
+    memcpy(text + rule_length + 1, word, length);
+    text[rule_length + 1 + length] = (char)length;
+    return rule_length + length + 2;
+}
+
+// Splits packed text back up, returning the candidate and setting *prefix_length to the length of the rule and tab before it
+static inline char *seen_debug_unpack(char *text, int text_length, int *prefix_length, int *length) {
+    *length        = (unsigned char)text[text_length - 1];
+    *prefix_length = text_length - 1 - *length;
+    return text + *prefix_length;
+}
+#endif
+
+#endif /* SEEN_H */
@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include "shmring.h"
+
+// Reference consumer for hcre --output-shm, built on shmring.h and shmring.c alone
+// Candidates are used straight from the ring, a real consumer would hash them where this one writes or counts them
+
+
+void usage(char *shmcat) {
+    printf("\n");
+    printf("USAGE:  %s  [-c]  NAME\n", shmcat);
+    printf("\n");
+    printf("Reads candidates from the shared memory ring NAME, written by hcre --output-shm NAME, and writes them on STDOUT\n");
+    printf("May be started before hcre, it waits for the ring to be created\n");
+    printf("\n");
+    printf("    -c    Only count the candidates and bytes\n");
+    printf("\n");
+}
+
+
+// Writes a whole batch from the ring, retrying short writes
+static int write_batch(const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, length);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+
+            fprintf(stderr, "ERROR: Failed to write output: %s\n", strerror(errno));
+            return -1;
+        }
+
+        data   += written;
+        length -= written;
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    bool count_only = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "ch")) != -1) {
+        switch (opt) {
+            case 'c': count_only = true; break;
+            case 'h': usage(argv[0]); return 0;
+            default:  return -1;
+        }
+    }
+    if (optind != argc - 1) { usage(argv[0]); return -1; }
+
+    // A closed stdout should detach from the ring so hcre stops, rather than kill us and leave it waiting
+    signal(SIGPIPE, SIG_IGN);
+
+    ShmRing ring;
+    int rtn;
+    while ((rtn = shmring_attach(&ring, argv[optind])) == 1) {
+        struct timespec delay = { 0, 10 * 1000 * 1000 };
+        nanosleep(&delay, NULL);
+    }
+    if (rtn != 0) { return -1; }
+
+    unsigned long int word_count = 0;
+    unsigned long int byte_count = 0;
+
+    const char *data;
+    int64_t     length;
+    while ((length = shmring_read(&ring, &data)) > 0) {
+        if (count_only) {
+            const char *pos = data, *word;
+            int         word_len;
+            while (shmring_next_word(&pos, data + length, &word, &word_len)) { word_count++; }
+            byte_count += length;
+
+        } else if (write_batch(data, length) != 0) {
+            rtn = -1;
+            break;
+        }
+
+        shmring_release(&ring);
+    }
+    if (length < 0) { rtn = -1; }
+
+    if (count_only && rtn == 0) { printf("%lu candidates, %lu bytes\n", word_count, byte_count); }
+
+    shmring_detach(&ring);
+    return rtn;
+}
@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+
+// Same scheme as hcre's other file formats
+static const char shmring_magic[8] = { '\x89', 'H', 'C', 'R', 'S', '\r', '\n', '\x1a' };
+
+
+static inline uint64_t align8(uint64_t value) {
+    return (value + 7) & ~(uint64_t)7;
+}
+
+
+// Sleeps while *word still holds value, for up to timeout if it isn't NULL
+// The ring is shared between processes so the futex can't be private
+static void futex_wait(uint32_t *word, uint32_t value, const struct timespec *timeout) {
+    syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+// Builds "/name" for shm_open()
+static char *shm_path(const char *name) {
+    char *path = NULL;
+    if (asprintf(&path, "/%s", name) < 0) { return NULL; }
+    return path;
+}
+
+
+static int map_ring(ShmRing *ring, int fd, size_t size) {
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) { return -1; }
+
+    ring->header   = (ShmRingHeader *)mapping;
+    ring->data     = (char *)mapping + sizeof(ShmRingHeader);
+    ring->map_size = size;
+    return 0;
+}
+
+
+int shmring_create(ShmRing *ring, const char *name, size_t size) {
+    memset(ring, 0, sizeof(ShmRing));
+
+    if (strchr(name, '/') != NULL || size < (size_t)SHMRING_MIN_MB * 1024 * 1024) {
+        fprintf(stderr, "ERROR: Invalid shared memory ring <%s>, names can't contain '/' and rings need %d MB\n", name, SHMRING_MIN_MB);
+        return -1;
+    }
+
+    char *path = shm_path(name);
+    ring->name = strdup(name);
+    if (path == NULL || ring->name == NULL) {
+        free(path);
+        free(ring->name);
+        return -1;
+    }
+
+    // A ring left behind by an earlier run may still be mapped by its consumer, so it's replaced rather than reused
+    shm_unlink(path);
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    free(path);
+
+    size_t map_size = sizeof(ShmRingHeader) + (size & ~(size_t)7);
+    if (fd < 0 || ftruncate(fd, map_size) != 0 || map_ring(ring, fd, map_size) != 0) {
+        fprintf(stderr, "ERROR: Failed to create shared memory ring <%s>: %s\n", name, strerror(errno));
+        if (fd >= 0) { close(fd); }
+        free(ring->name);
+        memset(ring, 0, sizeof(ShmRing));
+        return -1;
+    }
+    close(fd);
+
+    // A fresh object is zeroed, the magic goes in last so a consumer never sees a half-made header
+    ring->header->version     = SHMRING_VERSION;
+    ring->header->header_size = sizeof(ShmRingHeader);
+    ring->header->capacity    = map_size - sizeof(ShmRingHeader);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(ring->header->magic, shmring_magic, sizeof(shmring_magic));
+    return 0;
+}
+
+
+int shmring_write(ShmRing *ring, const char *data, size_t length) {
+    ShmRingHeader *header   = ring->header;
+    uint64_t       capacity = header->capacity;
+    uint64_t       size     = align8(sizeof(uint64_t) + length);
+
+    // Batches are one output buffer, half the ring always fits one after wrapping
+    if (size > capacity / 2) {
+        fprintf(stderr, "ERROR: Output batch is too large for shared memory ring <%s>\n", ring->name);
+        return -1;
+    }
+
+    uint64_t write_pos = header->write_pos;
+    uint64_t offset    = write_pos % capacity;
+    uint64_t skip      = (offset + size > capacity ? capacity - offset : 0);
+
+    // Wait for the consumer to release enough
+    while (true) {
+        uint32_t seq      = __atomic_load_n(&header->space_seq, __ATOMIC_SEQ_CST);
+        uint64_t read_pos = __atomic_load_n(&header->read_pos,  __ATOMIC_SEQ_CST);
+        if (write_pos + skip + size - read_pos <= capacity) { break; }
+
+        pid_t consumer = __atomic_load_n(&header->consumer_pid, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->detached, __ATOMIC_SEQ_CST) || (consumer > 0 && kill(consumer, 0) != 0 && errno == ESRCH)) {
+            fprintf(stderr, "ERROR: The consumer of shared memory ring <%s> went away\n", ring->name);
+            return -1;
+        }
+
+        struct timespec timeout = { 1, 0 };
+        __atomic_store_n(&header->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        read_pos = __atomic_load_n(&header->read_pos, __ATOMIC_SEQ_CST);
+        if (write_pos + skip + size - read_pos > capacity) { futex_wait(&header->space_seq, seq, &timeout); }
+        __atomic_store_n(&header->producer_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+
+    if (skip > 0) {
+        uint64_t wrap = SHMRING_WRAP;
+        memcpy(ring->data + offset, &wrap, sizeof(wrap));
+        write_pos += skip;
+        offset     = 0;
+    }
+
+    uint64_t batch_length = length;
+    memcpy(ring->data + offset, &batch_length, sizeof(batch_length));
+    memcpy(ring->data + offset + sizeof(batch_length), data, length);
+
+    // Publish, then only make the syscall if the consumer is asleep
+    __atomic_store_n(&header->write_pos, write_pos + size, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&header->data_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->consumer_waiting, __ATOMIC_SEQ_CST)) { futex_wake(&header->data_seq); }
+    return 0;
+}
+
+
+void shmring_close(ShmRing *ring) {
+    if (ring == NULL || ring->header == NULL) { return; }
+
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&ring->header->data_seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&ring->header->data_seq);
+
+    munmap(ring->header, ring->map_size);
+    free(ring->name);
+    memset(ring, 0, sizeof(ShmRing));
+}
+
+
+int shmring_attach(ShmRing *ring, const char *name) {
+    memset(ring, 0, sizeof(ShmRing));
+
+    char *path = shm_path(name);
+    ring->name = strdup(name);
+    if (path == NULL || ring->name == NULL) {
+        free(path);
+        free(ring->name);
+        return -1;
+    }
+
+    int fd = shm_open(path, O_RDWR, 0);
+    free(path);
+
+    // Until the producer has sized the object and written its magic, there's nothing to attach to yet
+    struct stat info;
+    int rtn = 0;
+    if (fd < 0 && errno == ENOENT) {
+        rtn = 1;
+    } else if (fd < 0 || fstat(fd, &info) != 0) {
+        rtn = -1;
+    } else if ((size_t)info.st_size < sizeof(ShmRingHeader)) {
+        rtn = 1;
+    } else if (map_ring(ring, fd, info.st_size) != 0) {
+        rtn = -1;
+    } else if (memcmp(ring->header->magic, "\0\0\0\0\0\0\0\0", sizeof(shmring_magic)) == 0) {
+        rtn = 1;
+    }
+    if (fd >= 0) { close(fd); }
+
+    if (rtn < 0) { fprintf(stderr, "ERROR: Failed to attach to shared memory ring <%s>: %s\n", name, strerror(errno)); }
+    if (rtn != 0) {
+        if (ring->header) { munmap(ring->header, ring->map_size); }
+        free(ring->name);
+        memset(ring, 0, sizeof(ShmRing));
+        return rtn;
+    }
+
+    ShmRingHeader *header = ring->header;
+    if (memcmp(header->magic, shmring_magic, sizeof(shmring_magic)) != 0 || header->version != SHMRING_VERSION
+    ||  header->header_size != sizeof(ShmRingHeader) || header->capacity != info.st_size - sizeof(ShmRingHeader)) {
+        fprintf(stderr, "ERROR: <%s> is not a shared memory ring this build can read\n", name);
+        shmring_detach(ring);
+        return -1;
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    __atomic_store_n(&header->consumer_pid, (int32_t)getpid(), __ATOMIC_SEQ_CST);
+    ring->read_end = header->read_pos;
+    return 0;
+}
+
+
+int64_t shmring_read(ShmRing *ring, const char **data) {
+    ShmRingHeader *header   = ring->header;
+    uint64_t       capacity = header->capacity;
+    uint64_t       read_pos = ring->read_end;
+
+    while (true) {
+        // Wait for the producer to publish something, or to finish
+        while (true) {
+            uint32_t seq = __atomic_load_n(&header->data_seq, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&header->write_pos, __ATOMIC_SEQ_CST) != read_pos) { break; }
+            if (__atomic_load_n(&header->closed, __ATOMIC_SEQ_CST)) { return 0; }
+
+            __atomic_store_n(&header->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&header->write_pos, __ATOMIC_SEQ_CST) == read_pos
+            && !__atomic_load_n(&header->closed, __ATOMIC_SEQ_CST)) {
+                futex_wait(&header->data_seq, seq, NULL);
+            }
+            __atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+        }
+
+        uint64_t offset = read_pos % capacity;
+        uint64_t length;
+        memcpy(&length, ring->data + offset, sizeof(length));
+
+        // The rest of the ring was skipped, the batch is at the start
+        if (length == SHMRING_WRAP) {
+            read_pos += capacity - offset;
+            ring->read_end = read_pos;
+            continue;
+        }
+
+        if (length > capacity - offset - sizeof(length)) {
+            fprintf(stderr, "ERROR: Shared memory ring <%s> is corrupt\n", ring->name);
+            return -1;
+        }
+
+        *data          = ring->data + offset + sizeof(length);
+        ring->read_end = read_pos + align8(sizeof(length) + length);
+        return (int64_t)length;
+    }
+}
+
+
+void shmring_release(ShmRing *ring) {
+    ShmRingHeader *header = ring->header;
+
+    __atomic_store_n(&header->read_pos, ring->read_end, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&header->space_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->producer_waiting, __ATOMIC_SEQ_CST)) { futex_wake(&header->space_seq); }
+}
+
+
+void shmring_detach(ShmRing *ring) {
+    if (ring == NULL || ring->header == NULL) { return; }
+
+    ShmRingHeader *header = ring->header;
+    bool finished = (__atomic_load_n(&header->closed, __ATOMIC_SEQ_CST)
+                  && __atomic_load_n(&header->read_pos, __ATOMIC_SEQ_CST) == __atomic_load_n(&header->write_pos, __ATOMIC_SEQ_CST));
+
+    char *path = (finished ? shm_path(ring->name) : NULL);
+    if (path) {
+        shm_unlink(path);
+        free(path);
+    }
+
+    // A producer waiting for room would otherwise wait forever
+    if (!finished) {
+        __atomic_store_n(&header->detached, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&header->space_seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&header->space_seq);
+    }
+
+    munmap(ring->header, ring->map_size);
+    free(ring->name);
+    memset(ring, 0, sizeof(ShmRing));
+}
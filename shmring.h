@@ -0,0 +1,107 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Shared memory rings for handing output to a consumer on the same host
+// This header and shmring.c are all a consumer needs, they don't depend on the rest of hcre
+
+// Bumped whenever the layout changes
+#define SHMRING_VERSION 1
+
+// Default and smallest ring sizes, a ring must hold at least two full output buffers
+#define SHMRING_MB     64
+#define SHMRING_MIN_MB 4
+
+
+// The mapped ring, the same layout on both sides
+// Batches are an 8 byte length followed by that many bytes of newline separated candidates, padded to 8 bytes
+// A batch that wouldn't fit before the end of the ring starts over at the beginning, after a SHMRING_WRAP length
+// The producer and consumer each keep to their own cache line, and sleep on a futex when they have to wait
+typedef struct ShmRingHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t capacity;
+    char     pad0[40];
+
+    // Producer side: bytes ever written, bumped on every batch and on close
+    uint64_t write_pos;
+    uint32_t data_seq;
+    uint32_t closed;
+    uint32_t consumer_waiting;
+    char     pad1[44];
+
+    // Consumer side: bytes ever released, bumped on every release and when the consumer gives up early
+    // The producer checks the consumer's pid now and then so a consumer that died doesn't leave it waiting
+    uint64_t read_pos;
+    uint32_t space_seq;
+    uint32_t producer_waiting;
+    uint32_t detached;
+    int32_t  consumer_pid;
+    char     pad2[40];
+} ShmRingHeader;
+
+#define SHMRING_WRAP UINT64_MAX
+
+
+// One side's view of a ring
+typedef struct ShmRing {
+    ShmRingHeader *header;
+    char          *data;
+    size_t         map_size;
+
+    // Name the ring was created or attached by, without the leading slash
+    char          *name;
+
+    // Consumer only: where the batch being read ends, so it can be released
+    uint64_t       read_end;
+} ShmRing;
+
+
+// Creates a ring of size bytes named name, replacing any ring left behind with that name
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int shmring_create(ShmRing *ring, const char *name, size_t size);
+
+// Copies length bytes of newline separated candidates into the ring as one batch, waiting for room if needed
+// Returns 0 on success, -1 on failure or if the consumer detached before reading everything (an error has already been printed)
+int shmring_write(ShmRing *ring, const char *data, size_t length);
+
+// Marks the end of output, wakes the consumer and unmaps the ring
+// The name is left for the consumer to remove once it has read everything
+void shmring_close(ShmRing *ring);
+
+
+// Attaches to a ring created by hcre
+// Returns 0 on success, 1 if it hasn't been created yet, -1 on failure (an error has already been printed)
+int shmring_attach(ShmRing *ring, const char *name);
+
+// Waits for the next batch and points *data at it in the ring, where it stays until shmring_release()
+// Returns the batch's length, 0 once the producer is done and everything has been read, -1 on failure
+int64_t shmring_read(ShmRing *ring, const char **data);
+
+// Gives the last batch's space back to the producer
+void shmring_release(ShmRing *ring);
+
+// Unmaps the ring, removing its name if everything in it was read, otherwise telling the producer to stop
+void shmring_detach(ShmRing *ring);
+
+
+// Steps through the candidates of a batch: sets *word and *length to the one at *pos and moves *pos past it
+// Returns false at the end of the batch
+static inline bool shmring_next_word(const char **pos, const char *end, const char **word, int *length) {
+    if (*pos >= end) { return false; }
+
+    const char *next = (const char *)memchr(*pos, '\n', end - *pos);
+    if (next == NULL) { next = end; }
+
+    *word   = *pos;
+    *length = (int)(next - *pos);
+    *pos    = next + 1;
+    return true;
+}
+
+#endif /* SHMRING_H */
@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "stream.h"
+
+
+// Rule lines shared by all workers, read one file after another
+typedef struct RuleStream {
+    char       **file_names;
+    int          file_count;
+    int          file_num;
+
+    // The file being read, its name for messages and the last line number read from it
+    FILE        *file;
+    const char  *file_name;
+    unsigned int line_num;
+    bool         finished;
+
+    // getline() buffer, only touched while holding lock
+    char        *line;
+    size_t       line_size;
+
+    pthread_mutex_t lock;
+} RuleStream;
+
+
+// A worker's private copy of some rule lines, stored back to back and NULL terminated
+typedef struct RuleLines {
+    char        *text;
+    size_t       size, capacity;
+
+    size_t       starts    [STREAM_BATCH_RULES];
+    int          lengths   [STREAM_BATCH_RULES];
+    unsigned int line_nums [STREAM_BATCH_RULES];
+    const char  *file_names[STREAM_BATCH_RULES];
+    int          count;
+} RuleLines;
+
+
+// State shared by all workers
+typedef struct Streamer {
+    const EngineConfig *config;
+    const WordBatch    *words;
+    OutputSet          *output;
+
+    RuleStream   rules;
+
+    // Every worker checks its rules against the same filter
+    DedupeFilter filter;
+    pthread_mutex_t filter_lock;
+
+    Topology     topology;
+
+    // Candidates any rule already produced are dropped, the last worker to finish writes out the deferred ones
+    SeenSet     *seen;
+    int          active;
+
+    // Set when a worker fails so the others stop early
+    int          failed;
+} Streamer;
+
+
+typedef struct StreamWorker {
+    Streamer   *streamer;
+    pthread_t   thread;
+
+    // CPU this worker is pinned to, -1 if not pinned
+    int         id, cpu;
+
+    StreamStats stats;
+    int         status;
+} StreamWorker;
+
+
+// Moves on to the next rule file, must be called with the stream locked
+// Returns 0 on success, -1 if the file couldn't be opened
+static int next_rule_file(RuleStream *stream) {
+    if (stream->file != NULL && stream->file != stdin) { fclose(stream->file); }
+    stream->file     = NULL;
+    stream->line_num = 0;
+
+    if (stream->file_num >= stream->file_count) {
+        stream->finished = true;
+        return 0;
+    }
+
+    const char *file_name = stream->file_names[stream->file_num++];
+    if (strcmp(file_name, "-") == 0) {
+        stream->file      = stdin;
+        stream->file_name = "STDIN";
+        return 0;
+    }
+
+    stream->file      = fopen(file_name, "r");
+    stream->file_name = file_name;
+    if (stream->file == NULL) {
+        fprintf(stderr, "ERROR: Failed to open input file <%s>\n", file_name);
+        stream->finished = true;
+        return -1;
+    }
+    return 0;
+}
+
+
+// Fills lines with the next non-blank, non-comment rule lines
+// Returns the number of lines read, 0 at the end of the last file, -1 on failure
+static int read_rules(RuleStream *stream, RuleLines *lines) {
+    lines->count = 0;
+    lines->size  = 0;
+
+    int rtn = 0;
+    pthread_mutex_lock(&stream->lock);
+
+    while (lines->count < STREAM_BATCH_RULES && !stream->finished) {
+        if (stream->file == NULL && next_rule_file(stream) != 0) { rtn = -1; break; }
+        if (stream->finished) { break; }
+
+        ssize_t line_len = getline(&stream->line, &stream->line_size, stream->file);
+        if (line_len < 0) {
+            // This file is done, the next pass opens the next one
+            if (stream->file != stdin) { fclose(stream->file); }
+            stream->file = NULL;
+            continue;
+        }
+        stream->line_num++;
+
+        // Trimmed and skipped exactly as ruleset_load() does
+        while (line_len > 0 && (stream->line[line_len - 1] == '\n' || stream->line[line_len - 1] == '\r')) {
+            stream->line[--line_len] = 0;
+        }
+        if (line_len == 0 || stream->line[0] == '#') { continue; }
+
+        if (lines->size + line_len + 1 > lines->capacity) {
+            size_t capacity = (lines->capacity ? lines->capacity : 4096);
+            while (lines->size + line_len + 1 > capacity) { capacity *= 2; }
+
+            char *text = (char *)realloc(lines->text, capacity);
+            if (text == NULL) { rtn = -1; break; }
+            lines->text     = text;
+            lines->capacity = capacity;
+        }
+
+        memcpy(lines->text + lines->size, stream->line, line_len + 1);
+        lines->starts    [lines->count] = lines->size;
+        lines->lengths   [lines->count] = line_len;
+        lines->line_nums [lines->count] = stream->line_num;
+        lines->file_names[lines->count] = stream->file_name;
+        lines->count++;
+        lines->size += line_len + 1;
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+    return (rtn < 0 ? -1 : lines->count);
+}
+
+
+// Writes out the deferred candidates the global set found to be new, and empties the batch
+static int write_accepted(StreamWorker *worker, SeenBatch *accepted, OutputBuffer *output) {
+    size_t position = 0;
+    int    length;
+    char  *word;
+    while ((word = seen_batch_next(accepted, &position, &length)) != NULL) {
+        // In debug mode, the candidate was checked along with its rule, which goes first
+        #ifdef DEBUG_OUTPUT
+        int prefix_length;
+        char *candidate = seen_debug_unpack(word, length, &prefix_length, &length);
+        output_buffer_append(output, word, prefix_length);
+        word = candidate;
+        #endif
+
+        if (output_buffer_record(output, word, length) != 0) { return -1; }
+        worker->stats.word_count++;
+    }
+    accepted->length = 0;
+    return 0;
+}
+
+
+// Applies one rule to every word
+// Returns 0 on success, -1 if output failed
+static int apply_to_words(StreamWorker *worker, Rule *cur_rule, OutputBuffer *output, SeenBatch *accepted,
+                          const RuleLines *lines, int line_num) {
+    SeenSet *seen = worker->streamer->seen;
+    const WordBatch *words = worker->streamer->words;
+
+    // Our mangled text ends up here
+    char rule_output[BLOCK_SIZE];
+
+    for (int word_num = 0; word_num < words->count; word_num++) {
+        const char *line     = words->words[word_num];
+        int         line_len = words->lengths[word_num];
+
+        int rule_rtn = apply_rule(cur_rule, line, line_len, rule_output);
+        if (rule_rtn < 0) {
+            if (rule_rtn == REJECTED) {
+                worker->stats.reject_count++;
+                continue;
+            }
+
+            // Same as the engine, a rule that breaks after parsing is removed
+            // It's only ours, so there's nobody else to tell
+            fprintf(stderr,
+                "Input word <%.*s> broke rule <%s> from file <%s>, line <%u> (parsed as <%s>): %s\n",
+                line_len, line,
+                lines->text + lines->starts[line_num], lines->file_names[line_num], lines->line_nums[line_num],
+                cur_rule->text, rule_output
+            );
+            return 0;
+        }
+
+        // An earlier candidate of any rule and word may be the same
+        if (seen) {
+            uint64_t hash = dedupe_hash(rule_output, rule_rtn);
+            #ifdef DEBUG_OUTPUT
+            char debug_text[cur_rule->length + BLOCK_SIZE + 2];
+            int  seen_rtn = seen_check(seen, hash, debug_text,
+                                       seen_debug_pack(debug_text, cur_rule->text, cur_rule->length, rule_output, rule_rtn), accepted);
+            #else
+            int seen_rtn = seen_check(seen, hash, rule_output, rule_rtn, accepted);
+            #endif
+            if (seen_rtn < 0 || (accepted->length > 0 && write_accepted(worker, accepted, output) != 0)) { return -1; }
+            if (seen_rtn != SEEN_NEW) { continue; }
+        }
+
+        // In debug mode, include the rule itself with the output
+        #ifdef DEBUG_OUTPUT
+        output_buffer_append(output, cur_rule->text, cur_rule->length);
+        output_buffer_append(output, "\t", 1);
+        #endif
+
+        if (output_buffer_record(output, rule_output, rule_rtn) != 0) { return -1; }
+        worker->stats.word_count++;
+    }
+
+    return 0;
+}
+
+
+static void *stream_worker(void *arg) {
+    StreamWorker *worker   = (StreamWorker *)arg;
+    Streamer     *streamer = worker->streamer;
+
+    // Pin before allocating anything so our buffers end up on our NUMA node
+    if (worker->cpu >= 0 && topology_pin_thread(worker->cpu) != 0) {
+        fprintf(stderr, "WARNING: Failed to pin worker %d to CPU %d\n", worker->id, worker->cpu);
+    }
+
+    RuleLines    lines;
+    OutputBuffer output;
+    SeenBatch    accepted;
+    memset(&lines,    0, sizeof(RuleLines));
+    memset(&output,   0, sizeof(OutputBuffer));
+    memset(&accepted, 0, sizeof(SeenBatch));
+    if (output_buffer_init(&output, streamer->output->worker_sinks[worker->id]) != 0) {
+        fprintf(stderr, "ERROR: Worker %d failed to allocate buffers\n", worker->id);
+        __atomic_store_n(&streamer->failed, 1, __ATOMIC_RELAXED);
+        worker->status = -1;
+        return NULL;
+    }
+
+    // Output for parse_rule()
+    Rule *cur_rule = NULL;
+
+    while (worker->status == 0 && !__atomic_load_n(&streamer->failed, __ATOMIC_RELAXED)) {
+        int line_count = read_rules(&streamer->rules, &lines);
+        if (line_count <  0) { worker->status = -1; break; }
+        if (line_count == 0) { break; }
+
+        for (int line_num = 0; line_num < line_count; line_num++) {
+            char *line = lines.text + lines.starts[line_num];
+
+            #ifdef DEBUG_PARSING
+            fprintf(stderr, "Before Parsing: %s (Length: %d)\n", line, (int)strlen(line));
+            #endif
+
+            if (parse_rule(line, lines.lengths[line_num], &cur_rule) < 0) {
+                fprintf(
+                    stderr, "File: <%s>; Line: <%u>; Rule: <%s>; Error: %s\n",
+                    lines.file_names[line_num], lines.line_nums[line_num], line, cur_rule->text
+                );
+                worker->stats.error_count++;
+                continue;
+            }
+
+            #ifdef DEBUG_PARSING
+            fprintf(stderr, "After  Parsing: %s (Length: %d)\n", cur_rule->text, (int)cur_rule->length);
+            fprintf(stderr, "\n");
+            #endif
+
+            uint64_t hash = dedupe_hash(cur_rule->text, cur_rule->length);
+            pthread_mutex_lock(&streamer->filter_lock);
+            bool seen = dedupe_filter_check(&streamer->filter, hash);
+            pthread_mutex_unlock(&streamer->filter_lock);
+
+            if (seen) {
+                // The filter only remembers hashes, so there's no telling where the original was
+                #ifdef DEBUG_DUPES
+                fprintf(
+                    stderr, "File: <%s>; Line: <%u>; Rule: <%s>; Duplicate of an earlier rule\n",
+                    lines.file_names[line_num], lines.line_nums[line_num], line
+                );
+                #endif
+
+                worker->stats.dupe_count++;
+                continue;
+            }
+
+            worker->stats.rule_count++;
+            if (apply_to_words(worker, cur_rule, &output, &accepted, &lines, line_num) != 0) {
+                worker->status = -1;
+                break;
+            }
+        }
+    }
+
+    // Once every other worker is done, nothing can be deferred any more and whatever is left is written out
+    if (streamer->seen && __atomic_sub_fetch(&streamer->active, 1, __ATOMIC_ACQ_REL) == 0
+    &&  worker->status == 0 && !__atomic_load_n(&streamer->failed, __ATOMIC_RELAXED)) {
+        if (seen_finish(streamer->seen, &accepted) != 0 || write_accepted(worker, &accepted, &output) != 0) { worker->status = -1; }
+    }
+
+    if (output_buffer_free(&output) != 0) { worker->status = -1; }
+    seen_batch_free(&accepted);
+    if (cur_rule) { free_rule(cur_rule); free(cur_rule); }
+    if (lines.text) { free(lines.text); }
+
+    if (worker->status != 0) { __atomic_store_n(&streamer->failed, 1, __ATOMIC_RELAXED); }
+    return NULL;
+}
+
+
+int stream_run(const EngineConfig *config, const WordBatch *words, char **rule_files, int rule_file_count,
+               size_t filter_mb, SeenSet *seen, OutputSet *output, StreamStats *stats) {
+    static char *stdin_only[] = { "-" };
+
+    Streamer streamer;
+    memset(&streamer, 0, sizeof(Streamer));
+    memset(stats,     0, sizeof(StreamStats));
+    streamer.config           = config;
+    streamer.words            = words;
+    streamer.output           = output;
+    streamer.seen             = seen;
+    streamer.active           = config->thread_count;
+    streamer.rules.file_names = (rule_file_count > 0 ? rule_files      : stdin_only);
+    streamer.rules.file_count = (rule_file_count > 0 ? rule_file_count : 1);
+
+    if (dedupe_filter_init(&streamer.filter, filter_mb * 1024 * 1024) != 0) {
+        fprintf(stderr, "ERROR: Failed to allocate a %zuMB duplicate rule filter\n", filter_mb);
+        return -1;
+    }
+
+    StreamWorker *workers = (StreamWorker *)calloc(config->thread_count, sizeof(StreamWorker));
+    if (workers == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate workers\n");
+        dedupe_filter_free(&streamer.filter);
+        return -1;
+    }
+
+    pthread_mutex_init(&streamer.rules.lock,  NULL);
+    pthread_mutex_init(&streamer.filter_lock, NULL);
+
+    // Pinned the same way as engine_run(), a single worker is left wherever the scheduler puts it
+    bool pin_threads = config->pin_threads && config->thread_count > 1 && topology_detect(&streamer.topology) == 0;
+
+    int started = 0;
+    for (int worker_num = 0; worker_num < config->thread_count; worker_num++) {
+        StreamWorker *worker = &workers[worker_num];
+        worker->streamer = &streamer;
+        worker->id       = worker_num;
+        worker->cpu      = (pin_threads ? streamer.topology.cpus[worker_num % streamer.topology.cpu_count] : -1);
+
+        if (pthread_create(&worker->thread, NULL, stream_worker, worker) != 0) {
+            fprintf(stderr, "ERROR: Failed to start worker %d\n", worker_num);
+            __atomic_store_n(&streamer.failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        started++;
+    }
+
+    for (int worker_num = 0; worker_num < started; worker_num++) {
+        pthread_join(workers[worker_num].thread, NULL);
+
+        StreamStats *worker_stats = &workers[worker_num].stats;
+        stats->word_count   += worker_stats->word_count;
+        stats->reject_count += worker_stats->reject_count;
+        stats->rule_count   += worker_stats->rule_count;
+        stats->error_count  += worker_stats->error_count;
+        stats->dupe_count   += worker_stats->dupe_count;
+    }
+    stats->forgotten_count = streamer.filter.evictions;
+
+
+    if (streamer.rules.file != NULL && streamer.rules.file != stdin) { fclose(streamer.rules.file); }
+    if (streamer.rules.line) { free(streamer.rules.line); }
+    pthread_mutex_destroy(&streamer.rules.lock);
+    pthread_mutex_destroy(&streamer.filter_lock);
+    dedupe_filter_free(&streamer.filter);
+    topology_free(&streamer.topology);
+    free(workers);
+
+    return (streamer.failed ? -1 : 0);
+}
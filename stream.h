@@ -0,0 +1,41 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "engine.h"
+#include "dedupe.h"
+
+// Rule lines a worker takes from the rule stream at a time
+#define STREAM_BATCH_RULES 64
+
+// Default size of the duplicate rule filter, in MB
+#define STREAM_FILTER_MB 64
+
+
+// Totals from a streaming run
+typedef struct StreamStats {
+    unsigned long int word_count;
+    unsigned long int reject_count;
+
+    unsigned long int rule_count;
+    unsigned long int error_count;
+    unsigned long int dupe_count;
+
+    // Rules the duplicate filter had to forget to make room, later copies of them weren't caught
+    unsigned long int forgotten_count;
+} StreamStats;
+
+
+// Applies every rule from a stream of rule files to every word in words
+// This is the inverse of engine_run(): words are held in memory and rules are read as they're needed,
+// so memory use doesn't depend on how many rules there are
+//   rule_files - Read in order, "-" is stdin, no files at all also means stdin
+//   filter_mb  - Size of the filter used to drop duplicate rules
+//   seen       - Drops candidates that were already written, if not NULL
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int stream_run(const EngineConfig *config, const WordBatch *words, char **rule_files, int rule_file_count,
+               size_t filter_mb, SeenSet *seen, OutputSet *output, StreamStats *stats);
+
+#endif /* STREAM_H */
@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include "topology.h"
+
+
+// Finds the NUMA node of a CPU by looking for a "nodeN" entry in its sysfs directory
+// Machines without NUMA (or without sysfs) report everything as node 0
+static int cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) { return 0; }
+
+    int node = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) { break; }
+        node = 0;
+    }
+
+    closedir(dir);
+    return node;
+}
+
+
+int topology_detect(Topology *topology) {
+    memset(topology, 0, sizeof(Topology));
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) { return -1; }
+
+    int cpu_count = CPU_COUNT(&allowed);
+    if (cpu_count < 1) { return -1; }
+
+    topology->cpus  = (int *)calloc(cpu_count, sizeof(int));
+    topology->nodes = (int *)calloc(cpu_count, sizeof(int));
+    if (topology->cpus == NULL || topology->nodes == NULL) {
+        topology_free(topology);
+        return -1;
+    }
+
+    topology->node_count = 1;
+    for (int cpu = 0; cpu < CPU_SETSIZE && topology->cpu_count < cpu_count; cpu++) {
+        if ( !CPU_ISSET(cpu, &allowed) ) { continue; }
+
+        int node = cpu_node(cpu);
+        topology->cpus [topology->cpu_count] = cpu;
+        topology->nodes[topology->cpu_count] = node;
+        topology->cpu_count++;
+
+        if (node >= topology->node_count) { topology->node_count = node + 1; }
+    }
+
+    return 0;
+}
+
+
+void topology_free(Topology *topology) {
+    if (topology == NULL) { return; }
+    if (topology->cpus ) { free(topology->cpus);  }
+    if (topology->nodes) { free(topology->nodes); }
+    memset(topology, 0, sizeof(Topology));
+}
+
+
+int topology_pin_thread(int cpu) {
+    cpu_set_t target;
+    CPU_ZERO(&target);
+    CPU_SET(cpu, &target);
+
+    return (pthread_setaffinity_np(pthread_self(), sizeof(target), &target) == 0 ? 0 : -1);
+}
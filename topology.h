@@ -0,0 +1,30 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdbool.h>
+
+
+// The CPUs we're allowed to run on and the NUMA node each one belongs to
+// Nodes are read from sysfs so we don't need libnuma at build or run time
+typedef struct Topology {
+    int *cpus;
+    int *nodes;
+    int  cpu_count;
+
+    // Highest node number + 1, always at least 1
+    int  node_count;
+} Topology;
+
+
+// Fills in topology from the process affinity mask and sysfs
+// Returns 0 on success, -1 on failure
+int topology_detect(Topology *topology);
+
+// Frees the members of a topology structure
+void topology_free(Topology *topology);
+
+// Pins the calling thread to a single CPU
+// Returns 0 on success, -1 on failure
+int topology_pin_thread(int cpu);
+
+#endif /* TOPOLOGY_H */
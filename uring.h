@@ -0,0 +1,47 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// linux/io_uring.h pulls in linux/fs.h, whose BLOCK_SIZE would replace the one from rules.h
+#pragma push_macro("BLOCK_SIZE")
+#include <linux/io_uring.h>
+#pragma pop_macro("BLOCK_SIZE")
+
+
+// A minimal io_uring for queueing writes, set up with raw syscalls so we don't need liburing at build or run time
+typedef struct URing {
+    int fd;
+    unsigned entries;
+
+    // Submission queue: the kernel takes entries from head, we add them at tail
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+
+    // Completion queue: the kernel adds completions at tail, we take them from head
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void  *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} URing;
+
+
+// Sets up a ring that can hold entries writes at once
+// Returns 0 on success, 1 if the kernel doesn't offer io_uring (or won't let us have it), -1 on failure
+int uring_init(URing *ring, unsigned entries);
+
+// Tears down a ring, anything still in flight is left to finish on its own
+void uring_free(URing *ring);
+
+// Submits a write of length bytes at offset, tagged with id
+// The caller must not have more than entries writes in flight
+// Returns 0 on success, -1 on failure
+int uring_write(URing *ring, int fd, const void *data, unsigned length, uint64_t offset, uint64_t id);
+
+// Waits for the next write to complete, setting *id to its tag and *result to bytes written or -errno
+// Returns 0 on success, -1 on failure
+int uring_wait(URing *ring, uint64_t *id, int *result);
+
+#endif /* URING_H */
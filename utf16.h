@@ -0,0 +1,77 @@
+#ifndef UTF16_H
+#define UTF16_H
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// UTF-16LE encoding of candidates, for consumers that hash that rather than the bytes hcre produces
+
+
+// Decodes the UTF-8 sequence at text, setting *code_point, or returns 0 if it isn't a valid, shortest form sequence
+// Returns the number of bytes the sequence takes
+static inline int utf8_decode(const unsigned char *text, int length, uint32_t *code_point) {
+    unsigned char lead = text[0];
+    int      size;
+    uint32_t value, min;
+    if      (lead >= 0xc2 && lead <= 0xdf) { size = 2; value = lead & 0x1f; min = 0x80;    }
+    else if (lead >= 0xe0 && lead <= 0xef) { size = 3; value = lead & 0x0f; min = 0x800;   }
+    else if (lead >= 0xf0 && lead <= 0xf4) { size = 4; value = lead & 0x07; min = 0x10000; }
+    else { return 0; }
+
+    if (size > length) { return 0; }
+    for (int pos = 1; pos < size; pos++) {
+        if ((text[pos] & 0xc0) != 0x80) { return 0; }
+        value = value << 6 | (text[pos] & 0x3f);
+    }
+
+    // Overlong forms, surrogates and anything past the last plane aren't characters
+    if (value < min || (value >= 0xd800 && value <= 0xdfff) || value > 0x10ffff) { return 0; }
+    *code_point = value;
+    return size;
+}
+
+
+// Writes word as UTF-16LE into dst, which holds at least length * 2 bytes
+// Runs of ASCII are widened 16 bytes at a time, UTF-8 is decoded, and bytes that aren't valid UTF-8 are taken as Latin-1
+// Returns the encoded length in bytes
+static inline int utf16_widen(char *dst, const char *word, int length) {
+    const unsigned char *text = (const unsigned char *)word;
+    unsigned char       *out  = (unsigned char *)dst;
+
+    int pos = 0;
+    while (pos < length) {
+        #ifdef __SSE2__
+        if (pos + 16 <= length) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(text + pos));
+            if (_mm_movemask_epi8(bytes) == 0) {
+                _mm_storeu_si128((__m128i *)out,        _mm_unpacklo_epi8(bytes, _mm_setzero_si128()));
+                _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(bytes, _mm_setzero_si128()));
+                out += 32;
+                pos += 16;
+                continue;
+            }
+        }
+        #endif
+
+        uint32_t code_point = text[pos];
+        int      size       = (code_point < 0x80 ? 1 : utf8_decode(text + pos, length - pos, &code_point));
+        if (size == 0) { size = 1; }
+        pos += size;
+
+        if (code_point >= 0x10000) {
+            uint32_t high = 0xd800 + ((code_point - 0x10000) >> 10);
+            uint32_t low  = 0xdc00 + ((code_point - 0x10000) & 0x3ff);
+            *out++ = high & 0xff; *out++ = high >> 8;
+            *out++ = low  & 0xff; *out++ = low  >> 8;
+        } else {
+            *out++ = code_point & 0xff;
+            *out++ = code_point >> 8;
+        }
+    }
+    return (int)((char *)out - dst);
+}
+
+#endif /* UTF16_H */
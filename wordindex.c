@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "wordindex.h"
+#include "wordpack.h"
+#include "decompress.h"
+#include "hex.h"
+
+// Same scheme as compiled rule files and packed wordlists
+static const char wordindex_magic[8] = { '\x89', 'H', 'C', 'R', 'I', '\r', '\n', '\x1a' };
+#define WORDINDEX_BYTE_ORDER 0x01020304u
+
+
+// Followed by entry_count offsets, entry n being where word n * stride starts
+// The wordlist's size and modification time tell whether the index still matches it
+typedef struct IndexHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t stride;
+    uint32_t reserved;
+
+    uint64_t word_count;
+    uint64_t entry_count;
+
+    uint64_t file_size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+} IndexHeader;
+
+
+// A slice of the wordlist starting at the beginning of a line and ending after a newline, or at the end of the file
+typedef struct IndexJob {
+    pthread_t   thread;
+    const char *data;
+    size_t      start, end;
+
+    // Counted on the first pass, the slice's first word number is known on the second
+    uint64_t    word_count;
+    uint64_t    first_word;
+
+    // Entries are only recorded on the second pass
+    uint64_t   *entries;
+} IndexJob;
+
+
+// Counts the slice's words, recording where every stride-th word of the whole wordlist starts once entries is set
+// Lines are split the same way read_source() splits them: a trailing carriage return is trimmed and blank lines skipped,
+// along with $HEX[] since it decodes to nothing
+static void *index_thread(void *arg) {
+    IndexJob   *job  = (IndexJob *)arg;
+    const char *data = job->data;
+
+    uint64_t word = job->first_word;
+    size_t   pos  = job->start;
+    while (pos < job->end) {
+        const char *next     = (const char *)memchr(data + pos, '\n', job->end - pos);
+        size_t      line_end = (next ? (size_t)(next - data) : job->end);
+
+        size_t line_len = line_end - pos;
+        if (line_len > 0 && data[line_end - 1] == '\r') { line_len--; }
+
+        bool empty_hex = (line_len == HEX_PREFIX_LEN + 1 && memcmp(data + pos, HEX_PREFIX "]", HEX_PREFIX_LEN + 1) == 0);
+        if (line_len > 0 && !empty_hex) {
+            if (job->entries && word % WORDINDEX_STRIDE == 0) { job->entries[word / WORDINDEX_STRIDE] = pos; }
+            word++;
+        }
+        pos = line_end + 1;
+    }
+
+    job->word_count = word - job->first_word;
+    return NULL;
+}
+
+
+// Runs index_thread() on every job, the last one here along with any whose thread doesn't start
+static void run_jobs(IndexJob *jobs, int job_count) {
+    int started = 0;
+    for (int job_num = 0; job_num < job_count - 1; job_num++) {
+        if (pthread_create(&jobs[job_num].thread, NULL, index_thread, &jobs[job_num]) != 0) { break; }
+        started++;
+    }
+    for (int job_num = started; job_num < job_count; job_num++) { index_thread(&jobs[job_num]); }
+    for (int job_num = 0; job_num < started; job_num++) { pthread_join(jobs[job_num].thread, NULL); }
+}
+
+
+// Writes the header and entries under a temporary name, then moves it into place
+static int write_index(const char *index_name, const IndexHeader *header, const uint64_t *entries) {
+    char *temp_name = NULL;
+    if (asprintf(&temp_name, "%s.%d.tmp", index_name, (int)getpid()) < 0) { return -1; }
+
+    FILE *index_file = fopen(temp_name, "wb");
+    if (index_file == NULL) {
+        fprintf(stderr, "ERROR: Failed to open index <%s>\n", temp_name);
+        free(temp_name);
+        return -1;
+    }
+
+    int rtn = 0;
+    if (fwrite(header, sizeof(IndexHeader), 1, index_file) != 1
+    ||  fwrite(entries, sizeof(uint64_t), header->entry_count, index_file) != header->entry_count) {
+        rtn = -1;
+    }
+    if (fclose(index_file) != 0) { rtn = -1; }
+    if (rtn == 0 && rename(temp_name, index_name) != 0) { rtn = -1; }
+
+    if (rtn != 0) {
+        fprintf(stderr, "ERROR: Failed to write index <%s>\n", index_name);
+        unlink(temp_name);
+    }
+    free(temp_name);
+    return rtn;
+}
+
+
+int wordindex_build(const char *file_name, int thread_count) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Failed to open wordlist <%s>\n", file_name);
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        fprintf(stderr, "ERROR: Wordlist <%s> is not a regular file and can't be indexed\n", file_name);
+        close(fd);
+        return -1;
+    }
+
+    size_t      size = info.st_size;
+    const char *data = NULL;
+    if (size > 0) {
+        void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            fprintf(stderr, "ERROR: Failed to map wordlist <%s>\n", file_name);
+            close(fd);
+            return -1;
+        }
+        madvise(mapping, size, MADV_WILLNEED);
+        data = (const char *)mapping;
+    }
+    close(fd);
+
+    int rtn = 0;
+    if (wordpack_detect(data, size)) {
+        fprintf(stderr, "ERROR: Wordlist <%s> is packed, it can be skipped through without an index\n", file_name);
+        rtn = -1;
+    } else if (decompress_detect(data, size) != COMPRESSION_NONE) {
+        fprintf(stderr, "ERROR: Wordlist <%s> is compressed and can't be indexed\n", file_name);
+        rtn = -1;
+    }
+
+    // Tiny files aren't worth a thread each
+    if (thread_count < 1) { thread_count = 1; }
+    if ((size_t)thread_count > size / (1024 * 1024) + 1) { thread_count = size / (1024 * 1024) + 1; }
+
+    IndexJob *jobs = (IndexJob *)calloc(thread_count, sizeof(IndexJob));
+    if (rtn == 0 && jobs == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate index\n");
+        rtn = -1;
+    }
+
+    // Every slice after the first starts on the line after its even share's boundary
+    for (int job_num = 0; job_num < thread_count && rtn == 0; job_num++) {
+        IndexJob *job = &jobs[job_num];
+        job->data  = data;
+        job->start = (job_num > 0 ? jobs[job_num - 1].end : 0);
+        job->end   = size;
+
+        size_t boundary = size / thread_count * (job_num + 1);
+        if (job_num < thread_count - 1 && boundary > job->start) {
+            const char *next = (const char *)memchr(data + boundary - 1, '\n', size - boundary + 1);
+            job->end = (next ? (size_t)(next - data) + 1 : size);
+        } else if (job_num < thread_count - 1) {
+            job->end = job->start;
+        }
+    }
+
+    // Every slice is counted, then scanned again knowing its first word number
+    uint64_t *entries = NULL;
+    IndexHeader header;
+    memset(&header, 0, sizeof(IndexHeader));
+
+    if (rtn == 0) {
+        run_jobs(jobs, thread_count);
+
+        for (int job_num = 0; job_num < thread_count; job_num++) {
+            jobs[job_num].first_word = header.word_count;
+            header.word_count       += jobs[job_num].word_count;
+        }
+        header.entry_count = (header.word_count + WORDINDEX_STRIDE - 1) / WORDINDEX_STRIDE;
+
+        entries = (uint64_t *)calloc(header.entry_count + 1, sizeof(uint64_t));
+        if (entries == NULL) {
+            fprintf(stderr, "ERROR: Failed to allocate index\n");
+            rtn = -1;
+        }
+    }
+
+    if (rtn == 0) {
+        for (int job_num = 0; job_num < thread_count; job_num++) { jobs[job_num].entries = entries; }
+        run_jobs(jobs, thread_count);
+
+        memcpy(header.magic, wordindex_magic, sizeof(header.magic));
+        header.version    = WORDINDEX_VERSION;
+        header.byte_order = WORDINDEX_BYTE_ORDER;
+        header.stride     = WORDINDEX_STRIDE;
+        header.file_size  = size;
+        header.mtime_sec  = info.st_mtim.tv_sec;
+        header.mtime_nsec = info.st_mtim.tv_nsec;
+
+        char *index_name = NULL;
+        if (asprintf(&index_name, "%s%s", file_name, WORDINDEX_SUFFIX) < 0) {
+            rtn = -1;
+        } else {
+            rtn = write_index(index_name, &header, entries);
+            free(index_name);
+        }
+    }
+
+    #ifdef DEBUG_STATS
+    if (rtn == 0) {
+        fprintf(stderr, "Indexed %lu words of <%s> with %lu entries\n",
+                (unsigned long)header.word_count, file_name, (unsigned long)header.entry_count);
+    }
+    #endif
+
+    free(entries);
+    free(jobs);
+    if (data) { munmap((void *)data, size); }
+    return rtn;
+}
+
+
+int wordindex_lookup(const char *file_name, int fd, uint64_t word, uint64_t *offset, uint64_t *index) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) { return -1; }
+
+    char *index_name = NULL;
+    if (asprintf(&index_name, "%s%s", file_name, WORDINDEX_SUFFIX) < 0) { return -1; }
+
+    int index_fd = open(index_name, O_RDONLY);
+    free(index_name);
+    if (index_fd < 0) { return 1; }
+
+    IndexHeader header;
+    int rtn = 0;
+    if (pread(index_fd, &header, sizeof(IndexHeader), 0) != (ssize_t)sizeof(IndexHeader)
+    ||  memcmp(header.magic, wordindex_magic, sizeof(header.magic)) != 0
+    ||  header.version != WORDINDEX_VERSION || header.byte_order != WORDINDEX_BYTE_ORDER
+    ||  header.stride == 0 || header.entry_count != (header.word_count + header.stride - 1) / header.stride) {
+        fprintf(stderr, "WARNING: Index of wordlist <%s> is unreadable, ignoring it\n", file_name);
+        rtn = 1;
+    } else if (header.file_size != (uint64_t)info.st_size
+           ||  header.mtime_sec  != info.st_mtim.tv_sec || header.mtime_nsec != info.st_mtim.tv_nsec) {
+        fprintf(stderr, "WARNING: Index of wordlist <%s> is out of date, ignoring it\n", file_name);
+        rtn = 1;
+    }
+
+    // Past the last word, there's nothing left to read
+    if (rtn == 0 && word >= header.word_count) {
+        *offset = header.file_size;
+        *index  = header.word_count;
+    } else if (rtn == 0) {
+        uint64_t entry_num = word / header.stride;
+        uint64_t entry;
+        if (pread(index_fd, &entry, sizeof(entry), sizeof(IndexHeader) + entry_num * sizeof(entry)) != (ssize_t)sizeof(entry)
+        ||  entry >= header.file_size) {
+            fprintf(stderr, "WARNING: Index of wordlist <%s> is unreadable, ignoring it\n", file_name);
+            rtn = 1;
+        } else {
+            *offset = entry;
+            *index  = entry_num * header.stride;
+        }
+    }
+
+    close(index_fd);
+    return rtn;
+}
@@ -0,0 +1,26 @@
+#ifndef WORDINDEX_H
+#define WORDINDEX_H
+
+#include <stdint.h>
+
+// Bumped whenever the layout changes
+#define WORDINDEX_VERSION 1
+
+// The offset of every this many words is recorded, skipping to any word scans at most this many lines
+#define WORDINDEX_STRIDE 1024
+
+// An index is kept next to its wordlist, named after it with this added
+#define WORDINDEX_SUFFIX ".hcri"
+
+
+// Builds the index for a wordlist, splitting the work between thread_count threads
+// Words are counted exactly as the input reader splits them
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int wordindex_build(const char *file_name, int thread_count);
+
+// Looks up the closest indexed word at or before word in the wordlist open as fd
+// Sets *offset to where that word starts and *index to its number, which is word_count if word is past the end
+// Returns 0 on success, 1 if there's no index or it's out of date, -1 on failure
+int wordindex_lookup(const char *file_name, int fd, uint64_t word, uint64_t *offset, uint64_t *index);
+
+#endif /* WORDINDEX_H */
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "wordpack.h"
+#include "input.h"
+
+// Sections start on a cache line, and slots are aligned to their own size within them
+#define WORDPACK_ALIGN 64
+
+// Same scheme as compiled rule files
+static const char wordpack_magic[8] = { '\x89', 'H', 'C', 'R', 'W', '\r', '\n', '\x1a' };
+#define WORDPACK_BYTE_ORDER 0x01020304u
+
+
+typedef struct PackBucketHeader {
+    uint64_t count;
+    uint64_t slots_offset, lengths_offset, classes_offset;
+    uint32_t slot_size;
+    uint32_t reserved;
+} PackBucketHeader;
+
+
+// Everything after the header is found through its offsets
+typedef struct PackHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t block_size;
+    uint32_t bucket_count;
+
+    uint64_t word_count;
+    uint64_t file_size;
+
+    PackBucketHeader buckets[WORDPACK_BUCKETS];
+} PackHeader;
+
+
+static inline uint64_t align_up(uint64_t value) {
+    return (value + WORDPACK_ALIGN - 1) & ~(uint64_t)(WORDPACK_ALIGN - 1);
+}
+
+
+static uint32_t slot_size(int bucket_num) {
+    if (bucket_num == WORDPACK_BUCKETS - 1) { return BLOCK_SIZE; }
+    return ((8u << bucket_num) < BLOCK_SIZE ? (8u << bucket_num) : BLOCK_SIZE);
+}
+
+
+bool wordpack_detect(const char *data, size_t size) {
+    return (size >= sizeof(wordpack_magic) && memcmp(data, wordpack_magic, sizeof(wordpack_magic)) == 0);
+}
+
+
+int wordpack_parse(WordPack *pack, const char *data, size_t size) {
+    memset(pack, 0, sizeof(WordPack));
+
+    PackHeader header;
+    if (size < sizeof(PackHeader)) {
+        fprintf(stderr, "ERROR: Packed wordlist is truncated\n");
+        return -1;
+    }
+    memcpy(&header, data, sizeof(PackHeader));
+
+    if (header.version != WORDPACK_VERSION || header.byte_order != WORDPACK_BYTE_ORDER
+    ||  header.block_size != BLOCK_SIZE    || header.bucket_count != WORDPACK_BUCKETS) {
+        fprintf(stderr, "ERROR: Packed wordlist was written by an incompatible build\n");
+        return -1;
+    }
+
+    if (header.file_size > size) {
+        fprintf(stderr, "ERROR: Packed wordlist is truncated\n");
+        return -1;
+    }
+
+    uint64_t word_count = 0;
+    for (int bucket_num = 0; bucket_num < WORDPACK_BUCKETS; bucket_num++) {
+        PackBucketHeader *bucket = &header.buckets[bucket_num];
+
+        // Checked piece by piece so a corrupt count can't overflow its way past the end
+        if (bucket->slot_size != slot_size(bucket_num)
+        ||  bucket->count > header.file_size / bucket->slot_size
+        ||  bucket->slots_offset   > header.file_size - bucket->count * bucket->slot_size
+        ||  bucket->lengths_offset > header.file_size - bucket->count
+        ||  bucket->classes_offset > header.file_size - bucket->count) {
+            fprintf(stderr, "ERROR: Packed wordlist is corrupt\n");
+            return -1;
+        }
+
+        pack->buckets[bucket_num].slots     = data + bucket->slots_offset;
+        pack->buckets[bucket_num].lengths   = (const uint8_t *)data + bucket->lengths_offset;
+        pack->buckets[bucket_num].classes   = (const uint8_t *)data + bucket->classes_offset;
+        pack->buckets[bucket_num].count     = bucket->count;
+        pack->buckets[bucket_num].slot_size = bucket->slot_size;
+        word_count += bucket->count;
+    }
+
+    if (word_count != header.word_count) {
+        fprintf(stderr, "ERROR: Packed wordlist is corrupt\n");
+        return -1;
+    }
+
+    pack->word_count = word_count;
+    return 0;
+}
+
+
+uint8_t wordpack_classes(const char *word, int length) {
+    uint8_t classes = 0;
+    for (int pos = 0; pos < length; pos++) {
+        unsigned char c = word[pos];
+
+        if      (c >= 'a' && c <= 'z') { classes |= WORD_CLASS_LOWER;   }
+        else if (c >= 'A' && c <= 'Z') { classes |= WORD_CLASS_UPPER;   }
+        else if (c >= '0' && c <= '9') { classes |= WORD_CLASS_DIGIT;   }
+        else if (c >= 0x80)            { classes |= WORD_CLASS_HIGH;    }
+        else if (c < 0x20 || c == 0x7f){ classes |= WORD_CLASS_CONTROL; }
+        else                           { classes |= WORD_CLASS_SPECIAL; }
+    }
+    return classes;
+}
+
+
+// Pads the file out to the next section boundary after a section of size bytes
+static int write_padding(FILE *pack_file, uint64_t size) {
+    static const char padding[WORDPACK_ALIGN] = { 0 };
+
+    size_t pad = align_up(size) - size;
+    if (pad > 0 && fwrite(padding, 1, pad, pack_file) != pad) { return -1; }
+    return 0;
+}
+
+
+// Copies a temporary file to the pack, taking every stride-th byte starting at first, or all of it for a stride of 1
+static int copy_section(FILE *pack_file, FILE *temp_file, int first, int stride) {
+    char buffer[64 * 1024];
+    char picked[sizeof(buffer)];
+
+    rewind(temp_file);
+
+    uint64_t written = 0;
+    size_t   bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), temp_file)) > 0) {
+        const char *data  = buffer;
+        size_t      count = bytes;
+
+        // Temporary files hold whole records and the buffer holds a whole number of them
+        if (stride > 1) {
+            count = 0;
+            for (size_t pos = first; pos < bytes; pos += stride) { picked[count++] = buffer[pos]; }
+            data = picked;
+        }
+
+        if (fwrite(data, 1, count, pack_file) != count) { return -1; }
+        written += count;
+    }
+
+    if (ferror(temp_file)) { return -1; }
+    return write_padding(pack_file, written);
+}
+
+
+int wordpack_write(struct WordReader *input, const char *file_name) {
+    PackHeader header;
+    memset(&header, 0, sizeof(PackHeader));
+    memcpy(header.magic, wordpack_magic, sizeof(header.magic));
+    header.version      = WORDPACK_VERSION;
+    header.byte_order   = WORDPACK_BYTE_ORDER;
+    header.block_size   = BLOCK_SIZE;
+    header.bucket_count = WORDPACK_BUCKETS;
+
+    // Buckets are only laid out once every word has been counted, until then they're spilled to
+    // temporary files: one of slots, one of length and classes pairs
+    FILE *slot_files[WORDPACK_BUCKETS] = { NULL };
+    FILE *info_files[WORDPACK_BUCKETS] = { NULL };
+
+    int rtn = 0;
+    for (int bucket_num = 0; bucket_num < WORDPACK_BUCKETS && rtn == 0; bucket_num++) {
+        header.buckets[bucket_num].slot_size = slot_size(bucket_num);
+        slot_files[bucket_num] = tmpfile();
+        info_files[bucket_num] = tmpfile();
+        if (slot_files[bucket_num] == NULL || info_files[bucket_num] == NULL) {
+            fprintf(stderr, "ERROR: Failed to create a temporary file\n");
+            rtn = -1;
+        }
+    }
+
+    WordBatch batch;
+    memset(&batch, 0, sizeof(WordBatch));
+    if (rtn == 0 && input_batch_init(&batch, WORD_BATCH_SIZE) != 0) {
+        fprintf(stderr, "ERROR: Failed to allocate input buffers\n");
+        rtn = -1;
+    }
+
+    while (rtn == 0 && input_read_batch(input, &batch) > 0) {
+        for (int word_num = 0; word_num < batch.count; word_num++) {
+            int length = batch.lengths[word_num];
+
+            // Every slot keeps room for a NULL terminator
+            int bucket_num = 0;
+            while ((uint32_t)length >= slot_size(bucket_num)) { bucket_num++; }
+
+            char slot[BLOCK_SIZE];
+            memset(slot, 0, sizeof(slot));
+            memcpy(slot, batch.words[word_num], length);
+
+            uint8_t info[2] = { (uint8_t)length, wordpack_classes(batch.words[word_num], length) };
+            if (fwrite(slot, 1, slot_size(bucket_num), slot_files[bucket_num]) != slot_size(bucket_num)
+            ||  fwrite(info, 1, sizeof(info), info_files[bucket_num]) != sizeof(info)) {
+                fprintf(stderr, "ERROR: Failed to write a temporary file\n");
+                rtn = -1;
+                break;
+            }
+
+            header.buckets[bucket_num].count++;
+            header.word_count++;
+        }
+    }
+    input_batch_free(&batch);
+
+    // Slots first, then lengths, then classes, for every bucket in turn
+    uint64_t offset = align_up(sizeof(PackHeader));
+    for (int bucket_num = 0; bucket_num < WORDPACK_BUCKETS; bucket_num++) {
+        PackBucketHeader *bucket = &header.buckets[bucket_num];
+        bucket->slots_offset   = offset;
+        bucket->lengths_offset = bucket->slots_offset   + align_up(bucket->count * bucket->slot_size);
+        bucket->classes_offset = bucket->lengths_offset + align_up(bucket->count);
+        offset                 = bucket->classes_offset + align_up(bucket->count);
+    }
+    header.file_size = offset;
+
+    // Written under a temporary name so a reader never maps a half-written file
+    char *temp_name = NULL;
+    FILE *pack_file = NULL;
+    if (rtn == 0 && asprintf(&temp_name, "%s.%d.tmp", file_name, (int)getpid()) < 0) {
+        temp_name = NULL;
+        rtn = -1;
+    }
+    if (rtn == 0 && (pack_file = fopen(temp_name, "wb")) == NULL) {
+        fprintf(stderr, "ERROR: Failed to open packed wordlist <%s>\n", temp_name);
+        rtn = -1;
+    }
+
+    if (rtn == 0) {
+        if (fwrite(&header, sizeof(PackHeader), 1, pack_file) != 1 || write_padding(pack_file, sizeof(PackHeader)) != 0) {
+            rtn = -1;
+        }
+
+        for (int bucket_num = 0; bucket_num < WORDPACK_BUCKETS && rtn == 0; bucket_num++) {
+            if (copy_section(pack_file, slot_files[bucket_num], 0, 1) != 0
+            ||  copy_section(pack_file, info_files[bucket_num], 0, 2) != 0
+            ||  copy_section(pack_file, info_files[bucket_num], 1, 2) != 0) {
+                rtn = -1;
+            }
+        }
+
+        if (fclose(pack_file) != 0) { rtn = -1; }
+        if (rtn == 0 && rename(temp_name, file_name) != 0) { rtn = -1; }
+
+        if (rtn != 0) {
+            fprintf(stderr, "ERROR: Failed to write packed wordlist <%s>\n", file_name);
+            unlink(temp_name);
+        }
+    }
+
+    for (int bucket_num = 0; bucket_num < WORDPACK_BUCKETS; bucket_num++) {
+        if (slot_files[bucket_num]) { fclose(slot_files[bucket_num]); }
+        if (info_files[bucket_num]) { fclose(info_files[bucket_num]); }
+    }
+    free(temp_name);
+    return rtn;
+}
@@ -0,0 +1,59 @@
+#ifndef WORDPACK_H
+#define WORDPACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "rules.h"
+
+// Bumped whenever the layout changes
+#define WORDPACK_VERSION 1
+
+// Words are stored in slots of 8, 16, 32 and BLOCK_SIZE bytes, each size in its own bucket
+#define WORDPACK_BUCKETS 4
+
+// Character classes a word contains, recorded for every word
+#define WORD_CLASS_LOWER   0x01
+#define WORD_CLASS_UPPER   0x02
+#define WORD_CLASS_DIGIT   0x04
+#define WORD_CLASS_SPECIAL 0x08
+#define WORD_CLASS_CONTROL 0x10
+#define WORD_CLASS_HIGH    0x20
+
+
+// One size of slot in a mapped packed wordlist
+// Word n is slot_size bytes at slots + n * slot_size, NULL padded, with its length and classes at lengths[n] and classes[n]
+typedef struct WordPackBucket {
+    const char    *slots;
+    const uint8_t *lengths;
+    const uint8_t *classes;
+    uint64_t       count;
+    uint32_t       slot_size;
+} WordPackBucket;
+
+
+// A packed wordlist, pointing into its mapping
+typedef struct WordPack {
+    WordPackBucket buckets[WORDPACK_BUCKETS];
+    uint64_t       word_count;
+} WordPack;
+
+
+struct WordReader;
+
+// Returns true if data starts with a packed wordlist header
+bool wordpack_detect(const char *data, size_t size);
+
+// Points pack into a packed wordlist of size bytes
+// Returns 0 on success, -1 if it's corrupt or was packed for another BLOCK_SIZE or byte order (an error has already been printed)
+int wordpack_parse(WordPack *pack, const char *data, size_t size);
+
+// Returns the WORD_CLASS_ bits for a word
+uint8_t wordpack_classes(const char *word, int length);
+
+// Packs every word left in input into file_name
+// Words are bucketed by slot size, so shorter words come first, otherwise they keep their order
+// Returns 0 on success, -1 on failure (an error has already been printed)
+int wordpack_write(struct WordReader *input, const char *file_name);
+
+#endif /* WORDPACK_H */
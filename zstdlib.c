@@ -0,0 +1,40 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include "zstdlib.h"
+
+
+static ZstdLib        zstd;
+static bool           zstd_loaded = false;
+static pthread_once_t zstd_once   = PTHREAD_ONCE_INIT;
+
+
+static void load_zstd(void) {
+    void *library = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) { return; }
+
+    zstd.create_dctx       = dlsym(library, "ZSTD_createDCtx");
+    zstd.free_dctx         = dlsym(library, "ZSTD_freeDCtx");
+    zstd.decompress_stream = dlsym(library, "ZSTD_decompressStream");
+    zstd.frame_size        = dlsym(library, "ZSTD_findFrameCompressedSize");
+    zstd.create_cctx       = dlsym(library, "ZSTD_createCCtx");
+    zstd.free_cctx         = dlsym(library, "ZSTD_freeCCtx");
+    zstd.compress          = dlsym(library, "ZSTD_compressCCtx");
+    zstd.compress_bound    = dlsym(library, "ZSTD_compressBound");
+    zstd.max_level         = dlsym(library, "ZSTD_maxCLevel");
+    zstd.is_error          = dlsym(library, "ZSTD_isError");
+    zstd.error_name        = dlsym(library, "ZSTD_getErrorName");
+
+    zstd_loaded = (zstd.create_dctx && zstd.free_dctx && zstd.decompress_stream && zstd.frame_size
+               &&  zstd.create_cctx && zstd.free_cctx && zstd.compress && zstd.compress_bound && zstd.max_level
+               &&  zstd.is_error && zstd.error_name);
+    if (!zstd_loaded) { dlclose(library); }
+}
+
+
+const ZstdLib *zstdlib_load(void) {
+    pthread_once(&zstd_once, load_zstd);
+    return (zstd_loaded ? &zstd : NULL);
+}
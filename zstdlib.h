@@ -0,0 +1,33 @@
+#ifndef ZSTDLIB_H
+#define ZSTDLIB_H
+
+#include <stddef.h>
+
+// The few libzstd calls hcre needs, loaded at run time so hcre builds and runs without it
+// Their signatures and the buffer structs are part of zstd's stable ABI
+
+typedef struct ZstdInBuffer  { const void *src; size_t size; size_t pos; } ZstdInBuffer;
+typedef struct ZstdOutBuffer { void       *dst; size_t size; size_t pos; } ZstdOutBuffer;
+
+typedef struct ZstdLib {
+    void       *(*create_dctx)(void);
+    size_t      (*free_dctx)(void *dctx);
+    size_t      (*decompress_stream)(void *dctx, ZstdOutBuffer *output, ZstdInBuffer *input);
+    size_t      (*frame_size)(const void *data, size_t length);
+
+    void       *(*create_cctx)(void);
+    size_t      (*free_cctx)(void *cctx);
+    size_t      (*compress)(void *cctx, void *output, size_t capacity, const void *input, size_t length, int level);
+    size_t      (*compress_bound)(size_t length);
+    int         (*max_level)(void);
+
+    unsigned    (*is_error)(size_t code);
+    const char *(*error_name)(size_t code);
+} ZstdLib;
+
+
+// Loads libzstd the first time it's called, safe to call from any thread
+// Returns the library's calls, or NULL if it isn't installed
+const ZstdLib *zstdlib_load(void);
+
+#endif /* ZSTDLIB_H */